@@ -0,0 +1,536 @@
+#include "config.h"
+#include "common.h"
+#include "bigint.h"
+#include "bigint_mb.h"
+#include "bigint_fixed.h"
+#include "cpu.h"
+#include "rsa.h"
+#include "rnd.h"
+#include "solovay_strassen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+// Micro-benchmarks of the bigint kernels. Every benchmark is calibrated
+// to a minimum trial time, warmed up and then timed over repeated trials;
+// the median and p99 per operation are reported, optionally as JSON that
+// a later run can compare against.
+
+#define MAX_SIZES 16
+#define MIN_SIZE 64 // the coprime operand is 32 bits shorter
+#define MAX_TRIALS 1000
+#define MIN_TRIALS 3
+#define MIN_TRIAL_NS 1e6 // 1ms
+
+static void print_usage()
+{
+    const char *usage_str =
+        "usage: rsa_bench [options]\n"
+        "options:\n"
+        "  --sizes=<bits,...>   operand sizes (default: 512,1024,2048,3072,\n"
+        "                       4096,8192)\n"
+        "  --filter=<text>      only benchmarks whose name contains text\n"
+        "  --trials=<n>         timed trials per benchmark (default: 51)\n"
+        "  --warmup=<n>         untimed trials before that (default: 3)\n"
+        "  --budget=<seconds>   stop a benchmark early past this time once\n"
+        "                       it has 3 trials (default: 2)\n"
+        "  --keygen-max=<bits>  largest keygen size (default: 2048)\n"
+        "  --json=<file>        write results as JSON\n"
+        "  --compare=<file>     compare against JSON from an earlier run\n"
+        "  --threshold=<pct>    median slowdown counted as a regression\n"
+        "                       (default: 5)";
+    puts(usage_str);
+}
+
+typedef struct
+{
+    size_t sizes[MAX_SIZES];
+    size_t size_count;
+    const char *filter;
+    unsigned trials;
+    unsigned warmup;
+    double budget;
+    size_t keygen_max;
+    const char *json_path;
+    const char *compare_path;
+    double threshold;
+} options_t;
+
+static options_t options = {
+    {512, 1024, 2048, 3072, 4096, 8192}, 6,
+    NULL, 51, 3, 2.0, 2048, NULL, NULL, 5.0
+};
+
+static int parse_sizes(const char *list)
+{
+    options.size_count = 0;
+    while (*list)
+    {
+        char *end;
+        unsigned long bits = strtoul(list, &end, 10);
+        if (end==list || bits<MIN_SIZE || bits%32 ||
+            options.size_count==MAX_SIZES)
+        {
+            return 1;
+        }
+        options.sizes[options.size_count++] = bits;
+        list = *end==',' ? end+1 : end;
+        if (*end && *end!=',')
+            return 1;
+    }
+    return !options.size_count;
+}
+
+static int parse_options(int argc, char *argv[])
+{
+    for (int i = 1; i<argc; i++)
+    {
+        const char *arg = argv[i];
+        unsigned long long bits;
+        if (!strncmp(arg, "--sizes=", 8))
+        {
+            if (parse_sizes(arg+8))
+            {
+                puts("invalid size list (multiples of 32 from 64 expected).");
+                return 1;
+            }
+        }
+        else if (!strncmp(arg, "--filter=", 9))
+            options.filter = arg+9;
+        else if (!strncmp(arg, "--json=", 7))
+            options.json_path = arg+7;
+        else if (!strncmp(arg, "--compare=", 10))
+            options.compare_path = arg+10;
+        else if (sscanf(arg, "--trials=%u", &options.trials)==1 &&
+            options.trials && options.trials<=MAX_TRIALS)
+            ;
+        else if (sscanf(arg, "--warmup=%u", &options.warmup)==1)
+            ;
+        else if (sscanf(arg, "--budget=%lf", &options.budget)==1)
+            ;
+        else if (sscanf(arg, "--keygen-max=%llu", &bits)==1)
+            options.keygen_max = (size_t)bits;
+        else if (sscanf(arg, "--threshold=%lf", &options.threshold)==1)
+            ;
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static double now_ns()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart*1e9/freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9+ts.tv_nsec;
+#endif
+}
+
+// Operands for one size, regenerated from the same seed for every run so
+// results stay comparable between builds.
+typedef struct
+{
+    size_t bits;
+    rnd_t rnd;
+    bigint_t *a; // bits wide
+    bigint_t *b; // bits wide
+    bigint_t *wide; // 2*bits wide, for division
+    bigint_t *n; // odd, bits wide
+    bigint_t *unit; // coprime to n
+    bigint_t *result;
+    bigint_t *extra;
+    bigint_t *extra2;
+    // Montgomery operands modulo n, 'size' limbs each
+    bigint_mont_t mont;
+    const bigint_fixed_kernel_t *kernel;
+    uint32_t *x;
+    uint32_t *y;
+    uint32_t *t; // 2*size+2 limbs
+} bench_args_t;
+
+typedef struct
+{
+    const char *name;
+    void (*run)(bench_args_t *args);
+    int keygen; // limited by --keygen-max
+} bench_t;
+
+static void rand_bits(rnd_t *rnd, bigint_t *b, size_t bits)
+{
+    size_t limbs = bits/32;
+    uint32_t *buf = malloc(limbs*sizeof(uint32_t));
+    rnd_bytes(rnd, (uint8_t *)buf, limbs*sizeof(uint32_t));
+    buf[limbs-1] |= 0x80000000;
+    bigint_load(b, (uint8_t *)buf, limbs*sizeof(uint32_t));
+    free(buf);
+}
+
+static void args_init(bench_args_t *args, size_t bits)
+{
+    static const uint8_t seed[CHACHA20_KEY_SIZE] = "rsa_bench fixed operand seed..";
+    args->bits = bits;
+    rnd_seed(&args->rnd, seed);
+    args->a = bigint_alloc();
+    args->b = bigint_alloc();
+    args->wide = bigint_alloc();
+    args->n = bigint_alloc();
+    args->unit = bigint_alloc();
+    args->result = bigint_alloc();
+    args->extra = bigint_alloc();
+    args->extra2 = bigint_alloc();
+    rand_bits(&args->rnd, args->a, bits);
+    rand_bits(&args->rnd, args->b, bits);
+    rand_bits(&args->rnd, args->wide, 2*bits);
+    rand_bits(&args->rnd, args->n, bits);
+    args->n->data[0] |= 1;
+    // walk up from a random value to one coprime to n
+    rand_bits(&args->rnd, args->unit, bits-32);
+    while (1)
+    {
+        bigint_gcd(args->unit, args->n, args->result);
+        if (bigint_equal(args->result, &small_bigint[1]))
+            break;
+        bigint_iadd(args->unit, &small_bigint[1]);
+    }
+    bigint_mont_init(&args->mont, args->n);
+    size_t s = args->mont.size;
+    args->kernel = bigint_fixed_select(s, cpu_features());
+    args->x = calloc(4*s+2, sizeof(uint32_t));
+    args->y = args->x+s;
+    args->t = args->y+s;
+    memcpy(args->x, args->unit->data, args->unit->size*sizeof(uint32_t));
+    memcpy(args->y, args->unit->data, args->unit->size*sizeof(uint32_t));
+}
+
+static void args_free(bench_args_t *args)
+{
+    bigint_free(args->a);
+    bigint_free(args->b);
+    bigint_free(args->wide);
+    bigint_free(args->n);
+    bigint_free(args->unit);
+    bigint_free(args->result);
+    bigint_free(args->extra);
+    bigint_free(args->extra2);
+    bigint_mont_free(&args->mont);
+    free(args->x);
+}
+
+static void run_mul(bench_args_t *args)
+{ bigint_mul(args->result, args->a, args->b); }
+
+static void run_div(bench_args_t *args)
+{ bigint_div(args->result, args->extra, args->wide, args->n); }
+
+static void run_modpow(bench_args_t *args)
+{ bigint_modpow(args->a, args->b, args->n, args->result); }
+
+static void run_mont_mul(bench_args_t *args)
+{ bigint_mont_mul(&args->mont, args->x, args->x, args->y, args->t); }
+
+// the kernels rsa.c picks for this size, fixed-width where available
+static void run_mont_mul_kernel(bench_args_t *args)
+{ args->kernel->mul(&args->mont, args->x, args->x, args->y, args->t); }
+
+static void run_mont_sqr_kernel(bench_args_t *args)
+{ args->kernel->sqr(&args->mont, args->x, args->x, args->t); }
+
+static void run_gcd(bench_args_t *args)
+{ bigint_gcd(args->a, args->b, args->result); }
+
+static void run_inv(bench_args_t *args)
+{ bigint_inv(args->unit, args->n, args->result); }
+
+static void run_jacobi(bench_args_t *args)
+{ bigint_jacobi(args->a, args->n); }
+
+// one round on an odd number: a Jacobi symbol and a modpow, the unit of
+// work keygen repeats for every candidate
+static void run_prime_round(bench_args_t *args)
+{ is_prime_ss(&args->rnd, args->n, 1); }
+
+static void run_keygen(bench_args_t *args)
+{
+    rsa_generate_keypair(&args->rnd, args->result, args->extra,
+        args->extra2, args->bits);
+}
+
+static const bench_t benches[] = {
+    {"bigint_mul", run_mul, 0},
+    {"bigint_div", run_div, 0},
+    {"bigint_modpow", run_modpow, 0},
+    {"bigint_mont_mul", run_mont_mul, 0},
+    {"mont_mul_kernel", run_mont_mul_kernel, 0},
+    {"mont_sqr_kernel", run_mont_sqr_kernel, 0},
+    {"bigint_gcd", run_gcd, 0},
+    {"bigint_inv", run_inv, 0},
+    {"bigint_jacobi", run_jacobi, 0},
+    {"is_prime_ss", run_prime_round, 0},
+    {"rsa_generate_keypair", run_keygen, 1}
+};
+
+typedef struct
+{
+    const char *name;
+    size_t bits;
+    size_t iterations; // operations per trial
+    size_t trials;
+    double median_ns; // per operation
+    double p99_ns;
+    double min_ns;
+    double mean_ns;
+} result_t;
+
+static double run_trial(const bench_t *bench, bench_args_t *args,
+    size_t iterations)
+{
+    double start = now_ns();
+    for (size_t i = 0; i<iterations; i++)
+        bench->run(args);
+    return (now_ns()-start)/iterations;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x<y ? -1 : x>y;
+}
+
+static void run_bench(const bench_t *bench, bench_args_t *args,
+    result_t *result)
+{
+    static double times[MAX_TRIALS];
+    // double the iterations until a trial is long enough to time
+    size_t iterations = 1;
+    while (iterations<((size_t)1<<24) &&
+        run_trial(bench, args, iterations)*iterations<MIN_TRIAL_NS)
+    {
+        iterations *= 2;
+    }
+    for (unsigned i = 0; i<options.warmup; i++)
+        run_trial(bench, args, iterations);
+    size_t trials = 0;
+    double start = now_ns();
+    while (trials<options.trials)
+    {
+        times[trials++] = run_trial(bench, args, iterations);
+        if (trials>=MIN_TRIALS && now_ns()-start>options.budget*1e9)
+            break;
+    }
+    qsort(times, trials, sizeof(double), compare_double);
+    double sum = 0;
+    for (size_t i = 0; i<trials; i++)
+        sum += times[i];
+    result->name = bench->name;
+    result->bits = args->bits;
+    result->iterations = iterations;
+    result->trials = trials;
+    result->median_ns = trials%2 ? times[trials/2] :
+        (times[trials/2-1]+times[trials/2])/2;
+    // nearest rank
+    result->p99_ns = times[(trials*99+99)/100-1];
+    result->min_ns = times[0];
+    result->mean_ns = sum/trials;
+}
+
+static void print_time(double ns)
+{
+    if (ns<1e3)
+        printf(" %10.1fns", ns);
+    else if (ns<1e6)
+        printf(" %10.2fus", ns/1e3);
+    else
+        printf(" %10.2fms", ns/1e6);
+}
+
+static int write_json(const char *path, const char *kernel,
+    const result_t *results, size_t count)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return 1;
+    // one benchmark per line, read back by load_baseline()
+    fprintf(f, "{\n  \"kernel\": \"%s\",\n  \"benchmarks\": [\n", kernel);
+    for (size_t i = 0; i<count; i++)
+    {
+        const result_t *r = &results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"bits\": %zu, "
+            "\"iterations\": %zu, \"trials\": %zu, \"median_ns\": %.1f, "
+            "\"p99_ns\": %.1f, \"min_ns\": %.1f, \"mean_ns\": %.1f}%s\n",
+            r->name, r->bits, r->iterations, r->trials, r->median_ns,
+            r->p99_ns, r->min_ns, r->mean_ns, i+1<count ? "," : "");
+    }
+    fputs("  ]\n}\n", f);
+    return fclose(f)!=0;
+}
+
+typedef struct
+{
+    char name[64];
+    size_t bits;
+    double median_ns;
+} baseline_t;
+
+static baseline_t *load_baseline(const char *path, size_t *count)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return NULL;
+    size_t capacity = 64;
+    baseline_t *entries = malloc(capacity*sizeof(baseline_t));
+    char line[512];
+    *count = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        const char *name = strstr(line, "\"name\": \"");
+        const char *bits = strstr(line, "\"bits\": ");
+        const char *median = strstr(line, "\"median_ns\": ");
+        if (!name || !bits || !median)
+            continue;
+        if (*count==capacity)
+        {
+            capacity *= 2;
+            entries = realloc(entries, capacity*sizeof(baseline_t));
+        }
+        baseline_t *entry = &entries[*count];
+        unsigned long long bits_value;
+        if (sscanf(name+9, "%63[^\"]", entry->name)==1 &&
+            sscanf(bits+8, "%llu", &bits_value)==1 &&
+            sscanf(median+13, "%lf", &entry->median_ns)==1)
+        {
+            entry->bits = (size_t)bits_value;
+            (*count)++;
+        }
+    }
+    fclose(f);
+    return entries;
+}
+
+// returns the number of regressions
+static size_t compare(const result_t *results, size_t count,
+    const baseline_t *baseline, size_t baseline_count)
+{
+    size_t regressions = 0;
+    printf("\n%-22s %6s %12s %12s %8s\n", "benchmark", "bits",
+        "baseline", "current", "change");
+    for (size_t i = 0; i<count; i++)
+    {
+        const result_t *r = &results[i];
+        const baseline_t *base = NULL;
+        for (size_t j = 0; j<baseline_count && !base; j++)
+        {
+            if (!strcmp(baseline[j].name, r->name) &&
+                baseline[j].bits==r->bits)
+            {
+                base = &baseline[j];
+            }
+        }
+        printf("%-22s %6zu", r->name, r->bits);
+        if (!base)
+        {
+            puts("  (not in baseline)");
+            continue;
+        }
+        double change = (r->median_ns/base->median_ns-1)*100;
+        print_time(base->median_ns);
+        print_time(r->median_ns);
+        printf(" %+7.1f%%", change);
+        if (change>options.threshold)
+        {
+            printf("  REGRESSION");
+            regressions++;
+        }
+        else if (change<-options.threshold)
+            printf("  improved");
+        putchar('\n');
+    }
+    return regressions;
+}
+
+int main(int argc, char *argv[])
+{
+    if (parse_options(argc, argv))
+        return 1;
+    const char *kernel = bigint_mb_select(cpu_features())->name;
+    size_t bench_count = sizeof(benches)/sizeof(benches[0]);
+    result_t *results = malloc(bench_count*options.size_count*
+        sizeof(result_t));
+    size_t count = 0;
+    printf("multi-buffer kernel: %s\n", kernel);
+    // what rsa.c picks for a 2048-bit modulus
+    printf("single-block kernel: %s\n",
+        bigint_fixed_select(64, cpu_features())->name);
+    printf("%-22s %6s %12s %12s %12s %10s\n", "benchmark", "bits",
+        "median", "p99", "min", "trials");
+    for (size_t s = 0; s<options.size_count; s++)
+    {
+        bench_args_t args;
+        args_init(&args, options.sizes[s]);
+        for (size_t i = 0; i<bench_count; i++)
+        {
+            const bench_t *bench = &benches[i];
+            if (options.filter && !strstr(bench->name, options.filter))
+                continue;
+            if (bench->keygen && args.bits>options.keygen_max)
+                continue;
+            result_t *r = &results[count++];
+            run_bench(bench, &args, r);
+            printf("%-22s %6zu", r->name, r->bits);
+            print_time(r->median_ns);
+            print_time(r->p99_ns);
+            print_time(r->min_ns);
+            printf(" %5zux%-4zu\n", r->trials, r->iterations);
+            fflush(stdout);
+        }
+        args_free(&args);
+    }
+    int status = 0;
+    if (options.json_path && write_json(options.json_path, kernel, results,
+        count))
+    {
+        printf("can't write %s.\n", options.json_path);
+        status = 1;
+    }
+    if (options.compare_path)
+    {
+        size_t baseline_count;
+        baseline_t *baseline = load_baseline(options.compare_path,
+            &baseline_count);
+        if (!baseline)
+        {
+            printf("can't read %s.\n", options.compare_path);
+            status = 1;
+        }
+        else
+        {
+            size_t regressions = compare(results, count, baseline,
+                baseline_count);
+            if (regressions)
+            {
+                printf("%zu regression(s) over %.1f%%.\n", regressions,
+                    options.threshold);
+                status = 1;
+            }
+            free(baseline);
+        }
+    }
+    free(results);
+    return status;
+}
@@ -0,0 +1,249 @@
+#include "config.h"
+#include "audit.h"
+#include "bigint.h"
+#include "rsa_util.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+    size_t count;
+    size_t capacity;
+    char **paths;
+    bigint_t **moduli;
+    size_t failed; // files that aren't keys
+} audit_keys_t;
+
+// one tree level computed from the level above or below it
+typedef struct
+{
+    bigint_t **src;
+    size_t src_count;
+    bigint_t **nodes; // the product tree level being reduced
+    bigint_t **dst;
+} audit_level_t;
+
+typedef void (*audit_proc_t)(void *arg, size_t i);
+
+typedef struct
+{
+    mutex_t lock;
+    size_t next;
+    size_t count;
+    audit_proc_t proc;
+    void *arg;
+} audit_loop_t;
+
+static void add_key(void *user, const char *path)
+{
+    audit_keys_t *keys = user;
+    rsa_key_t key;
+    if (rsa_key_map(path, &key))
+    {
+        printf("%s: invalid key file.\n", path);
+        keys->failed++;
+        return;
+    }
+    if (keys->count==keys->capacity)
+    {
+        keys->capacity = keys->capacity ? 2*keys->capacity : 64;
+        keys->paths = realloc(keys->paths,
+            keys->capacity*sizeof(char *));
+        keys->moduli = realloc(keys->moduli,
+            keys->capacity*sizeof(bigint_t *));
+    }
+    // copied out, the mapping is released right away
+    bigint_t *n = bigint_alloc_reserve(key.n->size);
+    bigint_copy(key.n, n);
+    rsa_key_free(&key);
+    size_t len = strlen(path);
+    char *copy = malloc(len+1);
+    memcpy(copy, path, len+1);
+    keys->paths[keys->count] = copy;
+    keys->moduli[keys->count] = n;
+    keys->count++;
+}
+
+static void loop_proc(void *arg)
+{
+    audit_loop_t *loop = arg;
+    while (1)
+    {
+        mutex_lock(&loop->lock);
+        size_t i = loop->next++;
+        mutex_unlock(&loop->lock);
+        if (i>=loop->count)
+            break;
+        loop->proc(loop->arg, i);
+    }
+}
+
+// Run proc(arg, i) for every i in [0, count) on up to 'workers' threads,
+// the caller included. Items are handed out one at a time since the
+// sizes within a level differ.
+static void parallel_for(size_t workers, size_t count, audit_proc_t proc,
+    void *arg)
+{
+    audit_loop_t loop;
+    mutex_init(&loop.lock);
+    loop.next = 0;
+    loop.count = count;
+    loop.proc = proc;
+    loop.arg = arg;
+    size_t helpers = min(workers, count);
+    thread_t *threads = malloc(max(helpers, 1)*sizeof(thread_t));
+    size_t started = 0;
+    for (; started+1<helpers; started++)
+    {
+        if (thread_create(&threads[started], loop_proc, &loop))
+            break;
+    }
+    loop_proc(&loop);
+    for (size_t i = 0; i<started; i++)
+        thread_join(threads[i]);
+    free(threads);
+    mutex_destroy(&loop.lock);
+}
+
+// node i of the next level up = src[2i]*src[2i+1]
+static void product_proc(void *arg, size_t i)
+{
+    audit_level_t *level = arg;
+    bigint_t *dst = level->dst[i] = bigint_alloc();
+    if (2*i+1<level->src_count)
+        bigint_mul(dst, level->src[2*i], level->src[2*i+1]);
+    else
+        bigint_copy(level->src[2*i], dst);
+}
+
+// remainder i of the next level down = (parent remainder) mod nodes[i]^2
+static void remainder_proc(void *arg, size_t i)
+{
+    audit_level_t *level = arg;
+    bigint_t *square = bigint_alloc();
+    bigint_mul(square, level->nodes[i], level->nodes[i]);
+    bigint_t *q = bigint_alloc();
+    bigint_t *dst = level->dst[i] = bigint_alloc();
+    bigint_div(q, dst, level->src[i/2], square);
+    bigint_free(q);
+    bigint_free(square);
+}
+
+// leaf i: gcd((P mod n^2)/n, n), 1 unless n shares a prime
+static void leaf_proc(void *arg, size_t i)
+{
+    audit_level_t *level = arg;
+    bigint_t *n = level->nodes[i];
+    bigint_t *q = bigint_alloc();
+    bigint_t *r = bigint_alloc();
+    bigint_div(q, r, level->src[i], n);
+    bigint_t *g = level->dst[i] = bigint_alloc();
+    bigint_gcd(q, n, g);
+    bigint_free(q);
+    bigint_free(r);
+}
+
+static void free_level(bigint_t **level, size_t count)
+{
+    for (size_t i = 0; i<count; i++)
+        bigint_free(level[i]);
+    free(level);
+}
+
+// Batch GCD over all moduli; 'factors[i]' receives the product of the
+// primes n_i shares with the other moduli, 1 if none.
+static void batch_gcd(size_t workers, bigint_t **moduli, size_t count,
+    bigint_t **factors)
+{
+    // product tree, level 0 are the moduli themselves
+    bigint_t **tree[sizeof(size_t)*8+1];
+    size_t sizes[sizeof(size_t)*8+1];
+    tree[0] = moduli;
+    sizes[0] = count;
+    size_t depth = 0;
+    while (sizes[depth]>1)
+    {
+        audit_level_t level;
+        level.src = tree[depth];
+        level.src_count = sizes[depth];
+        level.dst = malloc((sizes[depth]+1)/2*sizeof(bigint_t *));
+        parallel_for(workers, (sizes[depth]+1)/2, product_proc, &level);
+        depth++;
+        tree[depth] = level.dst;
+        sizes[depth] = (sizes[depth-1]+1)/2;
+    }
+    // remainder tree, starting below the root where P mod root^2 = P
+    bigint_t **rems = tree[depth];
+    tree[depth] = NULL;
+    while (depth--)
+    {
+        audit_level_t level;
+        level.src = rems;
+        level.nodes = tree[depth];
+        level.dst = malloc(sizes[depth]*sizeof(bigint_t *));
+        parallel_for(workers, sizes[depth], remainder_proc, &level);
+        free_level(rems, sizes[depth+1]);
+        if (depth)
+            free_level(tree[depth], sizes[depth]);
+        rems = level.dst;
+    }
+    audit_level_t level;
+    level.src = rems;
+    level.nodes = moduli;
+    level.dst = factors;
+    parallel_for(workers, count, leaf_proc, &level);
+    free_level(rems, count);
+}
+
+int audit_run(const char *src, const batch_config_t *config)
+{
+    audit_keys_t keys;
+    memset(&keys, 0, sizeof(keys));
+    int list_failed = batch_list(src, add_key, &keys);
+    if (list_failed && !keys.count && !keys.failed)
+        return 1;
+    size_t workers = config->workers ? config->workers : thread_cpu_count();
+    size_t weak = 0;
+    if (keys.count>1)
+    {
+        bigint_t **factors = malloc(keys.count*sizeof(bigint_t *));
+        batch_gcd(workers, keys.moduli, keys.count, factors);
+        // only the few weak keys are compared pairwise, to name them
+        size_t *weak_keys = malloc(keys.count*sizeof(size_t));
+        for (size_t i = 0; i<keys.count; i++)
+        {
+            if (!bigint_equal(factors[i], &small_bigint[1]))
+                weak_keys[weak++] = i;
+            bigint_free(factors[i]);
+        }
+        free(factors);
+        bigint_t *g = bigint_alloc();
+        for (size_t i = 0; i<weak; i++)
+        {
+            for (size_t j = i+1; j<weak; j++)
+            {
+                bigint_t *a = keys.moduli[weak_keys[i]];
+                bigint_t *b = keys.moduli[weak_keys[j]];
+                bigint_gcd(a, b, g);
+                if (bigint_equal(g, &small_bigint[1]))
+                    continue;
+                printf("%s and %s %s.\n", keys.paths[weak_keys[i]],
+                    keys.paths[weak_keys[j]], bigint_equal(a, b) ?
+                    "have the same modulus" : "share a prime factor");
+            }
+        }
+        bigint_free(g);
+        free(weak_keys);
+    }
+    printf("%zu keys, %zu weak.\n", keys.count, weak);
+    for (size_t i = 0; i<keys.count; i++)
+    {
+        free(keys.paths[i]);
+        bigint_free(keys.moduli[i]);
+    }
+    free(keys.paths);
+    free(keys.moduli);
+    return weak || keys.failed || list_failed;
+}
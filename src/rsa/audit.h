@@ -0,0 +1,21 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+#include "batch.h"
+
+// Shared-factor audit of many public keys. Moduli that share a prime
+// are all broken by one gcd, so a corpus made with a weak random source
+// is checked as a whole with Bernstein's batch GCD: a product tree over
+// all moduli, a remainder tree reducing the product modulo every n^2 on
+// the way down, and one gcd per key at the leaves. That is a handful of
+// big products and divisions per tree level instead of a gcd per pair of
+// keys, and gets quasi-linear with subquadratic bigint multiplication.
+//
+// Every tree level runs on the worker threads. The product tree is the
+// largest allocation; the remainder tree only keeps the level being
+// computed and its parent, and frees product levels as it descends.
+
+// Audit every key file of 'src' (a directory or a list file, as for
+// batch_run()), printing each pair of keys sharing a factor and a
+// summary. returns nonzero if any key is weak or couldn't be read
+int audit_run(const char *src, const batch_config_t *config);
@@ -0,0 +1,905 @@
+#include "config.h"
+#include "batch.h"
+#include "rsa_util.h"
+#include "dumb_padding.h"
+#include "lz.h"
+#include "sign.h"
+#include "thread.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <dirent.h>
+#else
+#include <io.h>
+#include <direct.h>
+#include <windows.h>
+#ifndef S_ISDIR
+#define S_ISDIR(mode) (((mode)&S_IFMT)==S_IFDIR)
+#endif
+#endif
+
+// Compressed plaintext is a stream of chunks of up to LZ_CHUNK_SIZE
+// input bytes, each a 4-byte little-endian payload size followed by the
+// payload, stored as is when it didn't get smaller (top bit set).
+#define LZ_CHUNK_SIZE (64<<10)
+#define LZ_CHUNK_STORED 0x80000000
+#define LZ_CHUNK_MAX (4+LZ_BOUND(LZ_CHUNK_SIZE))
+
+// source of the bytes to encrypt: the file itself or its chunks
+typedef struct
+{
+    FILE *file;
+    int compress;
+    uint8_t *raw;
+    uint8_t *chunk;
+    size_t size; // bytes in 'chunk'
+    size_t pos; // bytes of 'chunk' handed out
+} batch_reader_t;
+
+// sink of decrypted bytes: the file itself or the decompressor
+typedef struct
+{
+    FILE *file;
+    int compressed;
+    uint64_t left; // plaintext bytes still to come, the rest is padding
+    uint8_t *raw;
+    uint8_t *chunk;
+    size_t size; // bytes gathered in 'chunk'
+    int result;
+} batch_writer_t;
+
+static int batch_seek(FILE *f, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static int batch_file_size(FILE *f, uint64_t *size)
+{
+#ifdef _WIN32
+    if (_fseeki64(f, 0, SEEK_END))
+        return 1;
+    __int64 pos = _ftelli64(f);
+#else
+    if (fseeko(f, 0, SEEK_END))
+        return 1;
+    off_t pos = ftello(f);
+#endif
+    if (pos<0)
+        return 1;
+    *size = (uint64_t)pos;
+    return 0;
+}
+
+static int reader_fill(batch_reader_t *reader)
+{
+    size_t raw_size = fread(reader->raw, 1, LZ_CHUNK_SIZE, reader->file);
+    if (!raw_size)
+        return 0;
+    size_t size = lz_compress(reader->raw, raw_size, reader->chunk+4);
+    if (size>=raw_size)
+    {
+        memcpy(reader->chunk+4, reader->raw, raw_size);
+        size = raw_size|LZ_CHUNK_STORED;
+    }
+    store32_le(reader->chunk, (uint32_t)size);
+    reader->size = 4+(size&~LZ_CHUNK_STORED);
+    reader->pos = 0;
+    return 1;
+}
+
+// returns less than 'size' only at the end of the source
+static size_t reader_read(batch_reader_t *reader, uint8_t *dst, size_t size)
+{
+    if (!reader->compress)
+        return fread(dst, 1, size, reader->file);
+    size_t done = 0;
+    while (done<size)
+    {
+        if (reader->pos==reader->size && !reader_fill(reader))
+            break;
+        size_t n = min(size-done, reader->size-reader->pos);
+        memcpy(dst+done, reader->chunk+reader->pos, n);
+        reader->pos += n;
+        done += n;
+    }
+    return done;
+}
+
+static void writer_chunk(batch_writer_t *writer)
+{
+    uint32_t header = load32_le(writer->chunk);
+    const uint8_t *payload = writer->chunk+4;
+    size_t size = header&~LZ_CHUNK_STORED;
+    if (header&LZ_CHUNK_STORED)
+        fwrite(payload, 1, size, writer->file);
+    else if (lz_decompress(payload, size, writer->raw, LZ_CHUNK_SIZE,
+        &size)==LZ_OK)
+    {
+        fwrite(writer->raw, 1, size, writer->file);
+    }
+    else
+        writer->result = BATCH_ERR_COMPRESSED;
+    writer->size = 0;
+}
+
+static void writer_write(batch_writer_t *writer, const uint8_t *src,
+    size_t size)
+{
+    size = (size_t)min(size, writer->left);
+    writer->left -= size;
+    if (!writer->compressed)
+    {
+        fwrite(src, 1, size, writer->file);
+        return;
+    }
+    while (size && writer->result==BATCH_OK)
+    {
+        // the header, then the payload it announces
+        size_t want = 4;
+        if (writer->size>=4)
+        {
+            uint32_t header = load32_le(writer->chunk);
+            want += header&~LZ_CHUNK_STORED;
+            if (want==4 || want>LZ_CHUNK_MAX ||
+                ((header&LZ_CHUNK_STORED) && want>4+LZ_CHUNK_SIZE))
+            {
+                writer->result = BATCH_ERR_COMPRESSED;
+                break;
+            }
+        }
+        size_t n = min(size, want-writer->size);
+        memcpy(writer->chunk+writer->size, src, n);
+        writer->size += n;
+        src += n;
+        size -= n;
+        if (writer->size>4 && writer->size==want)
+            writer_chunk(writer);
+    }
+}
+
+static int encrypt_file(rsa_ctx_t *ctx, bigint_t *n, rnd_t *rnd,
+    int compress, FILE *src, FILE *dst)
+{
+    size_t src_block_size, dst_block_size;
+    rsa_get_block_sizes('e', n, &src_block_size, &dst_block_size);
+    // transform full blocks, apply special case for the rest
+    size_t buf_sz = dst_block_size;
+    uint8_t *buf = malloc(buf_sz);
+    size_t zbytes = dst_block_size-src_block_size;
+    assert(zbytes<=sizeof(uint32_t));
+    batch_reader_t reader;
+    reader.file = src;
+    reader.compress = compress;
+    reader.raw = reader.chunk = NULL;
+    if (compress)
+    {
+        reader.raw = malloc(LZ_CHUNK_SIZE+LZ_CHUNK_MAX);
+        reader.chunk = reader.raw+LZ_CHUNK_SIZE;
+    }
+    reader.size = reader.pos = 0;
+    // full blocks are transformed in batches, one per SIMD lane
+    size_t batch = ctx->mb->lanes;
+    uint8_t *batch_buf = malloc(batch*buf_sz);
+    size_t bytes_read = src_block_size;
+    size_t blocks = 0;
+    int result = BATCH_OK;
+    while (bytes_read==src_block_size)
+    {
+        STATS_BEGIN(read_start);
+        for (blocks = 0; blocks<batch; blocks++)
+        {
+            uint8_t *block = batch_buf+blocks*buf_sz;
+            // XXX: valid for little endian only!
+            bytes_read = reader_read(&reader, block, src_block_size);
+            memset(block+buf_sz-zbytes, 0, zbytes);
+            if (bytes_read!=src_block_size)
+                break;
+        }
+        STATS_END(STAT_READ, read_start);
+        STATS_BEGIN(transform_start);
+        rsa_transform_batch(ctx, batch_buf, batch_buf, blocks);
+        STATS_END(STAT_TRANSFORM, transform_start);
+        STATS_BEGIN(write_start);
+        for (size_t i = 0; i<blocks; i++)
+            fwrite(batch_buf+i*buf_sz, 1, dst_block_size, dst);
+        STATS_END(STAT_WRITE, write_start);
+    }
+    // keep the partially read block for padding
+    memcpy(buf, batch_buf+blocks*buf_sz, buf_sz);
+    free(batch_buf);
+    free(reader.raw);
+    if (ferror(src))
+    {
+        result = BATCH_ERR_IO;
+        goto done;
+    }
+    size_t flags = compress ? DP_COMPRESSED : 0;
+    size_t param = flags;
+    int pad_result = dp_pad(rnd, buf, src_block_size, bytes_read, &param);
+    if (pad_result!=DP_OK)
+    {
+        if (pad_result!=DP_MORE)
+        {
+            result = BATCH_ERR_PADDING;
+            goto done;
+        }
+        STATS_BEGIN(pad_start);
+        rsa_transform_ctx(ctx, buf, buf);
+        STATS_END(STAT_TRANSFORM, pad_start);
+        fwrite(buf, 1, buf_sz, dst);
+        // the spare high bytes hold ciphertext now, keep m < n
+        memset(buf+buf_sz-zbytes, 0, zbytes);
+        param |= flags;
+        if (dp_pad(rnd, buf, src_block_size, 0, &param)!=DP_OK)
+        {
+            result = BATCH_ERR_PADDING;
+            goto done;
+        }
+    }
+    STATS_BEGIN(last_start);
+    rsa_transform_ctx(ctx, buf, buf);
+    STATS_END(STAT_TRANSFORM, last_start);
+    fwrite(buf, 1, buf_sz, dst);
+    if (ferror(dst))
+        result = BATCH_ERR_IO;
+done:
+    free(buf);
+    return result;
+}
+
+static int decrypt_file(rsa_ctx_t *ctx, bigint_t *n, FILE *src, FILE *dst)
+{
+    size_t src_block_size, dst_block_size;
+    rsa_get_block_sizes('d', n, &src_block_size, &dst_block_size);
+    // from the file itself, a stat() size may be 32 bits wide
+    uint64_t src_size;
+    if (batch_file_size(src, &src_size))
+        return BATCH_ERR_IO;
+    uint64_t count = src_size/src_block_size;
+    if (!count)
+        return BATCH_ERR_PADDING;
+    size_t buf_sz = src_block_size;
+    uint8_t *last = malloc(buf_sz);
+    // The last block goes first: its padding tells where the plaintext
+    // ends and whether it's compressed, so nothing past the end is ever
+    // written and the stream can go straight through the decompressor.
+    STATS_BEGIN(last_start);
+    if (batch_seek(src, (count-1)*src_block_size) ||
+        fread(last, 1, src_block_size, src)!=src_block_size ||
+        batch_seek(src, 0))
+    {
+        free(last);
+        return BATCH_ERR_IO;
+    }
+    rsa_transform_ctx(ctx, last, last);
+    STATS_END(STAT_TRANSFORM, last_start);
+    size_t padding = 0;
+    uint64_t src_plain_size = count*dst_block_size;
+    if (dp_depad(last, dst_block_size, &padding)!=DP_OK ||
+        (padding&~DP_COMPRESSED)>src_plain_size)
+    {
+        free(last);
+        return BATCH_ERR_PADDING;
+    }
+    batch_writer_t writer;
+    writer.file = dst;
+    writer.compressed = (padding&DP_COMPRESSED)!=0;
+    writer.left = src_plain_size-(padding&~DP_COMPRESSED);
+    writer.raw = writer.chunk = NULL;
+    if (writer.compressed)
+    {
+        writer.raw = malloc(LZ_CHUNK_SIZE+LZ_CHUNK_MAX);
+        writer.chunk = writer.raw+LZ_CHUNK_SIZE;
+    }
+    writer.size = 0;
+    writer.result = BATCH_OK;
+    // the other blocks are transformed in batches, one per SIMD lane
+    size_t batch = ctx->mb->lanes;
+    uint8_t *batch_buf = malloc(batch*buf_sz);
+    for (uint64_t done = 0; done+1<count && writer.result==BATCH_OK;)
+    {
+        size_t blocks = (size_t)min(batch, count-1-done);
+        STATS_BEGIN(read_start);
+        size_t bytes_read = fread(batch_buf, 1, blocks*buf_sz, src);
+        STATS_END(STAT_READ, read_start);
+        if (bytes_read!=blocks*buf_sz)
+        {
+            writer.result = BATCH_ERR_IO;
+            break;
+        }
+        STATS_BEGIN(transform_start);
+        rsa_transform_batch(ctx, batch_buf, batch_buf, blocks);
+        STATS_END(STAT_TRANSFORM, transform_start);
+        STATS_BEGIN(write_start);
+        for (size_t i = 0; i<blocks; i++)
+            writer_write(&writer, batch_buf+i*buf_sz, dst_block_size);
+        STATS_END(STAT_WRITE, write_start);
+        done += blocks;
+    }
+    writer_write(&writer, last, dst_block_size);
+    // a chunk cut short means the padding or the stream is damaged
+    if (writer.result==BATCH_OK && writer.size)
+        writer.result = BATCH_ERR_COMPRESSED;
+    if (writer.result==BATCH_OK && ferror(dst))
+        writer.result = BATCH_ERR_IO;
+    free(batch_buf);
+    free(writer.raw);
+    free(last);
+    return writer.result;
+}
+
+int batch_transform(char mode, rsa_ctx_t *ctx, bigint_t *n, rnd_t *rnd,
+    int compress, FILE *src, FILE *dst)
+{
+    if (mode=='e')
+        return encrypt_file(ctx, n, rnd, compress, src, dst);
+    return decrypt_file(ctx, n, src, dst);
+}
+
+const char *batch_error(int result)
+{
+    switch (result)
+    {
+    case BATCH_OK:
+        return "ok";
+    case BATCH_ERR_SOURCE:
+        return "can't open source file";
+    case BATCH_ERR_DESTINATION:
+        return "can't open destination file";
+    case BATCH_ERR_PADDING:
+        return "invalid padding or can't apply padding";
+    case BATCH_ERR_PATH:
+        return "path is outside the destination directory";
+    case BATCH_ERR_SIGNATURE:
+        return "signature is missing or invalid";
+    case BATCH_ERR_COMPRESSED:
+        return "compressed data is corrupt";
+    }
+    return "i/o error";
+}
+
+typedef struct
+{
+    char *src;
+    char *dst;
+} batch_job_t;
+
+// jobs found by the walk, waiting for a worker
+typedef struct
+{
+    mutex_t lock;
+    cond_t ready; // a job was queued or the walk is over
+    cond_t space; // a job was taken
+    batch_job_t **jobs;
+    size_t capacity;
+    size_t head;
+    size_t count;
+    int closed;
+} batch_queue_t;
+
+typedef struct
+{
+    char mode;
+    const rsa_key_t *key;
+    int compress;
+    batch_queue_t queue;
+    mutex_t report_lock;
+    size_t files;
+    size_t failed;
+    // set by batch_list(), takes every file instead of the queue
+    batch_file_proc_t proc;
+    void *user;
+#ifndef _WIN32
+    // the destination, skipped when it lies inside the source tree
+    dev_t dst_dev;
+    ino_t dst_ino;
+#endif
+} batch_t;
+
+typedef struct
+{
+    batch_t *batch;
+    rsa_ctx_t ctx;
+    rnd_t rnd;
+    thread_t thread;
+} batch_worker_t;
+
+static void queue_push(batch_queue_t *queue, batch_job_t *job)
+{
+    mutex_lock(&queue->lock);
+    while (queue->count==queue->capacity)
+        cond_wait(&queue->space, &queue->lock);
+    queue->jobs[(queue->head+queue->count)%queue->capacity] = job;
+    queue->count++;
+    cond_signal(&queue->ready);
+    mutex_unlock(&queue->lock);
+}
+
+// returns NULL once the queue is closed and drained, or right away if it
+// is empty and 'wait' is not set
+static batch_job_t *queue_pop(batch_queue_t *queue, int wait)
+{
+    mutex_lock(&queue->lock);
+    while (wait && !queue->count && !queue->closed)
+        cond_wait(&queue->ready, &queue->lock);
+    batch_job_t *job = NULL;
+    if (queue->count)
+    {
+        job = queue->jobs[queue->head];
+        queue->head = (queue->head+1)%queue->capacity;
+        queue->count--;
+        cond_signal(&queue->space);
+    }
+    mutex_unlock(&queue->lock);
+    return job;
+}
+
+static void queue_close(batch_queue_t *queue)
+{
+    mutex_lock(&queue->lock);
+    queue->closed = 1;
+    cond_broadcast(&queue->ready);
+    mutex_unlock(&queue->lock);
+}
+
+static void report(batch_t *batch, const char *path, int result)
+{
+    mutex_lock(&batch->report_lock);
+    batch->files++;
+    if (result!=BATCH_OK)
+    {
+        batch->failed++;
+        printf("%s: %s.\n", path, batch_error(result));
+    }
+    mutex_unlock(&batch->report_lock);
+}
+
+static char *join_path(const char *dir, const char *name)
+{
+    size_t dir_len = strlen(dir);
+    size_t name_len = strlen(name);
+    char *path = malloc(dir_len+name_len+2);
+    memcpy(path, dir, dir_len);
+    path[dir_len] = '/';
+    memcpy(path+dir_len+1, name, name_len+1);
+    return path;
+}
+
+// returns nonzero if 'path' isn't a directory afterwards
+static int make_dir(const char *path)
+{
+#ifdef _WIN32
+    int failed = _mkdir(path);
+#else
+    int failed = mkdir(path, 0777);
+#endif
+    struct stat info;
+    return failed && (errno!=EEXIST || stat(path, &info) ||
+        !S_ISDIR(info.st_mode));
+}
+
+// 'dst' is taken over; NULL when verifying, where it names the signature
+static void submit(batch_t *batch, const char *src, char *dst)
+{
+    if (batch->proc)
+    {
+        batch->proc(batch->user, src);
+        free(dst);
+        return;
+    }
+    batch_job_t *job = malloc(sizeof(batch_job_t)+strlen(src)+1);
+    job->src = (char *)(job+1);
+    strcpy(job->src, src);
+    if (!dst)
+    {
+        size_t len = strlen(src);
+        dst = malloc(len+5);
+        memcpy(dst, src, len);
+        memcpy(dst+len, ".sig", 5);
+    }
+    job->dst = dst;
+    queue_push(&batch->queue, job);
+}
+
+static int is_signature(const char *name)
+{
+    size_t len = strlen(name);
+    return len>=4 && !strcmp(name+len-4, ".sig");
+}
+
+// 'dst_dir' is NULL when verifying or listing
+static void walk_dir(batch_t *batch, const char *src_dir,
+    const char *dst_dir)
+{
+    if (dst_dir && make_dir(dst_dir))
+    {
+        report(batch, dst_dir, BATCH_ERR_DESTINATION);
+        return;
+    }
+#ifdef _WIN32
+    char *pattern = join_path(src_dir, "*");
+    WIN32_FIND_DATAA entry;
+    HANDLE find = FindFirstFileA(pattern, &entry);
+    free(pattern);
+    if (find==INVALID_HANDLE_VALUE)
+    {
+        report(batch, src_dir, BATCH_ERR_SOURCE);
+        return;
+    }
+    do
+    {
+        const char *name = entry.cFileName;
+        if (!strcmp(name, ".") || !strcmp(name, "..") ||
+            entry.dwFileAttributes&FILE_ATTRIBUTE_REPARSE_POINT)
+        {
+            continue;
+        }
+        char *src = join_path(src_dir, name);
+        char *dst = dst_dir ? join_path(dst_dir, name) : NULL;
+        if (entry.dwFileAttributes&FILE_ATTRIBUTE_DIRECTORY)
+        {
+            walk_dir(batch, src, dst);
+            free(dst);
+        }
+        else if (dst || batch->mode!='v' || !is_signature(name))
+            submit(batch, src, dst);
+        free(src);
+    } while (FindNextFileA(find, &entry));
+    FindClose(find);
+#else
+    DIR *dir = opendir(src_dir);
+    if (!dir)
+    {
+        report(batch, src_dir, BATCH_ERR_SOURCE);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        const char *name = entry->d_name;
+        if (!strcmp(name, ".") || !strcmp(name, ".."))
+            continue;
+        char *src = join_path(src_dir, name);
+        struct stat info;
+        // symbolic links are not followed
+        if (lstat(src, &info))
+            report(batch, src, BATCH_ERR_SOURCE);
+        else if (S_ISDIR(info.st_mode) && (!dst_dir ||
+            info.st_dev!=batch->dst_dev || info.st_ino!=batch->dst_ino))
+        {
+            char *dst = dst_dir ? join_path(dst_dir, name) : NULL;
+            walk_dir(batch, src, dst);
+            free(dst);
+        }
+        else if (S_ISREG(info.st_mode) && dst_dir)
+            submit(batch, src, join_path(dst_dir, name));
+        else if (S_ISREG(info.st_mode) && (batch->mode!='v' ||
+            !is_signature(name)))
+        {
+            submit(batch, src, NULL);
+        }
+        free(src);
+    }
+    closedir(dir);
+#endif
+}
+
+// Queue every path listed in 'list', mirrored under 'dst_dir'.
+static void walk_list(batch_t *batch, FILE *list, const char *dst_dir)
+{
+    char line[4096];
+    while (fgets(line, sizeof(line), list))
+    {
+        size_t len = strcspn(line, "\r\n");
+        if (len==sizeof(line)-1)
+        {
+            // too long to be a path, skip the rest of it
+            report(batch, "(long line)", BATCH_ERR_PATH);
+            int c;
+            while ((c = fgetc(list))!=EOF && c!='\n')
+                ;
+            continue;
+        }
+        line[len] = 0;
+        if (!len)
+            continue;
+        if (!dst_dir)
+        {
+            submit(batch, line, NULL);
+            continue;
+        }
+        // absolute entries land relative to the destination too
+        const char *rel = line;
+        while (*rel=='/' || *rel=='\\')
+            rel++;
+        // refuse ".." (and on Windows drive or stream) components, create
+        // the parent directories
+        char *dst = join_path(dst_dir, rel);
+        char *part = dst+strlen(dst_dir)+1;
+        int result = BATCH_OK;
+        while (result==BATCH_OK)
+        {
+            size_t part_len = strcspn(part, "/\\");
+            if (part_len==2 && !strncmp(part, "..", 2))
+                result = BATCH_ERR_PATH;
+#ifdef _WIN32
+            // "C:x" is relative to the drive, "x:y" names a stream
+            else if (memchr(part, ':', part_len))
+                result = BATCH_ERR_PATH;
+#endif
+            else if (!part[part_len])
+                break;
+            else
+            {
+                char sep = part[part_len];
+                part[part_len] = 0;
+                if (make_dir(dst))
+                    result = BATCH_ERR_DESTINATION;
+                part[part_len] = sep;
+                part += part_len+1;
+            }
+        }
+        if (result!=BATCH_OK)
+        {
+            report(batch, line, result);
+            free(dst);
+        }
+        else
+            submit(batch, line, dst);
+    }
+}
+
+static int run_job(batch_worker_t *worker, const batch_job_t *job)
+{
+    FILE *src = fopen(job->src, "rb");
+    if (!src)
+        return BATCH_ERR_SOURCE;
+    FILE *dst = fopen(job->dst, "wb");
+    if (!dst)
+    {
+        fclose(src);
+        return BATCH_ERR_DESTINATION;
+    }
+    int result = batch_transform(worker->batch->mode, &worker->ctx,
+        worker->batch->key->n, &worker->rnd, worker->batch->compress, src,
+        dst);
+    fclose(src);
+    if (fclose(dst) && result==BATCH_OK)
+        result = BATCH_ERR_IO;
+    // don't leave partial output behind
+    if (result!=BATCH_OK)
+        remove(job->dst);
+    return result;
+}
+
+// Hash the file and load its signature as a block for the batch.
+static int load_signature(batch_worker_t *worker, const batch_job_t *job,
+    uint8_t digest[SHA256_DIGEST_SIZE], uint8_t *block)
+{
+    FILE *src = fopen(job->src, "rb");
+    if (!src)
+        return BATCH_ERR_SOURCE;
+    int result = sign_digest_file(src, digest);
+    fclose(src);
+    if (result!=SIGN_OK)
+        return BATCH_ERR_IO;
+    FILE *sig_file = fopen(job->dst, "rb");
+    if (!sig_file)
+        return BATCH_ERR_SIGNATURE;
+    // one byte over, to tell an oversized signature from a valid one
+    size_t sig_size = sign_size(worker->batch->key->n);
+    uint8_t *sig = malloc(sig_size+1);
+    size_t bytes_read = fread(sig, 1, sig_size+1, sig_file);
+    fclose(sig_file);
+    result = sign_load(&worker->ctx, worker->batch->key->n, sig, bytes_read,
+        block);
+    free(sig);
+    return result==SIGN_OK ? BATCH_OK : BATCH_ERR_SIGNATURE;
+}
+
+static void verify_jobs(batch_worker_t *worker)
+{
+    batch_t *batch = worker->batch;
+    rsa_ctx_t *ctx = &worker->ctx;
+    size_t lanes = ctx->mb->lanes;
+    uint8_t *blocks = malloc(lanes*ctx->block_size);
+    batch_job_t *jobs[BIGINT_MB_MAX_LANES];
+    uint8_t digests[BIGINT_MB_MAX_LANES][SHA256_DIGEST_SIZE];
+    size_t count = 0;
+    while (1)
+    {
+        // don't sit on a partial batch while the walk is behind
+        batch_job_t *job = queue_pop(&batch->queue, !count);
+        if (job)
+        {
+            int result = load_signature(worker, job, digests[count],
+                blocks+count*ctx->block_size);
+            if (result!=BATCH_OK)
+            {
+                report(batch, job->src, result);
+                free(job->dst);
+                free(job);
+                continue;
+            }
+            jobs[count++] = job;
+            if (count<lanes)
+                continue;
+        }
+        else if (!count)
+            break;
+        STATS_BEGIN(transform_start);
+        rsa_transform_batch(ctx, blocks, blocks, count);
+        STATS_END(STAT_TRANSFORM, transform_start);
+        for (size_t i = 0; i<count; i++)
+        {
+            int result = sign_match(ctx, batch->key->n,
+                blocks+i*ctx->block_size, digests[i]);
+            report(batch, jobs[i]->src, result==SIGN_OK ? BATCH_OK :
+                BATCH_ERR_SIGNATURE);
+            free(jobs[i]->dst);
+            free(jobs[i]);
+        }
+        count = 0;
+    }
+    free(blocks);
+}
+
+static void worker_proc(void *arg)
+{
+    batch_worker_t *worker = arg;
+    if (worker->batch->mode=='v')
+    {
+        verify_jobs(worker);
+        return;
+    }
+    batch_job_t *job;
+    while ((job = queue_pop(&worker->batch->queue, 1)))
+    {
+        report(worker->batch, job->src, run_job(worker, job));
+        free(job->dst);
+        free(job);
+    }
+}
+
+// returns NULL for a directory, else the list to read, or NULL and
+// prints an error if there is none
+static FILE *open_source(const char *src, int *is_dir)
+{
+    struct stat info;
+    *is_dir = strcmp(src, "-") && !stat(src, &info) &&
+        S_ISDIR(info.st_mode);
+    if (*is_dir)
+        return NULL;
+    FILE *list = strcmp(src, "-") ? fopen(src, "r") : stdin;
+    if (!list)
+        puts("can't open source directory or list file.");
+    return list;
+}
+
+int batch_list(const char *src, batch_file_proc_t proc, void *user)
+{
+    int is_dir;
+    FILE *list = open_source(src, &is_dir);
+    if (!is_dir && !list)
+        return 1;
+    batch_t batch;
+    batch.mode = 'l';
+    batch.key = NULL;
+    batch.files = batch.failed = 0;
+    batch.proc = proc;
+    batch.user = user;
+    mutex_init(&batch.report_lock);
+    if (is_dir)
+        walk_dir(&batch, src, NULL);
+    else
+        walk_list(&batch, list, NULL);
+    if (list && list!=stdin)
+        fclose(list);
+    mutex_destroy(&batch.report_lock);
+    return batch.failed!=0;
+}
+
+int batch_run(char mode, const rsa_key_t *key, const char *src,
+    const char *dst_dir, const batch_config_t *config)
+{
+    int is_dir;
+    FILE *list = open_source(src, &is_dir);
+    if (!is_dir && !list)
+        return 1;
+    if (mode=='v')
+        dst_dir = NULL;
+    else if (make_dir(dst_dir))
+    {
+        if (list && list!=stdin)
+            fclose(list);
+        puts("can't create destination directory.");
+        return 1;
+    }
+    size_t workers = config->workers ? config->workers : thread_cpu_count();
+    batch_t batch;
+    batch.mode = mode;
+    batch.key = key;
+    batch.compress = config->compress;
+    batch.files = batch.failed = 0;
+    batch.proc = NULL;
+#ifndef _WIN32
+    struct stat info;
+    if (dst_dir && !stat(dst_dir, &info))
+    {
+        batch.dst_dev = info.st_dev;
+        batch.dst_ino = info.st_ino;
+    }
+#endif
+    mutex_init(&batch.report_lock);
+    batch_queue_t *queue = &batch.queue;
+    mutex_init(&queue->lock);
+    cond_init(&queue->ready);
+    cond_init(&queue->space);
+    // enough to keep the workers busy while the walk catches up
+    queue->capacity = 4*workers;
+    queue->jobs = malloc(queue->capacity*sizeof(batch_job_t *));
+    queue->head = queue->count = 0;
+    queue->closed = 0;
+    batch_worker_t *pool = calloc(workers, sizeof(batch_worker_t));
+    size_t started = 0;
+    int result = 0;
+    for (; started<workers; started++)
+    {
+        batch_worker_t *worker = &pool[started];
+        worker->batch = &batch;
+        if (rsa_ctx_init_key(&worker->ctx, key))
+        {
+            puts("invalid key file.");
+            result = 1;
+            break;
+        }
+        if (mode=='e' && rnd_init(&worker->rnd))
+        {
+            rsa_ctx_free(&worker->ctx);
+            puts("can't initialize random number generator.");
+            result = 1;
+            break;
+        }
+        if (thread_create(&worker->thread, worker_proc, worker))
+        {
+            rsa_ctx_free(&worker->ctx);
+            puts("can't start worker threads.");
+            result = 1;
+            break;
+        }
+    }
+    if (!result)
+    {
+        if (is_dir)
+            walk_dir(&batch, src, dst_dir);
+        else
+            walk_list(&batch, list, dst_dir);
+    }
+    queue_close(queue);
+    for (size_t i = 0; i<started; i++)
+    {
+        thread_join(pool[i].thread);
+        rsa_ctx_free(&pool[i].ctx);
+    }
+    if (list && list!=stdin)
+        fclose(list);
+    free(pool);
+    free(queue->jobs);
+    cond_destroy(&queue->space);
+    cond_destroy(&queue->ready);
+    mutex_destroy(&queue->lock);
+    mutex_destroy(&batch.report_lock);
+    if (result)
+        return result;
+    printf("%zu files, %zu failed.\n", batch.files, batch.failed);
+    return batch.failed!=0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+#include "rsa.h"
+#include "rnd.h"
+#include <stdio.h>
+
+// Plain block format of the encrypt/decrypt commands, for one file or
+// for many at once, and batch signature verification.
+//
+// A batch takes either a directory, walked recursively, or a list file
+// with one path per line ("-" reads the list from stdin). Outputs keep
+// their relative paths under the destination directory. The key is
+// loaded once; each worker thread owns a context and at most two open
+// files, and the walk stays at most a bounded number of jobs ahead of the
+// workers, so open files and memory don't grow with the number of inputs.
+// A failing file is reported on its own and the batch goes on.
+//
+// Verification (mode 'v') checks every file against the signature in
+// "<file>.sig" next to it (see sign.h); a directory walk skips the .sig
+// files themselves. Each worker gathers one signature per SIMD lane and
+// checks them with a single multi-buffer exponentiation.
+
+enum
+{
+    BATCH_OK = 0,
+    BATCH_ERR_IO = -1,
+    BATCH_ERR_SOURCE = -2, // can't open or stat the source
+    BATCH_ERR_DESTINATION = -3, // can't create the destination
+    BATCH_ERR_PADDING = -4, // invalid padding or can't apply it
+    BATCH_ERR_PATH = -6, // list entry leaves the destination directory
+    BATCH_ERR_SIGNATURE = -7, // missing, malformed or wrong signature
+    BATCH_ERR_COMPRESSED = -8 // compressed plaintext doesn't decode
+};
+
+typedef struct
+{
+    size_t workers; // 0: one per logical processor
+    int compress; // encrypting: compress the plaintext first
+} batch_config_t;
+
+typedef void (*batch_file_proc_t)(void *user, const char *path);
+
+// Encrypt (mode 'e') or decrypt (mode 'd') 'src' into 'dst'.
+// Any size works in constant memory; 'src' must be seekable when
+// decrypting. With 'compress' set, encryption runs the plaintext through
+// the LZ codec (lz.h) first and flags that in the padding; decryption
+// notices and decompresses on its own.
+int batch_transform(char mode, rsa_ctx_t *ctx, bigint_t *n, rnd_t *rnd,
+    int compress, FILE *src, FILE *dst);
+// returns a message for one of the BATCH_ERR_* codes
+const char *batch_error(int result);
+// Transform every file of 'src' (a directory or a list file) into the
+// 'dst_dir' tree, or verify them all when 'mode' is 'v' ('dst_dir' is
+// unused then), printing one line per failed file and a summary.
+// returns nonzero if anything failed
+int batch_run(char mode, const rsa_key_t *key, const char *src,
+    const char *dst_dir, const batch_config_t *config);
+// Call 'proc' for every file of 'src' (a directory or a list file, as for
+// batch_run()) on the calling thread, printing one line per unreadable
+// entry. returns nonzero if anything couldn't be read
+int batch_list(const char *src, batch_file_proc_t proc, void *user);
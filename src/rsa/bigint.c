@@ -1,6 +1,9 @@
 #include "config.h"
 #include "common.h"
 #include "bigint.h"
+#include "bigint_ntt.h"
+#include "stats.h"
+#include "tune.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -38,23 +41,24 @@ static void bigint_reserve(bigint_t *b, size_t size)
     if (b->capacity < size)
     {
         b->capacity = size;
-        b->data = realloc(b->data, size*sizeof(uint32_t));
+        b->data = bigint_mem_realloc(b->data, size*sizeof(uint32_t));
     }
 }
 
 bigint_t *bigint_alloc_reserve(size_t capacity)
 {
-    bigint_t* b = malloc(sizeof(bigint_t)+capacity*sizeof(uint32_t));
+    bigint_t* b = bigint_mem_alloc(sizeof(bigint_t));
     b->size = 1;
     b->capacity = capacity;
-    b->data = calloc(capacity, sizeof(uint32_t));
+    b->data = bigint_mem_alloc(capacity*sizeof(uint32_t));
+    memset(b->data, 0, capacity*sizeof(uint32_t));
     return b;
 }
 
 void bigint_free(bigint_t *b)
 {
-    free(b->data);
-    free(b);
+    bigint_mem_free(b->data);
+    bigint_mem_free(b);
 }
 
 // data_size must be a multiple of 4
@@ -264,18 +268,14 @@ void bigint_add(bigint_t *result, bigint_t *b1, bigint_t *b2)
     uint32_t carry = 0;
     for (size_t i = 0; i<n; i++)
     {
-        uint32_t sum = carry;
+        uint64_t sum = carry;
         if (i < b1->size)
             sum += b1->data[i];
         if (i < b2->size)
             sum += b2->data[i];
-        // Already taken mod 2^32 by unsigned wrap around
-        result->data[i] = sum;
-        // Result must have wrapped 2^32 so carry bit is 1
-        if (i < b1->size)
-            carry = sum < b1->data[i];
-        else
-            carry = sum < b2->data[i];
+        result->data[i] = (uint32_t)sum;
+        // b1+b2+carry can't pass 2^33, so the carry is a single bit
+        carry = (uint32_t)(sum>>32);
     }
     if (carry==1)
     {
@@ -303,14 +303,16 @@ void bigint_isub(bigint_t *src, bigint_t *sub)
 void bigint_sub(bigint_t *dst, bigint_t *b1, bigint_t *b2)
 {
     size_t length = 0;
-    uint32_t carry = 0, diff, temp;
+    uint32_t carry = 0, diff;
+    uint64_t temp;
     bigint_reserve(dst, b1->size);
     for (size_t i = 0; i < b1->size; i++)
     {
+        // kept wide: b2's limb plus the borrow may be 2^32
         temp = carry;
         if (i < b2->size)
-            temp += b2->data[i]; // Auto wrapped mod RADIX
-        diff = b1->data[i]-temp;
+            temp += b2->data[i];
+        diff = (uint32_t)(b1->data[i]-temp);
         carry = temp > b1->data[i];
         dst->data[i] = diff;
         if (dst->data[i])
@@ -329,40 +331,129 @@ void bigint_imul(bigint_t *src, bigint_t *mult)
     bigint_free(temp);
 }
 
-// Multiply two bigints by the naive school method.
-// dst = b1*b2
-void bigint_mul(bigint_t *dst, bigint_t *b1, bigint_t *b2)
+// r[0, an+bn) = a*b by the schoolbook method, one row of 'a' per limb
+// of 'b'
+static void mul_basecase(uint32_t *r, const uint32_t *a, size_t an,
+    const uint32_t *b, size_t bn)
 {
-    size_t comp_size = b1->size + b2->size;
-    bigint_reserve(dst, comp_size);
-    memset(dst->data, 0, comp_size*sizeof(uint32_t));
-    for (int i = 0; i < b1->size; i++)
+    STATS_ADD(STAT_LIMB_OPS, an*bn);
+    memset(r, 0, an*sizeof(uint32_t));
+    for (size_t i = 0; i<bn; i++)
     {
-        for (int j = 0; j < b2->size; j++)
+        // a[j]*b[i]+r[i+j]+carry fits in 64 bits
+        uint64_t carry = 0;
+        for (size_t j = 0; j<an; j++)
         {
-            // This should not overflow...
-            uint64_t prod = b1->data[i]*(uint64_t)b2->data[j]+
-                (uint64_t)dst->data[i+j];
-            uint32_t carry = (uint32_t)(prod/BIGINT_RADIX);
-            // Add carry to the next uint32_t over, but this may cause
-            // further overflow..
-            int k = 1;
-            while (carry)
-            {
-                uint32_t temp = dst->data[i+j+k]+carry;
-                carry = temp < dst->data[i+j+k] ? 1 : 0;
-                // Already wrapped in unsigned arithmetic
-                dst->data[i+j+k] = temp;
-                k++;
-            }
-            // Again, should not overflow...
-            prod = (dst->data[i+j] + b1->data[i]*(uint64_t)b2->data[j])%
-                BIGINT_RADIX;
-            dst->data[i+j] = (uint32_t)prod; // add
+            carry += (uint64_t)a[j]*b[i]+r[i+j];
+            r[i+j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r[i+an] = (uint32_t)carry;
+    }
+}
+
+// r[0, an) = a+b for bn<=an, returns the carry out; r may alias a
+static uint32_t limb_add(uint32_t *r, const uint32_t *a, size_t an,
+    const uint32_t *b, size_t bn)
+{
+    uint64_t carry = 0;
+    for (size_t i = 0; i<an; i++)
+    {
+        if (i>=bn && !carry && r==a)
+            break;
+        carry += (uint64_t)a[i]+(i<bn ? b[i] : 0);
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    return (uint32_t)carry;
+}
+
+// a[0, an) -= b[0, bn) for bn<=an, the difference must not be negative
+static void limb_sub(uint32_t *a, size_t an, const uint32_t *b, size_t bn)
+{
+    int64_t borrow = 0;
+    for (size_t i = 0; i<an && (i<bn || borrow); i++)
+    {
+        borrow += (int64_t)a[i]-(i<bn ? b[i] : 0);
+        a[i] = (uint32_t)borrow;
+        borrow >>= 32;
+    }
+}
+
+// r[0, 2n) = a*b for two n-limb operands by Karatsuba's method: with
+// a = a1*B+a0 and b = b1*B+b0, the middle term a1*b0+a0*b1 is
+// (a0+a1)*(b0+b1)-a0*b0-a1*b1, three half-size products instead of four
+static void karatsuba(uint32_t *r, const uint32_t *a, const uint32_t *b,
+    size_t n)
+{
+    // below 4 limbs the middle product wouldn't be any smaller
+    if (n<tune_params()->karatsuba_cutoff || n<4)
+    {
+        mul_basecase(r, a, n, b, n);
+        return;
+    }
+    size_t l = (n+1)/2, h = n/2;
+    karatsuba(r, a, b, l);
+    karatsuba(r+2*l, a+l, b+l, h);
+    uint32_t *t = bigint_mem_alloc(4*(l+1)*sizeof(uint32_t));
+    uint32_t *sa = t, *sb = t+l+1, *mid = t+2*(l+1);
+    sa[l] = limb_add(sa, a, l, a+l, h);
+    sb[l] = limb_add(sb, b, l, b+l, h);
+    karatsuba(mid, sa, sb, l+1);
+    limb_sub(mid, 2*(l+1), r, 2*l);
+    limb_sub(mid, 2*(l+1), r+2*l, 2*h);
+    // the middle term is below B^(n+1), and n+1 <= 2n-l
+    limb_add(r+l, r+l, 2*n-l, mid, n+1);
+    bigint_mem_free(t);
+}
+
+// r[0, an+bn) = a*b, the method picked by the size of the smaller
+// operand. r must not alias a or b.
+static void limb_mul(uint32_t *r, const uint32_t *a, size_t an,
+    const uint32_t *b, size_t bn)
+{
+    if (an<bn)
+    {
+        const uint32_t *t = a;
+        a = b;
+        b = t;
+        size_t tn = an;
+        an = bn;
+        bn = tn;
+    }
+    const tune_params_t *params = tune_params();
+    if (bn<params->karatsuba_cutoff)
+        mul_basecase(r, a, an, b, bn);
+    else if (bn>=params->ntt_cutoff && an+bn<=BIGINT_NTT_MAX_LIMBS)
+        bigint_ntt_mul(r, a, an, b, bn);
+    else if (an==bn)
+        karatsuba(r, a, b, bn);
+    else
+    {
+        // unbalanced: multiply b by bn-limb slices of a and accumulate
+        memset(r, 0, (an+bn)*sizeof(uint32_t));
+        uint32_t *t = bigint_mem_alloc(2*bn*sizeof(uint32_t));
+        for (size_t i = 0; i<an; i += bn)
+        {
+            size_t n = min(bn, an-i);
+            limb_mul(t, a+i, n, b, bn);
+            limb_add(r+i, r+i, an+bn-i, t, n+bn);
         }
+        bigint_mem_free(t);
     }
+}
+
+// Multiply two bigints: schoolbook for small operands, Karatsuba from
+// the Karatsuba cutoff and the NTT from the NTT cutoff (tune.h).
+// dst = b1*b2, dst must not alias b1 or b2
+void bigint_mul(bigint_t *dst, bigint_t *b1, bigint_t *b2)
+{
+    size_t comp_size = b1->size + b2->size;
+    STATS_ADD(STAT_MUL, 1);
+    bigint_reserve(dst, comp_size);
+    limb_mul(dst->data, b1->data, b1->size, b2->data, b2->size);
     dst->size = comp_size;
-    if (dst->size && !dst->data[dst->size-1])
+    while (dst->size>1 && !dst->data[dst->size-1])
         dst->size--;
 }
 
@@ -411,11 +502,30 @@ void bigint_imod(bigint_t *src, bigint_t *mod)
     bigint_free(r);
 }
 
-static uint32_t get_shifted_block(bigint_t *num, size_t x, uint32_t y)
+// index of the lowest set bit, 'x' must be nonzero
+static int ctz32(uint32_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(x);
+#else
+    int k = 0;
+    for (; !(x&1); x >>= 1)
+        k++;
+    return k;
+#endif
+}
+
+// number of leading zero bits, 'x' must be nonzero
+static int clz32(uint32_t x)
 {
-    uint32_t part1 = !x || !y ? 0 : num->data[x-1] >> (32-y);
-    uint32_t part2 = x==num->size ? 0 : num->data[x] << y;
-    return part1|part2;
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clz(x);
+#else
+    int k = 0;
+    for (; !(x&0x80000000); x <<= 1)
+        k++;
+    return k;
+#endif
 }
 
 static void strip_leading_zeros(bigint_t *num)
@@ -424,20 +534,248 @@ static void strip_leading_zeros(bigint_t *num)
         num->size--;
 }
 
-// Divide two bigints by naive long division, producing both
-// quotient and remainder.
-// q = floor(b1/b2), rem = b1-q*b2
-// If b1<b2, the quotient is trivially 0 and remainder is b1.
-void bigint_div(bigint_t *q, bigint_t *rem, bigint_t *b1, bigint_t *b2)
+// Long division a limb at a time (Knuth, TAOCP vol. 2, 4.3.1,
+// algorithm D) of the m-limb b1 by the n-limb b2, both without leading
+// zero limbs and b1>=b2.
+static void div_knuth(bigint_t *q, bigint_t *rem, bigint_t *b1, size_t m,
+    bigint_t *b2, size_t n)
 {
-    if (bigint_less(b1, b2))
+    STATS_ADD(STAT_LIMB_OPS, (m-n+1)*n);
+    // normalize so the top divisor limb has its high bit set, then every
+    // quotient limb estimate is at most 2 too large
+    int shift = clz32(b2->data[n-1]);
+    uint32_t *u = bigint_mem_alloc((m+1+n)*sizeof(uint32_t));
+    uint32_t *v = u+m+1;
+    for (size_t i = n; i--;)
     {
-        // Trivial case: b1/b2 = 0 if b1<b2.
-        bigint_copy(&small_bigint[0], q);
-        bigint_copy(b1, rem);
+        v[i] = b2->data[i]<<shift;
+        if (shift && i)
+            v[i] |= b2->data[i-1]>>(32-shift);
+    }
+    u[m] = shift ? b1->data[m-1]>>(32-shift) : 0;
+    for (size_t i = m; i--;)
+    {
+        u[i] = b1->data[i]<<shift;
+        if (shift && i)
+            u[i] |= b1->data[i-1]>>(32-shift);
+    }
+    size_t q_size = m-n+1;
+    bigint_reserve(q, q_size);
+    for (size_t j = q_size; j--;)
+    {
+        uint64_t top = (uint64_t)u[j+n]<<32|u[j+n-1];
+        uint64_t qhat = top/v[n-1];
+        uint64_t rhat = top%v[n-1];
+        while (qhat>>32 || (n>1 &&
+            qhat*v[n-2]>(rhat<<32|u[j+n-2])))
+        {
+            qhat--;
+            rhat += v[n-1];
+            if (rhat>>32)
+                break;
+        }
+        // u[j..j+n] -= qhat*v
+        uint64_t carry = 0;
+        int64_t borrow = 0;
+        for (size_t i = 0; i<n; i++)
+        {
+            uint64_t prod = qhat*v[i]+carry;
+            carry = prod>>32;
+            int64_t diff = (int64_t)u[i+j]-(uint32_t)prod+borrow;
+            u[i+j] = (uint32_t)diff;
+            borrow = diff>>32;
+        }
+        int64_t diff = (int64_t)u[j+n]-(int64_t)carry+borrow;
+        u[j+n] = (uint32_t)diff;
+        if (diff<0)
+        {
+            // rare: the estimate was one too large, add v back
+            qhat--;
+            uint64_t sum = 0;
+            for (size_t i = 0; i<n; i++)
+            {
+                sum += (uint64_t)u[i+j]+v[i];
+                u[i+j] = (uint32_t)sum;
+                sum >>= 32;
+            }
+            u[j+n] += (uint32_t)sum;
+        }
+        q->data[j] = (uint32_t)qhat;
+    }
+    q->size = q_size;
+    strip_leading_zeros(q);
+    bigint_reserve(rem, n);
+    for (size_t i = 0; i<n; i++)
+    {
+        rem->data[i] = u[i]>>shift;
+        if (shift)
+            rem->data[i] |= u[i+1]<<(32-shift);
+    }
+    rem->size = n;
+    strip_leading_zeros(rem);
+    bigint_mem_free(u);
+}
+
+static void normalize(bigint_t *b)
+{
+    while (b->size>1 && !b->data[b->size-1])
+        b->size--;
+}
+
+// number of significant bits, 'b' without leading zero limbs
+static size_t bit_length(bigint_t *b)
+{
+    uint32_t top = b->data[b->size-1];
+    return top ? 32*b->size-clz32(top) : 0;
+}
+
+// dst = src*2^bits
+static void shift_left(bigint_t *dst, bigint_t *src, size_t bits)
+{
+    size_t limbs = bits/32, n = src->size;
+    int shift = bits%32;
+    bigint_reserve(dst, n+limbs+1);
+    dst->data[n+limbs] = shift ? src->data[n-1]>>(32-shift) : 0;
+    for (size_t i = n; i--;)
+    {
+        dst->data[i+limbs] = src->data[i]<<shift;
+        if (shift && i)
+            dst->data[i+limbs] |= src->data[i-1]>>(32-shift);
+    }
+    memset(dst->data, 0, limbs*sizeof(uint32_t));
+    dst->size = n+limbs+1;
+    normalize(dst);
+}
+
+// dst = floor(src/2^bits)
+static void shift_right(bigint_t *dst, bigint_t *src, size_t bits)
+{
+    size_t limbs = bits/32;
+    int shift = bits%32;
+    if (limbs>=src->size)
+    {
+        bigint_copy(&small_bigint[0], dst);
         return;
     }
-    if (bigint_iszero(b1) || bigint_iszero(b2))
+    size_t n = src->size-limbs;
+    bigint_reserve(dst, n);
+    for (size_t i = 0; i<n; i++)
+    {
+        dst->data[i] = src->data[i+limbs]>>shift;
+        if (shift && i+1<n)
+            dst->data[i] |= src->data[i+limbs+1]<<(32-shift);
+    }
+    dst->size = n;
+    normalize(dst);
+}
+
+// dst = 2^bits
+static void set_pow2(bigint_t *dst, size_t bits)
+{
+    size_t n = bits/32+1;
+    bigint_reserve(dst, n);
+    memset(dst->data, 0, n*sizeof(uint32_t));
+    dst->data[n-1] = (uint32_t)1<<(bits%32);
+    dst->size = n;
+}
+
+// x = floor(2^(2k)/d) for a k-bit d, less a few units. The reciprocal
+// of the top h bits of d is good to about h bits, and one Newton step
+// x' = x+x*(2^(2k)-d*x)/2^(2k) doubles that. The step is rounded so x'
+// never passes the exact value; h has a few guard bits over k/2 to keep
+// the error from growing from one level to the next.
+static void newton_recip(bigint_t *x, bigint_t *d, size_t k)
+{
+    bigint_t *p = bigint_alloc();
+    bigint_t *t = bigint_alloc();
+    if (d->size<tune_params()->newton_cutoff || d->size<2)
+    {
+        set_pow2(p, 2*k);
+        div_knuth(x, t, p, p->size, d, d->size);
+        bigint_free(p);
+        bigint_free(t);
+        return;
+    }
+    size_t h = k/2+4;
+    bigint_t *xh = bigint_alloc();
+    bigint_t *e = bigint_alloc();
+    shift_right(t, d, k-h);
+    newton_recip(xh, t, h);
+    // with x = xh*2^(k-h), the error 2^(2k)-d*x is 2^(k-h) times
+    // 2^(k+h)-d*xh, kept unsigned; only its top bits matter
+    bigint_mul(t, d, xh);
+    set_pow2(p, k+h);
+    int over = bigint_greater(t, p);
+    if (over)
+        bigint_sub(e, t, p);
+    else
+        bigint_sub(e, p, t);
+    shift_right(t, e, h-2);
+    if (over)
+        bigint_iadd32(t, 1);
+    bigint_mul(e, xh, t);
+    shift_right(t, e, h+2);
+    shift_left(x, xh, k-h);
+    if (over)
+    {
+        bigint_iadd32(t, 1);
+        bigint_sub(x, x, t);
+    }
+    else
+        bigint_add(x, x, t);
+    bigint_free(p);
+    bigint_free(t);
+    bigint_free(xh);
+    bigint_free(e);
+}
+
+// Division by multiplying with the reciprocal of b2, both shifted so
+// the reciprocal covers the whole quotient; a few products of the
+// operand size instead of a quadratic number of limb steps.
+// b1 and b2 without leading zero limbs, b1>=b2>=2.
+static void div_newton(bigint_t *q, bigint_t *rem, bigint_t *b1,
+    bigint_t *b2)
+{
+    size_t bits = bit_length(b2);
+    size_t k = max(bits, bit_length(b1)-bits);
+    bigint_t *d = bigint_alloc();
+    bigint_t *x = bigint_alloc();
+    bigint_t *t = bigint_alloc();
+    bigint_t *u = bigint_alloc();
+    shift_left(d, b2, k-bits);
+    newton_recip(x, d, k);
+    // q = b1*2^(k-bits)*x/2^(2k), where the low k-2 bits of the shifted
+    // b1 move the result by less than one
+    shift_right(t, b1, bits-2);
+    bigint_mul(u, t, x);
+    shift_right(q, u, k+2);
+    // q is a few short at most
+    bigint_mul(t, q, b2);
+    bigint_sub(rem, b1, t);
+    while (bigint_geq(rem, b2))
+    {
+        bigint_iadd32(q, 1);
+        bigint_sub(rem, rem, b2);
+    }
+    bigint_free(d);
+    bigint_free(x);
+    bigint_free(t);
+    bigint_free(u);
+}
+
+// Divide two bigints, producing both quotient and remainder: by long
+// division, or through a Newton reciprocal once divisor and quotient
+// are both at least the Newton cutoff (tune.h) in limbs.
+// q = floor(b1/b2), rem = b1-q*b2
+// If b1<b2, the quotient is trivially 0 and remainder is b1.
+void bigint_div(bigint_t *q, bigint_t *rem, bigint_t *b1, bigint_t *b2)
+{
+    size_t n = b2->size, m = b1->size;
+    while (n && !b2->data[n-1])
+        n--;
+    while (m && !b1->data[m-1])
+        m--;
+    if (!n)
     {
         // let a/0 == 0 and a%0 == a to preserve these two properties:
 		// 1] a%0 == a
@@ -446,67 +784,294 @@ void bigint_div(bigint_t *q, bigint_t *rem, bigint_t *b1, bigint_t *b2)
         bigint_copy(&small_bigint[0], rem);
         return;
     }
-    // Thanks to Matt McCutchen <matt@mattmccutchen.net> for the algorithm.
-    size_t ref_size = b1->size;
-    bigint_copy(b1, rem);
-    bigint_reserve(rem, rem->size+1);
-    rem->size++;
-    rem->data[ref_size] = 0;
-    uint32_t *sub_buf = malloc(rem->size*sizeof(uint32_t));
-    q->size = ref_size - b2->size+1;
-    bigint_reserve(q, q->size);
-    memset(q->data, 0, q->size*sizeof(uint32_t));
-    // for each left-shift of b2 in blocks...
-    size_t i = q->size;
-    while (i)
-    {
-        i--;
-        // for each left-shift of b2 in bits...
-        q->data[i] = 0;
-        uint32_t i2 = 32;
-        while (i2>0)
+    size_t i = m;
+    if (m==n)
+    {
+        while (i-- && b1->data[i]==b2->data[i])
+            ;
+    }
+    if (m<n || (m==n && i!=(size_t)-1 && b1->data[i]<b2->data[i]))
+    {
+        // Trivial case: b1/b2 = 0 if b1<b2.
+        bigint_copy(&small_bigint[0], q);
+        bigint_copy(b1, rem);
+        rem->size = max(m, 1);
+        return;
+    }
+    STATS_ADD(STAT_DIV, 1);
+    size_t cutoff = tune_params()->newton_cutoff;
+    if (n>=cutoff && m-n+1>=cutoff)
+    {
+        bigint_t a = *b1, b = *b2;
+        a.size = m;
+        b.size = n;
+        div_newton(q, rem, &a, &b);
+    }
+    else
+        div_knuth(q, rem, b1, m, b2, n);
+}
+
+// Compute -n^-1 mod 2^32 for odd n by Newton iteration; each step
+// doubles the number of correct low bits.
+static uint32_t mont_n0inv(uint32_t n0)
+{
+    uint32_t inv = n0; // correct to 3 bits for any odd n0
+    for (int i = 0; i<4; i++)
+        inv *= 2-n0*inv;
+    return (uint32_t)0-inv;
+}
+
+// Store (2^(32*shift))%mod into a zero-padded array of mod->size limbs.
+static void mont_pow2_mod(bigint_t *mod, size_t shift, uint32_t *result)
+{
+    bigint_t *p = bigint_alloc_reserve(shift+1);
+    bigint_t *q = bigint_alloc();
+    bigint_t *r = bigint_alloc_reserve(mod->size+1);
+    memset(p->data, 0, shift*sizeof(uint32_t));
+    p->data[shift] = 1;
+    p->size = shift+1;
+    bigint_div(q, r, p, mod);
+    memset(result, 0, mod->size*sizeof(uint32_t));
+    memcpy(result, r->data, min(r->size, mod->size)*sizeof(uint32_t));
+    bigint_free(p);
+    bigint_free(q);
+    bigint_free(r);
+}
+
+int bigint_mont_init(bigint_mont_t *mont, bigint_t *mod)
+{
+    size_t size = mod->size;
+    while (size && !mod->data[size-1])
+        size--;
+    if (!size || !(mod->data[0] & 1))
+        return 1;
+    bigint_t norm = {size, size, mod->data};
+    mont->size = size;
+    mont->n = bigint_mem_alloc(3*size*sizeof(uint32_t));
+    mont->rr = mont->n+size;
+    mont->one = mont->rr+size;
+    memcpy(mont->n, mod->data, size*sizeof(uint32_t));
+    mont->n0inv = mont_n0inv(mod->data[0]);
+    mont->borrowed = 0;
+    mont_pow2_mod(&norm, size, mont->one);
+    mont_pow2_mod(&norm, 2*size, mont->rr);
+    return 0;
+}
+
+void bigint_mont_free(bigint_mont_t *mont)
+{
+    if (!mont->borrowed)
+        bigint_mem_free(mont->n);
+    mont->n = mont->rr = mont->one = NULL;
+    mont->size = 0;
+}
+
+void bigint_mont_sub(bigint_mont_t *mont, uint32_t *r, const uint32_t *a,
+    const uint32_t *b)
+{
+    size_t s = mont->size;
+    uint32_t borrow = 0;
+    for (size_t i = 0; i<s; i++)
+    {
+        uint64_t diff = (uint64_t)a[i]-b[i]-borrow;
+        r[i] = (uint32_t)diff;
+        borrow = (uint32_t)(diff>>63);
+    }
+    if (borrow)
+    {
+        // wrapped below zero, add n back
+        uint64_t carry = 0;
+        for (size_t i = 0; i<s; i++)
         {
-            i2--;
-            size_t j, k;
-            int borrow_in, borrow_out;
-            for (j = 0, k = i, borrow_in = 0; j<=b2->size; j++, k++)
-            {
-                uint32_t temp = rem->data[k]-get_shifted_block(b2, j, i2);
-                borrow_out = temp > rem->data[k];
-                if (borrow_in)
-                {
-                    borrow_out |= !temp;
-                    temp--;
-                }
-                sub_buf[k] = temp;
-                borrow_in = borrow_out;
-            }            
-            for (; k<ref_size && borrow_in; k++)
+            carry += (uint64_t)r[i]+mont->n[i];
+            r[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+    }
+}
+
+// r = (a+b) mod n, a and b less than n
+static void mont_add(bigint_mont_t *mont, uint32_t *r, const uint32_t *a,
+    const uint32_t *b)
+{
+    size_t s = mont->size;
+    uint64_t carry = 0;
+    for (size_t i = 0; i<s; i++)
+    {
+        carry += (uint64_t)a[i]+b[i];
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    int ge = carry!=0;
+    if (!ge)
+    {
+        ge = 1;
+        for (size_t i = s; i--;)
+        {
+            if (r[i]!=mont->n[i])
             {
-                borrow_in = !rem->data[k];
-                sub_buf[k] = rem->data[k]-1;
+                ge = r[i] > mont->n[i];
+                break;
             }
-            if (!borrow_in)
+        }
+    }
+    if (ge)
+    {
+        uint32_t borrow = 0;
+        for (size_t i = 0; i<s; i++)
+        {
+            uint64_t diff = (uint64_t)r[i]-mont->n[i]-borrow;
+            r[i] = (uint32_t)diff;
+            borrow = (uint32_t)(diff>>63);
+        }
+    }
+}
+
+// Horner's rule over 'size'-limb chunks, most significant first:
+// x = x*R+chunk, where multiplying by R^2 both shifts and converts.
+void bigint_mont_from_wide(bigint_mont_t *mont, uint32_t *r,
+    const uint32_t *a, size_t a_size, uint32_t *t)
+{
+    size_t s = mont->size;
+    uint32_t *chunk = t+s+2;
+    size_t top = a_size%s ? a_size%s : s;
+    size_t pos = a_size-top;
+    memset(chunk, 0, s*sizeof(uint32_t));
+    memcpy(chunk, a+pos, top*sizeof(uint32_t));
+    bigint_mont_mul(mont, r, chunk, mont->rr, t);
+    while (pos)
+    {
+        pos -= s;
+        bigint_mont_mul(mont, r, r, mont->rr, t);
+        bigint_mont_mul(mont, chunk, a+pos, mont->rr, t);
+        mont_add(mont, r, r, chunk);
+    }
+}
+
+// Montgomery multiplication, coarsely integrated operand scanning (CIOS).
+// Each outer step adds a*b[i] and then an m*n multiple that clears the
+// lowest limb, shifting the accumulator down by one limb.
+void bigint_mont_mul(bigint_mont_t *mont, uint32_t *r, const uint32_t *a,
+    const uint32_t *b, uint32_t *t)
+{
+    size_t s = mont->size;
+    const uint32_t *n = mont->n;
+    STATS_ADD(STAT_MONT_MUL, 1);
+    STATS_ADD(STAT_LIMB_OPS, 2*s*s);
+    memset(t, 0, (s+2)*sizeof(uint32_t));
+    for (size_t i = 0; i<s; i++)
+    {
+        // t += a*b[i]
+        uint64_t c = 0;
+        for (size_t j = 0; j<s; j++)
+        {
+            // can't overflow: (2^32-1)^2+2*(2^32-1) == 2^64-1
+            c += (uint64_t)a[j]*b[i]+t[j];
+            t[j] = (uint32_t)c;
+            c >>= 32;
+        }
+        c += t[s];
+        t[s] = (uint32_t)c;
+        t[s+1] = (uint32_t)(c>>32);
+        // t = (t+m*n)/2^32
+        uint32_t m = t[0]*mont->n0inv;
+        c = ((uint64_t)m*n[0]+t[0])>>32;
+        for (size_t j = 1; j<s; j++)
+        {
+            c += (uint64_t)m*n[j]+t[j];
+            t[j-1] = (uint32_t)c;
+            c >>= 32;
+        }
+        c += t[s];
+        t[s-1] = (uint32_t)c;
+        t[s] = t[s+1]+(uint32_t)(c>>32);
+    }
+    // t < 2n here, so a single conditional subtraction is enough
+    int ge = t[s]!=0;
+    if (!ge)
+    {
+        ge = 1;
+        for (size_t i = s; i--;)
+        {
+            if (t[i]!=n[i])
             {
-                q->data[i] |= 1 << i2;
-                while (k>i)
-                {
-                    k--;
-                    rem->data[k] = sub_buf[k];
-                }
+                ge = t[i] > n[i];
+                break;
             }
         }
     }
-    strip_leading_zeros(q);
-    strip_leading_zeros(rem);
-    free(sub_buf);
+    if (ge)
+    {
+        uint32_t borrow = 0;
+        for (size_t i = 0; i<s; i++)
+        {
+            uint64_t diff = (uint64_t)t[i]-n[i]-borrow;
+            r[i] = (uint32_t)diff;
+            borrow = (uint32_t)(diff>>63);
+        }
+    }
+    else
+        memcpy(r, t, s*sizeof(uint32_t));
 }
 
-// Perform modular exponentiation by repeated squaring.
+// Left-to-right binary exponentiation in Montgomery form.
+static void mont_modpow(bigint_mont_t *mont, bigint_t *base, bigint_t *exp,
+    bigint_t *mod, bigint_t *result)
+{
+    size_t s = mont->size;
+    uint32_t *buf = bigint_mem_alloc((3*s+2)*sizeof(uint32_t));
+    memset(buf, 0, (3*s+2)*sizeof(uint32_t));
+    uint32_t *a = buf;
+    uint32_t *x = buf+s;
+    uint32_t *t = buf+2*s;
+    if (base->size > s)
+    {
+        bigint_t *rem = bigint_alloc();
+        bigint_rem(base, mod, rem);
+        memcpy(a, rem->data, min(rem->size, s)*sizeof(uint32_t));
+        bigint_free(rem);
+    }
+    else
+        memcpy(a, base->data, base->size*sizeof(uint32_t));
+    bigint_mont_mul(mont, a, a, mont->rr, t);
+    memcpy(x, mont->one, s*sizeof(uint32_t));
+    int started = 0;
+    for (size_t i = exp->size*32; i--;)
+    {
+        int bit = exp->data[i/32]>>(i%32) & 1;
+        if (started)
+            bigint_mont_mul(mont, x, x, x, t);
+        if (bit)
+        {
+            bigint_mont_mul(mont, x, x, a, t);
+            started = 1;
+        }
+    }
+    // leave Montgomery form: x = x*1/R
+    memset(a, 0, s*sizeof(uint32_t));
+    a[0] = 1;
+    bigint_mont_mul(mont, x, x, a, t);
+    bigint_reserve(result, s);
+    memcpy(result->data, x, s*sizeof(uint32_t));
+    result->size = s;
+    strip_leading_zeros(result);
+    bigint_mem_free(buf);
+}
+
+// Perform modular exponentiation by repeated squaring. Odd moduli take
+// the Montgomery path, which needs no long division per step.
 // result = (base^exp)%mod
 void bigint_modpow(bigint_t *base, bigint_t *exp, bigint_t *mod,
     bigint_t *result)
 {
+    bigint_mont_t mont;
+    STATS_ADD(STAT_MODPOW, 1);
+    if (!bigint_mont_init(&mont, mod))
+    {
+        mont_modpow(&mont, base, exp, mod, result);
+        bigint_mont_free(&mont);
+        return;
+    }
     bigint_t *a = bigint_alloc();
     bigint_t *b = bigint_alloc();
     bigint_t *c = bigint_alloc();
@@ -600,60 +1165,125 @@ void bigint_inv(bigint_t *a, bigint_t *m, bigint_t *result)
     bigint_free(acur);
 }
 
-// Compute the jacobi symbol, J(ac, nc).
+// Dividing by 2 flips the symbol when 2 is a non-residue, i.e. n = 3 or
+// 5 (mod 8); swapping flips it when both are 3 (mod 4). Only the low bits
+// of n are needed for either.
+#define JACOBI_TWO_FLIPS(n) ((((n)>>1)^((n)>>2))&1)
+#define JACOBI_SWAP_FLIPS(a, n) ((a)&(n)&2)
+
+// binary Jacobi on machine words, n odd, 't' is the sign so far
+static int jacobi_word(uint64_t a, uint64_t n, int t)
+{
+    while (a)
+    {
+        int k = (uint32_t)a ? ctz32((uint32_t)a) : 32+ctz32(a>>32);
+        a >>= k;
+        if ((k&1) && JACOBI_TWO_FLIPS(n))
+            t = -t;
+        if (a<n)
+        {
+            uint64_t temp = a;
+            a = n;
+            n = temp;
+            if (JACOBI_SWAP_FLIPS(a, n))
+                t = -t;
+        }
+        a -= n;
+    }
+    return n==1 ? t : 0;
+}
+
+static size_t trim_limbs(const uint32_t *x, size_t size)
+{
+    while (size && !x[size-1])
+        size--;
+    return size;
+}
+
+static uint64_t low_word(const uint32_t *x, size_t size)
+{
+    return size>1 ? x[0]|(uint64_t)x[1]<<32 : size ? x[0] : 0;
+}
+
+// Compute the jacobi symbol, J(ac, nc), for odd nc.
+// Binary algorithm on the limbs: halving and swapping only look at the
+// low word, a subtraction replaces each division. Once the smaller side
+// fits in a limb the other one is folded by a single remainder pass, and
+// the rest runs on machine words.
 int bigint_jacobi(bigint_t *ac, bigint_t *nc)
 {
-    bigint_t *remainder = bigint_alloc();
-    bigint_t *twos = bigint_alloc();
-    bigint_t *temp = bigint_alloc();
-    bigint_t *a = bigint_alloc();
-    bigint_t *n = bigint_alloc();
-    int mult = 1, result = 0;
-    bigint_copy(ac, a);
-    bigint_copy(nc, n);
-    while (bigint_greater(a, &small_bigint[1]) && !bigint_equal(a, n))
-    {
-        bigint_imod(a, n);
-        if (bigint_leq(a, &small_bigint[1]) || bigint_equal(a, n))
+    if (!(nc->data[0]&1))
+        return 0;
+    size_t as = trim_limbs(ac->data, ac->size);
+    size_t ns = trim_limbs(nc->data, nc->size);
+    size_t size = max(as, ns);
+    uint32_t *buf = bigint_mem_alloc(2*size*sizeof(uint32_t));
+    uint32_t *a = buf, *n = buf+size;
+    memcpy(a, ac->data, as*sizeof(uint32_t));
+    memcpy(n, nc->data, ns*sizeof(uint32_t));
+    int t = 1;
+    while (as>2 || ns>2)
+    {
+        if (!as)
+            break; // a = 0 and n > 1
+        if (ns==1)
+        {
+            // n is a single odd limb, fold a into it
+            uint64_t r = 0;
+            for (size_t i = as; i--;)
+                r = (r<<32|a[i])%n[0];
+            a[0] = (uint32_t)r;
+            as = 1;
             break;
-        bigint_fromint(twos, 0);
-        /* Factor out multiples of two */
-        while (a->data[0]%2==0)
+        }
+        // a /= 2^k, a is odd afterwards
+        size_t skip = 0;
+        while (!a[skip])
+            skip++;
+        int k = ctz32(a[skip]);
+        if (k)
         {
-            bigint_iadd(twos, &small_bigint[1]);
-            bigint_idiv(a, &small_bigint[2]);
+            for (size_t i = skip; i+1<as; i++)
+                a[i-skip] = a[i]>>k|a[i+1]<<(32-k);
+            a[as-1-skip] = a[as-1]>>k;
         }
-        // Coefficient for flipping
-        if (bigint_greater(twos, &small_bigint[0]) && twos->data[0]%2==1)
+        else
+            memmove(a, a+skip, (as-skip)*sizeof(uint32_t));
+        as = trim_limbs(a, as-skip);
+        if ((k&1) && JACOBI_TWO_FLIPS(n[0]))
+            t = -t;
+        // keep a >= n
+        int less = as<ns;
+        if (as==ns)
         {
-            bigint_rem(n, &small_bigint[8], remainder);
-            if (!bigint_equal(remainder, &small_bigint[1]) &&
-                !bigint_equal(remainder, &small_bigint[7]))
-            {
-                mult *= -1;
-            }
+            size_t i = as;
+            while (i-- && a[i]==n[i])
+                ;
+            less = i!=(size_t)-1 && a[i]<n[i];
         }
-        if (bigint_leq(a, &small_bigint[1]) || bigint_equal(a, n))
-            break;
-        bigint_rem(n, &small_bigint[4], remainder);
-        bigint_rem(a, &small_bigint[4], temp);
-        if (!bigint_equal(remainder, &small_bigint[1]) &&
-            !bigint_equal(temp, &small_bigint[1]))
+        if (less)
         {
-            mult *= -1;
+            uint32_t *temp = a;
+            a = n;
+            n = temp;
+            size_t temp_size = as;
+            as = ns;
+            ns = temp_size;
+            if (JACOBI_SWAP_FLIPS(a[0], n[0]))
+                t = -t;
         }
-        bigint_copy(a, temp);
-        bigint_copy(n, a);
-        bigint_copy(temp, n);
+        // a -= n, even or zero now
+        uint32_t borrow = 0;
+        for (size_t i = 0; i<as; i++)
+        {
+            uint64_t diff = (uint64_t)a[i]-(i<ns ? n[i] : 0)-borrow;
+            a[i] = (uint32_t)diff;
+            borrow = (uint32_t)(diff>>63);
+        }
+        as = trim_limbs(a, as);
     }
-    if (bigint_equal(a, &small_bigint[1]))
-        result = mult;
-    else
-        result = 0;
-    bigint_free(remainder);
-    bigint_free(twos);
-    bigint_free(temp);
-    bigint_free(a);
-    bigint_free(n);
+    int result = ns>2 ? 0 : jacobi_word(low_word(a, as), low_word(n, ns), t);
+    bigint_mem_free(buf);
     return result;
 }
+
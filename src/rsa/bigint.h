@@ -22,14 +22,23 @@ typedef struct
 
 #define BIGINT_DEFAULT_CAPACITY 20
 
+// Limb counts where bigint_mul() moves on from the schoolbook method to
+// Karatsuba and from Karatsuba to the NTT (bigint_ntt.h), judged by the
+// smaller operand, and where bigint_div() divides by multiplying with a
+// Newton reciprocal, judged by both divisor and quotient. These are the
+// defaults; a tuning file (tune.h) replaces them.
+#define BIGINT_KARATSUBA_CUTOFF 48
+#define BIGINT_NTT_CUTOFF 3072
+#define BIGINT_NEWTON_CUTOFF 2048
+
 extern bigint_t small_bigint[17];
 
 bigint_t *bigint_alloc_reserve(size_t capacity);
-inline bigint_t *bigint_alloc()
+static inline bigint_t *bigint_alloc()
 { return bigint_alloc_reserve(BIGINT_DEFAULT_CAPACITY); }
 void bigint_free(bigint_t *b);
 // returns size of bigint binary representation in bytes
-inline size_t bigint_get_size(bigint_t *b)
+static inline size_t bigint_get_size(bigint_t *b)
 { return b->size*4; }
 void bigint_load(bigint_t *b, uint8_t *buf, size_t buf_size);
 void bigint_save(bigint_t *b, uint8_t *buf);
@@ -62,4 +71,57 @@ void bigint_modpow(bigint_t *base, bigint_t *exp, bigint_t *mod,
     bigint_t *result);
 void bigint_gcd(bigint_t *b1, bigint_t *b2, bigint_t *result);
 void bigint_inv(bigint_t *a, bigint_t *m, bigint_t *result);
+// J(ac, nc) for odd nc, 0 for even nc
 int bigint_jacobi(bigint_t *ac, bigint_t *nc);
+
+// Heap hooks for all bigint memory: bigint_t structs, limb arrays,
+// Montgomery constants and the per-key state rsa.h derives from them.
+// The default is a thread-local size-classed pool (bigint_pool.c).
+// Install hooks before the first allocation; memory is always released
+// through the hooks that allocated it; free is never passed NULL.
+typedef struct
+{
+    void *(*alloc)(void *user, size_t size);
+    void *(*realloc)(void *user, void *p, size_t size);
+    void (*free)(void *user, void *p);
+    void *user;
+} bigint_allocator_t;
+
+// NULL restores the built-in pool
+void bigint_set_allocator(const bigint_allocator_t *allocator);
+void *bigint_mem_alloc(size_t size);
+void *bigint_mem_realloc(void *p, size_t size);
+void bigint_mem_free(void *p);
+// Hand the calling thread's cached pool blocks back to malloc(). Threads
+// do this as they exit (see thread_at_exit()).
+void bigint_pool_flush();
+
+// Montgomery arithmetic context for a fixed odd modulus.
+// All operands are raw 'size'-limb arrays in the same LSB order as
+// bigint_t::data, reduced modulo n. R = 2^(32*size).
+typedef struct
+{
+    size_t size;
+    uint32_t *n; // normalized modulus (no leading zero limbs)
+    uint32_t *rr; // R^2 mod n, used to enter Montgomery form
+    uint32_t *one; // R mod n, i.e. 1 in Montgomery form
+    uint32_t n0inv; // -n^-1 mod 2^32
+    // set when the arrays belong to someone else, e.g. a mapped key file
+    int borrowed;
+} bigint_mont_t;
+
+// returns nonzero if the modulus is even or zero
+int bigint_mont_init(bigint_mont_t *mont, bigint_t *mod);
+void bigint_mont_free(bigint_mont_t *mont);
+// r = a*R mod n for an 'a_size'-limb number of any length, i.e. 'a'
+// reduced and converted to Montgomery form at once.
+// t is scratch space of at least 2*size+2 limbs.
+void bigint_mont_from_wide(bigint_mont_t *mont, uint32_t *r,
+    const uint32_t *a, size_t a_size, uint32_t *t);
+// r = (a-b) mod n, a and b less than n, r may alias either
+void bigint_mont_sub(bigint_mont_t *mont, uint32_t *r, const uint32_t *a,
+    const uint32_t *b);
+// r = a*b/R mod n, a must be less than R, b less than n.
+// r may alias a or b, t is scratch space of at least size+2 limbs.
+void bigint_mont_mul(bigint_mont_t *mont, uint32_t *r, const uint32_t *a,
+    const uint32_t *b, uint32_t *t);
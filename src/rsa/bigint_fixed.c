@@ -0,0 +1,434 @@
+#include "config.h"
+#include "bigint_fixed.h"
+#include "cpu.h"
+#include "stats.h"
+#include "tune.h"
+#include <string.h>
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+// The bodies below take the limb count as a parameter and are forced
+// inline into each wrapper, where it is a literal.
+#if defined(_MSC_VER)
+#define FIXED_INLINE static __forceinline
+#elif defined(__GNUC__) || defined(__clang__)
+#define FIXED_INLINE static inline __attribute__((always_inline))
+#else
+#define FIXED_INLINE static inline
+#endif
+
+// unroll hint for the inner limb loops
+#if defined(__GNUC__) && !defined(__clang__)
+#define FIXED_UNROLL _Pragma("GCC unroll 8")
+#elif defined(__clang__)
+#define FIXED_UNROLL _Pragma("clang loop unroll_count(8)")
+#else
+#define FIXED_UNROLL
+#endif
+
+// r = t+top*2^(32*s) reduced once by n, the input is less than 2n
+FIXED_INLINE void fixed_final(const uint32_t *n, uint32_t *r,
+    const uint32_t *t, uint32_t top, size_t s)
+{
+    uint32_t borrow = 0;
+    for (size_t i = 0; i<s; i++)
+    {
+        uint64_t diff = (uint64_t)t[i]-n[i]-borrow;
+        r[i] = (uint32_t)diff;
+        borrow = (uint32_t)(diff>>63);
+    }
+    // t < n: the subtraction borrowed out of 'top'
+    if (top<borrow)
+        memcpy(r, t, s*sizeof(uint32_t));
+}
+
+// CIOS, as in bigint_mont_mul()
+FIXED_INLINE void fixed_mul(bigint_mont_t *mont, uint32_t *r,
+    const uint32_t *a, const uint32_t *b, uint32_t *t, size_t s)
+{
+    const uint32_t *n = mont->n;
+    uint32_t n0inv = mont->n0inv;
+    STATS_ADD(STAT_MONT_MUL, 1);
+    STATS_ADD(STAT_LIMB_OPS, 2*s*s);
+    memset(t, 0, (s+2)*sizeof(uint32_t));
+    for (size_t i = 0; i<s; i++)
+    {
+        uint64_t c = 0;
+        uint32_t bi = b[i];
+        FIXED_UNROLL
+        for (size_t j = 0; j<s; j++)
+        {
+            c += (uint64_t)a[j]*bi+t[j];
+            t[j] = (uint32_t)c;
+            c >>= 32;
+        }
+        c += t[s];
+        t[s] = (uint32_t)c;
+        t[s+1] = (uint32_t)(c>>32);
+        uint32_t m = t[0]*n0inv;
+        c = ((uint64_t)m*n[0]+t[0])>>32;
+        FIXED_UNROLL
+        for (size_t j = 1; j<s; j++)
+        {
+            c += (uint64_t)m*n[j]+t[j];
+            t[j-1] = (uint32_t)c;
+            c >>= 32;
+        }
+        c += t[s];
+        t[s-1] = (uint32_t)c;
+        t[s] = t[s+1]+(uint32_t)(c>>32);
+    }
+    fixed_final(n, r, t, t[s], s);
+}
+
+// Full square with each cross product computed once, then a separate
+// Montgomery reduction: about 1.5*s^2 limb products instead of 2*s^2.
+FIXED_INLINE void fixed_sqr(bigint_mont_t *mont, uint32_t *r,
+    const uint32_t *a, uint32_t *t, size_t s)
+{
+    const uint32_t *n = mont->n;
+    uint32_t n0inv = mont->n0inv;
+    STATS_ADD(STAT_MONT_MUL, 1);
+    STATS_ADD(STAT_LIMB_OPS, s*(s-1)/2+s+s*s);
+    // t = sum of a[i]*a[j] for i < j
+    memset(t, 0, 2*s*sizeof(uint32_t));
+    for (size_t i = 0; i+1<s; i++)
+    {
+        uint64_t c = 0;
+        uint32_t ai = a[i];
+        FIXED_UNROLL
+        for (size_t j = i+1; j<s; j++)
+        {
+            c += (uint64_t)ai*a[j]+t[i+j];
+            t[i+j] = (uint32_t)c;
+            c >>= 32;
+        }
+        t[i+s] = (uint32_t)c;
+    }
+    // t = 2*t + sum of a[i]^2, fits 2*s limbs
+    uint32_t shifted = 0;
+    uint64_t c = 0;
+    for (size_t i = 0; i<s; i++)
+    {
+        uint64_t sq = (uint64_t)a[i]*a[i];
+        uint32_t lo = t[2*i];
+        uint32_t hi = t[2*i+1];
+        c += (uint64_t)(lo<<1 | shifted)+(uint32_t)sq;
+        t[2*i] = (uint32_t)c;
+        c >>= 32;
+        c += (uint64_t)(hi<<1 | lo>>31)+(sq>>32);
+        t[2*i+1] = (uint32_t)c;
+        c >>= 32;
+        shifted = hi>>31;
+    }
+    // reduce: clear one low limb per step, carries out of the upper half
+    // ride in 'top' until the next step adds them
+    uint32_t top = 0;
+    for (size_t i = 0; i<s; i++)
+    {
+        uint32_t m = t[i]*n0inv;
+        c = 0;
+        FIXED_UNROLL
+        for (size_t j = 0; j<s; j++)
+        {
+            c += (uint64_t)m*n[j]+t[i+j];
+            t[i+j] = (uint32_t)c;
+            c >>= 32;
+        }
+        c += (uint64_t)t[i+s]+top;
+        t[i+s] = (uint32_t)c;
+        top = (uint32_t)(c>>32);
+    }
+    fixed_final(n, r, t+s, top, s);
+}
+
+FIXED_INLINE void fixed_sub(bigint_mont_t *mont, uint32_t *r,
+    const uint32_t *a, const uint32_t *b, size_t s)
+{
+    uint32_t borrow = 0;
+    for (size_t i = 0; i<s; i++)
+    {
+        uint64_t diff = (uint64_t)a[i]-b[i]-borrow;
+        r[i] = (uint32_t)diff;
+        borrow = (uint32_t)(diff>>63);
+    }
+    // wrapped below zero, add n back; branch-free so the loop stays flat
+    uint32_t mask = 0-borrow;
+    uint64_t carry = 0;
+    for (size_t i = 0; i<s; i++)
+    {
+        carry += (uint64_t)r[i]+(mont->n[i] & mask);
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+#define FIXED_KERNEL(S) \
+    static void fixed_mul_##S(bigint_mont_t *mont, uint32_t *r, \
+        const uint32_t *a, const uint32_t *b, uint32_t *t) \
+    { fixed_mul(mont, r, a, b, t, S); } \
+    static void fixed_sqr_##S(bigint_mont_t *mont, uint32_t *r, \
+        const uint32_t *a, uint32_t *t) \
+    { fixed_sqr(mont, r, a, t, S); } \
+    static void fixed_sub_##S(bigint_mont_t *mont, uint32_t *r, \
+        const uint32_t *a, const uint32_t *b) \
+    { fixed_sub(mont, r, a, b, S); }
+
+FIXED_KERNEL(16)
+FIXED_KERNEL(32)
+FIXED_KERNEL(48)
+FIXED_KERNEL(64)
+FIXED_KERNEL(96)
+FIXED_KERNEL(128)
+
+static void fixed_sqr_any(bigint_mont_t *mont, uint32_t *r,
+    const uint32_t *a, uint32_t *t)
+{ fixed_sqr(mont, r, a, t, mont->size); }
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define ADX_KERNELS 1
+#else
+#define ADX_KERNELS 0
+#endif
+
+#if ADX_KERNELS
+// Pairs of 32-bit limbs read as one 64-bit word (x86 is little endian),
+// at any 4-byte alignment and without breaking strict aliasing.
+#if defined(__GNUC__) || defined(__clang__)
+typedef uint64_t adx_word_t __attribute__((may_alias, aligned(4)));
+#else
+typedef uint64_t adx_word_t;
+#endif
+
+#define ADX_TARGET CPU_TARGET("bmi2,adx")
+
+// -n^-1 mod 2^64 from the 32-bit constant, one Newton step
+static uint64_t adx_n0inv(const bigint_mont_t *mont)
+{
+    uint64_t n0 = (uint64_t)mont->n[1]<<32 | mont->n[0];
+    uint64_t inv = (uint32_t)(0u-mont->n0inv);
+    inv *= 2-n0*inv;
+    return 0-inv;
+}
+
+// r = t+top*2^(64*w) reduced once by n, the input is less than 2n
+ADX_TARGET
+static void adx_final(const adx_word_t *n, adx_word_t *r,
+    const adx_word_t *t, uint64_t top, size_t w)
+{
+    unsigned char borrow = 0;
+    for (size_t i = 0; i<w; i++)
+    {
+        unsigned long long diff;
+        borrow = _subborrow_u64(borrow, t[i], n[i], &diff);
+        r[i] = diff;
+    }
+    if (top<borrow)
+        memcpy((void *)r, (const void *)t, w*sizeof(uint64_t));
+}
+
+// CIOS over 64-bit words. Each row runs two carry chains: ADCX adds the
+// high half of the previous product to the low half of this one, ADOX
+// accumulates that into t, so neither waits on the other's flag.
+ADX_TARGET
+static void adx_mul(bigint_mont_t *mont, uint32_t *r32, const uint32_t *a32,
+    const uint32_t *b32, uint32_t *t32)
+{
+    size_t w = mont->size/2;
+    const adx_word_t *n = (const adx_word_t *)mont->n;
+    const adx_word_t *a = (const adx_word_t *)a32;
+    const adx_word_t *b = (const adx_word_t *)b32;
+    adx_word_t *t = (adx_word_t *)t32;
+    uint64_t n0inv = adx_n0inv(mont);
+    STATS_ADD(STAT_MONT_MUL, 1);
+    STATS_ADD(STAT_LIMB_OPS, 2*w*w);
+    memset(t32, 0, (w+1)*sizeof(uint64_t));
+    for (size_t i = 0; i<w; i++)
+    {
+        // t += a*b[i]
+        unsigned long long lo, hi, prev = 0;
+        unsigned char cf = 0, of = 0;
+        uint64_t bi = b[i];
+        for (size_t j = 0; j<w; j++)
+        {
+            lo = _mulx_u64(a[j], bi, &hi);
+            cf = _addcarryx_u64(cf, lo, prev, &lo);
+            of = _addcarryx_u64(of, t[j], lo, &lo);
+            t[j] = lo;
+            prev = hi;
+        }
+        // prev < 2^64-1, so adding cf can't wrap
+        uint64_t top = t[w];
+        of = _addcarryx_u64(of, top, prev+cf, &lo);
+        t[w] = lo;
+        uint64_t top_carry = of;
+        // t = (t+m*n)/2^64
+        uint64_t m = t[0]*n0inv;
+        lo = _mulx_u64(n[0], m, &hi);
+        of = _addcarryx_u64(0, t[0], lo, &lo);
+        prev = hi;
+        cf = 0;
+        for (size_t j = 1; j<w; j++)
+        {
+            lo = _mulx_u64(n[j], m, &hi);
+            cf = _addcarryx_u64(cf, lo, prev, &lo);
+            of = _addcarryx_u64(of, t[j], lo, &lo);
+            t[j-1] = lo;
+            prev = hi;
+        }
+        of = _addcarryx_u64(of, t[w], prev+cf, &lo);
+        t[w-1] = lo;
+        t[w] = top_carry+of;
+    }
+    adx_final(n, (adx_word_t *)r32, t, t[w], w);
+}
+
+// Square as in fixed_sqr(): cross products once, doubled, squares added,
+// then a separate reduction that clears one low word per step.
+ADX_TARGET
+static void adx_sqr(bigint_mont_t *mont, uint32_t *r32, const uint32_t *a32,
+    uint32_t *t32)
+{
+    size_t w = mont->size/2;
+    const adx_word_t *n = (const adx_word_t *)mont->n;
+    const adx_word_t *a = (const adx_word_t *)a32;
+    adx_word_t *t = (adx_word_t *)t32;
+    uint64_t n0inv = adx_n0inv(mont);
+    STATS_ADD(STAT_MONT_MUL, 1);
+    STATS_ADD(STAT_LIMB_OPS, w*(w-1)/2+w+w*w);
+    memset(t32, 0, 2*w*sizeof(uint64_t));
+    unsigned long long lo, hi, prev;
+    unsigned char cf, of;
+    for (size_t i = 0; i+1<w; i++)
+    {
+        uint64_t ai = a[i];
+        prev = 0;
+        cf = of = 0;
+        for (size_t j = i+1; j<w; j++)
+        {
+            lo = _mulx_u64(ai, a[j], &hi);
+            cf = _addcarryx_u64(cf, lo, prev, &lo);
+            of = _addcarryx_u64(of, t[i+j], lo, &lo);
+            t[i+j] = lo;
+            prev = hi;
+        }
+        // t[i+w] is still zero here
+        t[i+w] = prev+cf+of;
+    }
+    // t = 2*t + sum of a[i]^2
+    cf = 0;
+    uint64_t shifted = 0;
+    for (size_t i = 0; i<w; i++)
+    {
+        uint64_t lo_word = t[2*i];
+        uint64_t hi_word = t[2*i+1];
+        lo = _mulx_u64(a[i], a[i], &hi);
+        cf = _addcarry_u64(cf, lo_word<<1 | shifted, lo, &lo);
+        t[2*i] = lo;
+        cf = _addcarry_u64(cf, hi_word<<1 | lo_word>>63, hi, &lo);
+        t[2*i+1] = lo;
+        shifted = hi_word>>63;
+    }
+    // reduce, carries out of the upper half wait in 'top'
+    uint64_t top = 0;
+    for (size_t i = 0; i<w; i++)
+    {
+        uint64_t m = t[i]*n0inv;
+        prev = 0;
+        cf = of = 0;
+        for (size_t j = 0; j<w; j++)
+        {
+            lo = _mulx_u64(n[j], m, &hi);
+            cf = _addcarryx_u64(cf, lo, prev, &lo);
+            of = _addcarryx_u64(of, t[i+j], lo, &lo);
+            t[i+j] = lo;
+            prev = hi;
+        }
+        unsigned char c = _addcarry_u64(0, t[i+w], prev+cf, &lo);
+        c += _addcarry_u64(0, lo, top+of, &lo);
+        t[i+w] = lo;
+        top = c;
+    }
+    adx_final(n, (adx_word_t *)r32, t+w, top, w);
+}
+
+ADX_TARGET
+static void adx_sub(bigint_mont_t *mont, uint32_t *r32, const uint32_t *a32,
+    const uint32_t *b32)
+{
+    size_t w = mont->size/2;
+    const adx_word_t *n = (const adx_word_t *)mont->n;
+    const adx_word_t *a = (const adx_word_t *)a32;
+    const adx_word_t *b = (const adx_word_t *)b32;
+    adx_word_t *r = (adx_word_t *)r32;
+    unsigned char borrow = 0;
+    unsigned long long word;
+    for (size_t i = 0; i<w; i++)
+    {
+        borrow = _subborrow_u64(borrow, a[i], b[i], &word);
+        r[i] = word;
+    }
+    // wrapped below zero, add n back
+    uint64_t mask = 0-(uint64_t)borrow;
+    unsigned char carry = 0;
+    for (size_t i = 0; i<w; i++)
+    {
+        carry = _addcarry_u64(carry, r[i], n[i] & mask, &word);
+        r[i] = word;
+    }
+}
+#endif
+
+#define FIXED_ENTRY(S) \
+    {"fixed", S, fixed_mul_##S, fixed_sqr_##S, fixed_sub_##S}
+
+// generic kernel last
+static const bigint_fixed_kernel_t fixed_kernels[] = {
+    FIXED_ENTRY(16),
+    FIXED_ENTRY(32),
+    FIXED_ENTRY(48),
+    FIXED_ENTRY(64),
+    FIXED_ENTRY(96),
+    FIXED_ENTRY(128),
+    {"generic", 0, bigint_mont_mul, fixed_sqr_any, bigint_mont_sub}
+};
+
+#if ADX_KERNELS
+// even sizes only
+static const bigint_fixed_kernel_t adx_kernel =
+    {"adx", 0, adx_mul, adx_sqr, adx_sub};
+#endif
+
+size_t bigint_fixed_candidates(size_t size, unsigned features,
+    const bigint_fixed_kernel_t **kernels)
+{
+    size_t count = 0;
+#if ADX_KERNELS
+    unsigned adx = CPU_ADX | CPU_BMI2;
+    if ((features & adx)==adx && size%2==0)
+        kernels[count++] = &adx_kernel;
+#endif
+    size_t i = 0;
+    while (fixed_kernels[i].size && fixed_kernels[i].size!=size)
+        i++;
+    kernels[count++] = &fixed_kernels[i];
+    if (fixed_kernels[i].size)
+        kernels[count++] = &fixed_kernels[sizeof(fixed_kernels)/
+            sizeof(fixed_kernels[0])-1];
+    return count;
+}
+
+const bigint_fixed_kernel_t *bigint_fixed_select(size_t size,
+    unsigned features)
+{
+    const bigint_fixed_kernel_t *kernels[BIGINT_FIXED_MAX_CANDIDATES];
+    size_t count = bigint_fixed_candidates(size, features, kernels);
+    const char *name = tune_kernel(size);
+    for (size_t i = 0; name && i<count; i++)
+    {
+        if (!strcmp(kernels[i]->name, name))
+            return kernels[i];
+    }
+    return kernels[0];
+}
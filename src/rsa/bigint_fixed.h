@@ -0,0 +1,39 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+#include "bigint.h"
+
+// Montgomery kernels specialized for the limb counts of common moduli
+// and their CRT halves (512 to 4096 bits). Every kernel is the same code
+// instantiated with the size as a compile-time constant, so loop bounds
+// are fixed and the compiler unrolls and schedules them freely; sizes
+// without a specialization get the generic kernel. On x86-64 with BMI2
+// and ADX, even sizes get 64-bit MULX/ADCX/ADOX kernels instead.
+
+typedef struct
+{
+    const char *name;
+    size_t size; // limbs, 0 for any size
+    // r = a*b/R mod n, same contract as bigint_mont_mul()
+    void (*mul)(bigint_mont_t *mont, uint32_t *r, const uint32_t *a,
+        const uint32_t *b, uint32_t *t);
+    // r = a*a/R mod n, a less than n, r may alias a.
+    // t is scratch space of at least 2*size limbs.
+    void (*sqr)(bigint_mont_t *mont, uint32_t *r, const uint32_t *a,
+        uint32_t *t);
+    // r = (a-b) mod n, same contract as bigint_mont_sub()
+    void (*sub)(bigint_mont_t *mont, uint32_t *r, const uint32_t *a,
+        const uint32_t *b);
+} bigint_fixed_kernel_t;
+
+#define BIGINT_FIXED_MAX_CANDIDATES 3
+
+// Kernels usable for a 'size'-limb modulus with only the CPU_* features in
+// 'features', fastest by default first; returns their count.
+size_t bigint_fixed_candidates(size_t size, unsigned features,
+    const bigint_fixed_kernel_t **kernels);
+// Best kernel for a 'size'-limb modulus using only the CPU_* features in
+// 'features'; pass cpu_features() for the fastest one on this machine.
+// The kernel chosen for the size by 'rsa tune' wins when it is usable.
+const bigint_fixed_kernel_t *bigint_fixed_select(size_t size,
+    unsigned features);
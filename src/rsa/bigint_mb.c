@@ -0,0 +1,316 @@
+#include "config.h"
+#include "bigint_mb.h"
+#include "cpu.h"
+#include "tune.h"
+#include <string.h>
+#if CPU_X86
+#include <immintrin.h>
+#endif
+
+#define MB_MASK32 0xffffffffull
+
+// Portable fallback, same algorithm as bigint_mont_mul() with the lane
+// loop innermost.
+#define SCALAR_LANES 4
+
+static void mb_mont_mul_scalar(bigint_mont_t *mont, uint64_t *r,
+    const uint64_t *a, const uint64_t *b, uint64_t *t)
+{
+    const size_t L = SCALAR_LANES;
+    size_t s = mont->size;
+    const uint32_t *n = mont->n;
+    uint64_t c[SCALAR_LANES], m[SCALAR_LANES];
+    memset(t, 0, (s+2)*L*sizeof(uint64_t));
+    for (size_t i = 0; i<s; i++)
+    {
+        const uint64_t *bi = b+i*L;
+        for (size_t l = 0; l<L; l++)
+            c[l] = 0;
+        for (size_t j = 0; j<s; j++)
+        {
+            for (size_t l = 0; l<L; l++)
+            {
+                c[l] += a[j*L+l]*bi[l]+t[j*L+l];
+                t[j*L+l] = c[l] & MB_MASK32;
+                c[l] >>= 32;
+            }
+        }
+        for (size_t l = 0; l<L; l++)
+        {
+            c[l] += t[s*L+l];
+            t[s*L+l] = c[l] & MB_MASK32;
+            t[(s+1)*L+l] = c[l]>>32;
+            m[l] = t[l]*mont->n0inv & MB_MASK32;
+            c[l] = (m[l]*n[0]+t[l])>>32;
+        }
+        for (size_t j = 1; j<s; j++)
+        {
+            for (size_t l = 0; l<L; l++)
+            {
+                c[l] += m[l]*n[j]+t[j*L+l];
+                t[(j-1)*L+l] = c[l] & MB_MASK32;
+                c[l] >>= 32;
+            }
+        }
+        for (size_t l = 0; l<L; l++)
+        {
+            c[l] += t[s*L+l];
+            t[(s-1)*L+l] = c[l] & MB_MASK32;
+            t[s*L+l] = t[(s+1)*L+l]+(c[l]>>32);
+        }
+    }
+    // t < 2n in every lane, subtract n where t >= n
+    for (size_t l = 0; l<L; l++)
+    {
+        uint64_t borrow = 0;
+        for (size_t j = 0; j<s; j++)
+            borrow = (t[j*L+l]-n[j]-borrow)>>63;
+        int keep = t[s*L+l]<borrow;
+        borrow = 0;
+        for (size_t j = 0; j<s; j++)
+        {
+            uint64_t diff = t[j*L+l]-n[j]-borrow;
+            borrow = diff>>63;
+            r[j*L+l] = keep ? t[j*L+l] : diff & MB_MASK32;
+        }
+    }
+}
+
+#if CPU_X86
+// AVX2: four 64-bit slots per register, two registers per limb.
+#define AVX2_LANES 8
+#define LD256(p) _mm256_loadu_si256((const __m256i *)(p))
+#define ST256(p, v) _mm256_storeu_si256((__m256i *)(p), v)
+
+CPU_TARGET("avx2")
+static void mb_mont_mul_avx2(bigint_mont_t *mont, uint64_t *r,
+    const uint64_t *a, const uint64_t *b, uint64_t *t)
+{
+    const size_t L = AVX2_LANES;
+    size_t s = mont->size;
+    const uint32_t *n = mont->n;
+    const __m256i mask = _mm256_set1_epi64x(MB_MASK32);
+    const __m256i n0inv = _mm256_set1_epi64x(mont->n0inv);
+    const __m256i zero = _mm256_setzero_si256();
+    memset(t, 0, (s+2)*L*sizeof(uint64_t));
+    for (size_t i = 0; i<s; i++)
+    {
+        __m256i b0 = LD256(b+i*L);
+        __m256i b1 = LD256(b+i*L+4);
+        __m256i c0 = zero, c1 = zero;
+        for (size_t j = 0; j<s; j++)
+        {
+            uint64_t *tj = t+j*L;
+            c0 = _mm256_add_epi64(c0, _mm256_add_epi64(
+                _mm256_mul_epu32(LD256(a+j*L), b0), LD256(tj)));
+            c1 = _mm256_add_epi64(c1, _mm256_add_epi64(
+                _mm256_mul_epu32(LD256(a+j*L+4), b1), LD256(tj+4)));
+            ST256(tj, _mm256_and_si256(c0, mask));
+            ST256(tj+4, _mm256_and_si256(c1, mask));
+            c0 = _mm256_srli_epi64(c0, 32);
+            c1 = _mm256_srli_epi64(c1, 32);
+        }
+        c0 = _mm256_add_epi64(c0, LD256(t+s*L));
+        c1 = _mm256_add_epi64(c1, LD256(t+s*L+4));
+        ST256(t+s*L, _mm256_and_si256(c0, mask));
+        ST256(t+s*L+4, _mm256_and_si256(c1, mask));
+        ST256(t+(s+1)*L, _mm256_srli_epi64(c0, 32));
+        ST256(t+(s+1)*L+4, _mm256_srli_epi64(c1, 32));
+        __m256i m0 = _mm256_and_si256(_mm256_mul_epu32(LD256(t), n0inv), mask);
+        __m256i m1 = _mm256_and_si256(_mm256_mul_epu32(LD256(t+4), n0inv),
+            mask);
+        __m256i nj = _mm256_set1_epi64x(n[0]);
+        c0 = _mm256_srli_epi64(_mm256_add_epi64(_mm256_mul_epu32(m0, nj),
+            LD256(t)), 32);
+        c1 = _mm256_srli_epi64(_mm256_add_epi64(_mm256_mul_epu32(m1, nj),
+            LD256(t+4)), 32);
+        for (size_t j = 1; j<s; j++)
+        {
+            uint64_t *tj = t+j*L;
+            nj = _mm256_set1_epi64x(n[j]);
+            c0 = _mm256_add_epi64(c0, _mm256_add_epi64(
+                _mm256_mul_epu32(m0, nj), LD256(tj)));
+            c1 = _mm256_add_epi64(c1, _mm256_add_epi64(
+                _mm256_mul_epu32(m1, nj), LD256(tj+4)));
+            ST256(tj-L, _mm256_and_si256(c0, mask));
+            ST256(tj-L+4, _mm256_and_si256(c1, mask));
+            c0 = _mm256_srli_epi64(c0, 32);
+            c1 = _mm256_srli_epi64(c1, 32);
+        }
+        c0 = _mm256_add_epi64(c0, LD256(t+s*L));
+        c1 = _mm256_add_epi64(c1, LD256(t+s*L+4));
+        ST256(t+(s-1)*L, _mm256_and_si256(c0, mask));
+        ST256(t+(s-1)*L+4, _mm256_and_si256(c1, mask));
+        ST256(t+s*L, _mm256_add_epi64(LD256(t+(s+1)*L),
+            _mm256_srli_epi64(c0, 32)));
+        ST256(t+s*L+4, _mm256_add_epi64(LD256(t+(s+1)*L+4),
+            _mm256_srli_epi64(c1, 32)));
+    }
+    // t < 2n in every lane, subtract n where t >= n
+    __m256i borrow0 = zero, borrow1 = zero;
+    for (size_t j = 0; j<s; j++)
+    {
+        __m256i nj = _mm256_set1_epi64x(n[j]);
+        borrow0 = _mm256_srli_epi64(_mm256_sub_epi64(_mm256_sub_epi64(
+            LD256(t+j*L), nj), borrow0), 63);
+        borrow1 = _mm256_srli_epi64(_mm256_sub_epi64(_mm256_sub_epi64(
+            LD256(t+j*L+4), nj), borrow1), 63);
+    }
+    __m256i keep0 = _mm256_cmpgt_epi64(borrow0, LD256(t+s*L));
+    __m256i keep1 = _mm256_cmpgt_epi64(borrow1, LD256(t+s*L+4));
+    borrow0 = borrow1 = zero;
+    for (size_t j = 0; j<s; j++)
+    {
+        __m256i nj = _mm256_set1_epi64x(n[j]);
+        __m256i t0 = LD256(t+j*L);
+        __m256i t1 = LD256(t+j*L+4);
+        __m256i d0 = _mm256_sub_epi64(_mm256_sub_epi64(t0, nj), borrow0);
+        __m256i d1 = _mm256_sub_epi64(_mm256_sub_epi64(t1, nj), borrow1);
+        borrow0 = _mm256_srli_epi64(d0, 63);
+        borrow1 = _mm256_srli_epi64(d1, 63);
+        ST256(r+j*L, _mm256_blendv_epi8(_mm256_and_si256(d0, mask), t0,
+            keep0));
+        ST256(r+j*L+4, _mm256_blendv_epi8(_mm256_and_si256(d1, mask), t1,
+            keep1));
+    }
+}
+
+// AVX-512F: eight 64-bit slots per register, two registers per limb.
+#define AVX512_LANES 16
+#define LD512(p) _mm512_loadu_si512((const void *)(p))
+#define ST512(p, v) _mm512_storeu_si512((void *)(p), v)
+
+CPU_TARGET("avx512f")
+static void mb_mont_mul_avx512(bigint_mont_t *mont, uint64_t *r,
+    const uint64_t *a, const uint64_t *b, uint64_t *t)
+{
+    const size_t L = AVX512_LANES;
+    size_t s = mont->size;
+    const uint32_t *n = mont->n;
+    const __m512i mask = _mm512_set1_epi64(MB_MASK32);
+    const __m512i n0inv = _mm512_set1_epi64(mont->n0inv);
+    const __m512i zero = _mm512_setzero_si512();
+    memset(t, 0, (s+2)*L*sizeof(uint64_t));
+    for (size_t i = 0; i<s; i++)
+    {
+        __m512i b0 = LD512(b+i*L);
+        __m512i b1 = LD512(b+i*L+8);
+        __m512i c0 = zero, c1 = zero;
+        for (size_t j = 0; j<s; j++)
+        {
+            uint64_t *tj = t+j*L;
+            c0 = _mm512_add_epi64(c0, _mm512_add_epi64(
+                _mm512_mul_epu32(LD512(a+j*L), b0), LD512(tj)));
+            c1 = _mm512_add_epi64(c1, _mm512_add_epi64(
+                _mm512_mul_epu32(LD512(a+j*L+8), b1), LD512(tj+8)));
+            ST512(tj, _mm512_and_si512(c0, mask));
+            ST512(tj+8, _mm512_and_si512(c1, mask));
+            c0 = _mm512_srli_epi64(c0, 32);
+            c1 = _mm512_srli_epi64(c1, 32);
+        }
+        c0 = _mm512_add_epi64(c0, LD512(t+s*L));
+        c1 = _mm512_add_epi64(c1, LD512(t+s*L+8));
+        ST512(t+s*L, _mm512_and_si512(c0, mask));
+        ST512(t+s*L+8, _mm512_and_si512(c1, mask));
+        ST512(t+(s+1)*L, _mm512_srli_epi64(c0, 32));
+        ST512(t+(s+1)*L+8, _mm512_srli_epi64(c1, 32));
+        __m512i m0 = _mm512_and_si512(_mm512_mul_epu32(LD512(t), n0inv), mask);
+        __m512i m1 = _mm512_and_si512(_mm512_mul_epu32(LD512(t+8), n0inv),
+            mask);
+        __m512i nj = _mm512_set1_epi64(n[0]);
+        c0 = _mm512_srli_epi64(_mm512_add_epi64(_mm512_mul_epu32(m0, nj),
+            LD512(t)), 32);
+        c1 = _mm512_srli_epi64(_mm512_add_epi64(_mm512_mul_epu32(m1, nj),
+            LD512(t+8)), 32);
+        for (size_t j = 1; j<s; j++)
+        {
+            uint64_t *tj = t+j*L;
+            nj = _mm512_set1_epi64(n[j]);
+            c0 = _mm512_add_epi64(c0, _mm512_add_epi64(
+                _mm512_mul_epu32(m0, nj), LD512(tj)));
+            c1 = _mm512_add_epi64(c1, _mm512_add_epi64(
+                _mm512_mul_epu32(m1, nj), LD512(tj+8)));
+            ST512(tj-L, _mm512_and_si512(c0, mask));
+            ST512(tj-L+8, _mm512_and_si512(c1, mask));
+            c0 = _mm512_srli_epi64(c0, 32);
+            c1 = _mm512_srli_epi64(c1, 32);
+        }
+        c0 = _mm512_add_epi64(c0, LD512(t+s*L));
+        c1 = _mm512_add_epi64(c1, LD512(t+s*L+8));
+        ST512(t+(s-1)*L, _mm512_and_si512(c0, mask));
+        ST512(t+(s-1)*L+8, _mm512_and_si512(c1, mask));
+        ST512(t+s*L, _mm512_add_epi64(LD512(t+(s+1)*L),
+            _mm512_srli_epi64(c0, 32)));
+        ST512(t+s*L+8, _mm512_add_epi64(LD512(t+(s+1)*L+8),
+            _mm512_srli_epi64(c1, 32)));
+    }
+    // t < 2n in every lane, subtract n where t >= n
+    __m512i borrow0 = zero, borrow1 = zero;
+    for (size_t j = 0; j<s; j++)
+    {
+        __m512i nj = _mm512_set1_epi64(n[j]);
+        borrow0 = _mm512_srli_epi64(_mm512_sub_epi64(_mm512_sub_epi64(
+            LD512(t+j*L), nj), borrow0), 63);
+        borrow1 = _mm512_srli_epi64(_mm512_sub_epi64(_mm512_sub_epi64(
+            LD512(t+j*L+8), nj), borrow1), 63);
+    }
+    __mmask8 keep0 = _mm512_cmplt_epi64_mask(LD512(t+s*L), borrow0);
+    __mmask8 keep1 = _mm512_cmplt_epi64_mask(LD512(t+s*L+8), borrow1);
+    borrow0 = borrow1 = zero;
+    for (size_t j = 0; j<s; j++)
+    {
+        __m512i nj = _mm512_set1_epi64(n[j]);
+        __m512i t0 = LD512(t+j*L);
+        __m512i t1 = LD512(t+j*L+8);
+        __m512i d0 = _mm512_sub_epi64(_mm512_sub_epi64(t0, nj), borrow0);
+        __m512i d1 = _mm512_sub_epi64(_mm512_sub_epi64(t1, nj), borrow1);
+        borrow0 = _mm512_srli_epi64(d0, 63);
+        borrow1 = _mm512_srli_epi64(d1, 63);
+        ST512(r+j*L, _mm512_mask_blend_epi64(keep0,
+            _mm512_and_si512(d0, mask), t0));
+        ST512(r+j*L+8, _mm512_mask_blend_epi64(keep1,
+            _mm512_and_si512(d1, mask), t1));
+    }
+}
+#endif
+
+static const bigint_mb_kernel_t mb_kernels[] = {
+#if CPU_X86
+    {"avx512", AVX512_LANES, mb_mont_mul_avx512},
+    {"avx2", AVX2_LANES, mb_mont_mul_avx2},
+#endif
+    {"scalar", SCALAR_LANES, mb_mont_mul_scalar}
+};
+
+static const unsigned mb_kernel_features[] = {
+#if CPU_X86
+    CPU_AVX512F,
+    CPU_AVX2,
+#endif
+    0
+};
+
+size_t bigint_mb_candidates(unsigned features,
+    const bigint_mb_kernel_t **kernels)
+{
+    size_t count = 0;
+    for (size_t i = 0; i<sizeof(mb_kernels)/sizeof(mb_kernels[0]); i++)
+    {
+        if ((mb_kernel_features[i] & features)==mb_kernel_features[i])
+            kernels[count++] = &mb_kernels[i];
+    }
+    return count;
+}
+
+const bigint_mb_kernel_t *bigint_mb_select(unsigned features)
+{
+    const bigint_mb_kernel_t *kernels[BIGINT_MB_MAX_CANDIDATES];
+    size_t count = bigint_mb_candidates(features, kernels);
+    const char *name = tune_params()->mb_kernel;
+    for (size_t i = 0; i<count; i++)
+    {
+        if (!strcmp(kernels[i]->name, name))
+            return kernels[i];
+    }
+    return kernels[0];
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+#include "bigint.h"
+
+// Multi-buffer Montgomery multiplication: 'lanes' independent operands
+// sharing one modulus, processed vertically so every SIMD lane runs the
+// same instruction stream on a different operand.
+//
+// Operands are limb-interleaved (struct of arrays): limb j of lane l is
+// stored at x[j*lanes+l]. Each 32-bit limb occupies a 64-bit slot, which
+// leaves every lane room for the carry of a 32x32-bit product.
+
+#define BIGINT_MB_MAX_LANES 16
+
+typedef void (*bigint_mb_mul_t)(bigint_mont_t *mont, uint64_t *r,
+    const uint64_t *a, const uint64_t *b, uint64_t *t);
+
+typedef struct
+{
+    const char *name;
+    size_t lanes;
+    // r = a*b/R mod n for every lane, r may alias a or b.
+    // t is scratch space of at least (size+2)*lanes slots.
+    bigint_mb_mul_t mul;
+} bigint_mb_kernel_t;
+
+#define BIGINT_MB_MAX_CANDIDATES 3
+
+// Kernels usable with only the CPU_* features in 'features', fastest by
+// default first; returns their count.
+size_t bigint_mb_candidates(unsigned features,
+    const bigint_mb_kernel_t **kernels);
+// Best kernel using only the CPU_* features in 'features'; pass
+// cpu_features() to get the fastest one for this machine. The kernel
+// chosen by 'rsa tune' wins when it is usable.
+const bigint_mb_kernel_t *bigint_mb_select(unsigned features);
@@ -0,0 +1,203 @@
+#include "config.h"
+#include "bigint_ntt.h"
+#include "bigint.h"
+#include <string.h>
+
+typedef struct
+{
+    uint32_t p;
+    uint32_t g; // primitive root
+    uint32_t pinv; // -p^-1 mod 2^32
+    uint32_t r2; // 2^64 mod p
+} ntt_prime_t;
+
+// largest power of two dividing p-1: 2^27, 2^26 and 2^25
+static const uint32_t ntt_primes[3][2] = {
+    {2013265921, 31}, // 15*2^27+1
+    {469762049, 3}, // 7*2^26+1
+    {2113929217, 5} // 63*2^25+1
+};
+
+// Data stays in plain form and every constant is kept in Montgomery
+// form, so one REDC per product gives a plain result again.
+static uint32_t ntt_redc(const ntt_prime_t *prime, uint64_t x)
+{
+    uint32_t m = (uint32_t)x*prime->pinv;
+    uint32_t t = (uint32_t)((x+(uint64_t)m*prime->p)>>32);
+    return t>=prime->p ? t-prime->p : t;
+}
+
+static uint32_t ntt_mul(const ntt_prime_t *prime, uint32_t a, uint32_t b)
+{ return ntt_redc(prime, (uint64_t)a*b); }
+
+static uint32_t ntt_to_mont(const ntt_prime_t *prime, uint32_t a)
+{ return ntt_redc(prime, (uint64_t)a*prime->r2); }
+
+// x^e, x and the result in Montgomery form
+static uint32_t ntt_pow(const ntt_prime_t *prime, uint32_t x, uint64_t e)
+{
+    uint32_t r = ntt_to_mont(prime, 1);
+    for (; e; e >>= 1)
+    {
+        if (e&1)
+            r = ntt_mul(prime, r, x);
+        x = ntt_mul(prime, x, x);
+    }
+    return r;
+}
+
+static void ntt_prime_init(ntt_prime_t *prime, size_t index)
+{
+    uint32_t p = ntt_primes[index][0];
+    prime->p = p;
+    prime->g = ntt_primes[index][1];
+    uint32_t inv = p;
+    for (int i = 0; i<4; i++)
+        inv *= 2-p*inv;
+    prime->pinv = (uint32_t)0-inv;
+    uint64_t r = ((uint64_t)1<<32)%p;
+    prime->r2 = (uint32_t)(r*r%p);
+}
+
+// roots[k] = w^k for k < len/2, w a primitive len-th root (Montgomery)
+static void ntt_roots(const ntt_prime_t *prime, uint32_t *roots,
+    size_t len, int inverse)
+{
+    uint32_t w = ntt_pow(prime, ntt_to_mont(prime, prime->g),
+        (prime->p-1)/len);
+    if (inverse)
+        w = ntt_pow(prime, w, prime->p-2);
+    roots[0] = ntt_to_mont(prime, 1);
+    for (size_t k = 1; k<len/2; k++)
+        roots[k] = ntt_mul(prime, roots[k-1], w);
+}
+
+// decimation in frequency, natural order in, bit-reversed order out
+static void ntt_forward(const ntt_prime_t *prime, uint32_t *x, size_t len,
+    const uint32_t *roots)
+{
+    uint32_t p = prime->p;
+    for (size_t half = len/2, stride = 1; half; half >>= 1, stride <<= 1)
+    {
+        for (size_t start = 0; start<len; start += 2*half)
+        {
+            uint32_t *lo = x+start, *hi = x+start+half;
+            for (size_t j = 0; j<half; j++)
+            {
+                uint32_t u = lo[j], v = hi[j];
+                uint32_t sum = u+v;
+                lo[j] = sum>=p ? sum-p : sum;
+                hi[j] = ntt_mul(prime, u+p-v, roots[j*stride]);
+            }
+        }
+    }
+}
+
+// decimation in time, bit-reversed order in, natural order out
+static void ntt_inverse(const ntt_prime_t *prime, uint32_t *x, size_t len,
+    const uint32_t *roots)
+{
+    uint32_t p = prime->p;
+    for (size_t half = 1, stride = len/2; half<len;
+        half <<= 1, stride >>= 1)
+    {
+        for (size_t start = 0; start<len; start += 2*half)
+        {
+            uint32_t *lo = x+start, *hi = x+start+half;
+            for (size_t j = 0; j<half; j++)
+            {
+                uint32_t u = lo[j];
+                uint32_t v = ntt_mul(prime, hi[j], roots[j*stride]);
+                uint32_t sum = u+v;
+                lo[j] = sum>=p ? sum-p : sum;
+                hi[j] = u>=v ? u-v : u+p-v;
+            }
+        }
+    }
+}
+
+// Cyclic convolution of a and b modulo one prime into 'out'; 'tmp' and
+// 'roots' hold len and len/2 words.
+static void ntt_convolve(const ntt_prime_t *prime, uint32_t *out,
+    uint32_t *tmp, uint32_t *roots, size_t len, const uint32_t *a, size_t an,
+    const uint32_t *b, size_t bn)
+{
+    uint32_t p = prime->p;
+    for (size_t i = 0; i<an; i++)
+        out[i] = a[i]%p;
+    memset(out+an, 0, (len-an)*sizeof(uint32_t));
+    for (size_t i = 0; i<bn; i++)
+        tmp[i] = b[i]%p;
+    memset(tmp+bn, 0, (len-bn)*sizeof(uint32_t));
+    ntt_roots(prime, roots, len, 0);
+    ntt_forward(prime, out, len, roots);
+    ntt_forward(prime, tmp, len, roots);
+    for (size_t i = 0; i<len; i++)
+        out[i] = ntt_mul(prime, out[i], tmp[i]);
+    ntt_roots(prime, roots, len, 1);
+    ntt_inverse(prime, out, len, roots);
+    // the pointwise REDC left a factor 1/R, undo it along with 1/len
+    uint32_t scale = ntt_pow(prime, ntt_to_mont(prime, (uint32_t)len),
+        prime->p-2);
+    scale = ntt_mul(prime, scale, prime->r2);
+    for (size_t i = 0; i<len; i++)
+        out[i] = ntt_mul(prime, out[i], scale);
+}
+
+static uint32_t mod_inverse(uint64_t a, uint32_t p)
+{
+    uint64_t r = 1, x = a%p;
+    for (uint32_t e = p-2; e; e >>= 1)
+    {
+        if (e&1)
+            r = r*x%p;
+        x = x*x%p;
+    }
+    return (uint32_t)r;
+}
+
+void bigint_ntt_mul(uint32_t *r, const uint32_t *a, size_t an,
+    const uint32_t *b, size_t bn)
+{
+    size_t size = an+bn;
+    size_t len = 2;
+    while (len<size-1)
+        len <<= 1;
+    uint32_t *buf = bigint_mem_alloc((4*len+len/2)*sizeof(uint32_t));
+    uint32_t *res[3] = {buf, buf+len, buf+2*len};
+    uint32_t *tmp = buf+3*len, *roots = buf+4*len;
+    ntt_prime_t primes[3];
+    for (size_t k = 0; k<3; k++)
+    {
+        ntt_prime_init(&primes[k], k);
+        ntt_convolve(&primes[k], res[k], tmp, roots, len, a, an, b, bn);
+    }
+    // Garner: x = r0 + p0*(t1 + p1*t2), below p0*p1*p2
+    uint32_t p0 = primes[0].p, p1 = primes[1].p, p2 = primes[2].p;
+    uint64_t p01 = (uint64_t)p0*p1;
+    uint32_t inv01 = mod_inverse(p0, p1);
+    uint32_t inv012 = mod_inverse(p01%p2, p2);
+    uint32_t p01_lo = (uint32_t)p01, p01_hi = (uint32_t)(p01>>32);
+    // pending sums for limbs i, i+1 and i+2
+    uint64_t c0 = 0, c1 = 0, c2 = 0;
+    for (size_t i = 0; i<size; i++)
+    {
+        if (i<size-1)
+        {
+            uint32_t r0 = res[0][i], r1 = res[1][i], r2 = res[2][i];
+            uint64_t t1 = (uint64_t)(r1+p1-r0%p1)%p1*inv01%p1;
+            uint64_t v = r0+p0*t1; // below p0*p1
+            uint64_t t2 = (r2+p2-v%p2)%p2*inv012%p2;
+            uint64_t lo = p01_lo*t2, hi = p01_hi*t2;
+            c0 += (v&0xffffffff)+(lo&0xffffffff);
+            c1 += (v>>32)+(lo>>32)+(uint32_t)hi;
+            c2 += hi>>32;
+        }
+        r[i] = (uint32_t)c0;
+        c1 += c0>>32;
+        c0 = c1;
+        c1 = c2;
+        c2 = 0;
+    }
+    bigint_mem_free(buf);
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+// Multiplication of very large operands by number-theoretic transform.
+// The limbs are the coefficients of two polynomials, multiplied by
+// convolution modulo three primes of the form k*2^e+1 below 2^31 and
+// recombined with the CRT. A coefficient of the product is at most
+// min(an, bn)*(2^32-1)^2, which the three primes (about 2^90.7) cover
+// up to the largest transform the last prime supports.
+
+// longest product (an+bn limbs) the transform handles
+#define BIGINT_NTT_MAX_LIMBS ((size_t)1<<25)
+
+// r[0, an+bn) = a*b, an+bn at most BIGINT_NTT_MAX_LIMBS, no aliasing
+void bigint_ntt_mul(uint32_t *r, const uint32_t *a, size_t an,
+    const uint32_t *b, size_t bn);
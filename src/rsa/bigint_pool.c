@@ -0,0 +1,159 @@
+#include "config.h"
+#include "bigint.h"
+#include "thread.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Built-in allocator: per-thread free lists for power-of-two size classes
+// from 64 bytes to 32KiB, which covers the few limb counts an RSA
+// workload cycles through (key, half-key and double-key numbers plus
+// division scratch). Larger blocks go straight to malloc(). Each block
+// starts with a header recording its class, so freeing needs no size and
+// works from any thread; it lands on the freeing thread's list. Blocks are
+// cleared when freed since they may have held key material, and threads
+// flush their lists as they exit.
+
+#define POOL_MIN_SHIFT 6
+#define POOL_CLASSES 10
+#define POOL_LARGE POOL_CLASSES
+#define POOL_CACHE 32 // blocks kept per class and thread
+#define POOL_HEADER 16 // keeps malloc()'s 16-byte alignment
+
+typedef struct
+{
+    size_t size_class;
+    size_t size; // requested size, only kept for large blocks
+} pool_header_t;
+
+typedef struct pool_block
+{
+    struct pool_block *next;
+} pool_block_t;
+
+static THREAD_LOCAL pool_block_t *pool_lists[POOL_CLASSES];
+static THREAD_LOCAL size_t pool_counts[POOL_CLASSES];
+static THREAD_LOCAL int pool_hooked;
+
+static thread_exit_hook_t pool_exit_hook = {bigint_pool_flush, NULL, NULL};
+
+static size_t pool_class(size_t size)
+{
+    for (size_t c = 0; c<POOL_CLASSES; c++)
+    {
+        if (size<=(size_t)1<<(POOL_MIN_SHIFT+c))
+            return c;
+    }
+    return POOL_LARGE;
+}
+
+static pool_header_t *pool_header(void *p)
+{ return (pool_header_t *)((uint8_t *)p-POOL_HEADER); }
+
+static void *pool_alloc(void *user, size_t size)
+{
+    (void)user;
+    size_t c = pool_class(size);
+    pool_header_t *header;
+    if (c!=POOL_LARGE && pool_lists[c])
+    {
+        header = (pool_header_t *)pool_lists[c];
+        pool_lists[c] = pool_lists[c]->next;
+        pool_counts[c]--;
+    }
+    else
+    {
+        size_t bytes = c==POOL_LARGE ? size : (size_t)1<<(POOL_MIN_SHIFT+c);
+        header = malloc(POOL_HEADER+bytes);
+        if (!header)
+            return NULL;
+    }
+    header->size_class = c;
+    header->size = size;
+    return (uint8_t *)header+POOL_HEADER;
+}
+
+static void pool_free(void *user, void *p)
+{
+    (void)user;
+    pool_header_t *header = pool_header(p);
+    size_t c = header->size_class;
+    memset(p, 0, c==POOL_LARGE ? header->size :
+        (size_t)1<<(POOL_MIN_SHIFT+c));
+    if (c==POOL_LARGE || pool_counts[c]==POOL_CACHE)
+    {
+        free(header);
+        return;
+    }
+    if (!pool_hooked)
+    {
+        thread_at_exit(&pool_exit_hook);
+        pool_hooked = 1;
+    }
+    pool_block_t *block = (pool_block_t *)header;
+    block->next = pool_lists[c];
+    pool_lists[c] = block;
+    pool_counts[c]++;
+}
+
+static void *pool_realloc(void *user, void *p, size_t size)
+{
+    if (!p)
+        return pool_alloc(user, size);
+    pool_header_t *header = pool_header(p);
+    size_t c = header->size_class;
+    // still fits the class it came from
+    if (c!=POOL_LARGE && size<=(size_t)1<<(POOL_MIN_SHIFT+c))
+        return p;
+    // no realloc() for large blocks, it could leave the old copy behind
+    size_t old_size = c==POOL_LARGE ? header->size :
+        (size_t)1<<(POOL_MIN_SHIFT+c);
+    void *q = pool_alloc(user, size);
+    if (!q)
+        return NULL;
+    memcpy(q, p, min(old_size, size));
+    pool_free(user, p);
+    return q;
+}
+
+void bigint_pool_flush()
+{
+    for (size_t c = 0; c<POOL_CLASSES; c++)
+    {
+        while (pool_lists[c])
+        {
+            pool_block_t *block = pool_lists[c];
+            pool_lists[c] = block->next;
+            free(block);
+        }
+        pool_counts[c] = 0;
+    }
+}
+
+static bigint_allocator_t allocator = {pool_alloc, pool_realloc, pool_free,
+    NULL};
+
+void bigint_set_allocator(const bigint_allocator_t *hooks)
+{
+    static const bigint_allocator_t pool = {pool_alloc, pool_realloc,
+        pool_free, NULL};
+    allocator = hooks ? *hooks : pool;
+}
+
+void *bigint_mem_alloc(size_t size)
+{
+    STATS_ADD(STAT_ALLOC, 1);
+    return allocator.alloc(allocator.user, size);
+}
+
+void *bigint_mem_realloc(void *p, size_t size)
+{
+    STATS_ADD(STAT_REALLOC, 1);
+    return allocator.realloc(allocator.user, p, size);
+}
+
+void bigint_mem_free(void *p)
+{
+    if (p)
+        allocator.free(allocator.user, p);
+}
@@ -0,0 +1,136 @@
+#include "config.h"
+#include "chacha20.h"
+#include <string.h>
+
+#define ROTL32(v, n) ((v)<<(n) | (v)>>(32-(n)))
+
+#define QUARTERROUND(x, a, b, c, d) \
+    x[a] += x[b]; x[d] = ROTL32(x[d]^x[a], 16); \
+    x[c] += x[d]; x[b] = ROTL32(x[b]^x[c], 12); \
+    x[a] += x[b]; x[d] = ROTL32(x[d]^x[a], 8); \
+    x[c] += x[d]; x[b] = ROTL32(x[b]^x[c], 7)
+
+void chacha20_init(chacha20_t *ctx, const uint8_t key[CHACHA20_KEY_SIZE],
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], uint64_t counter)
+{
+    // "expand 32-byte k"
+    ctx->state[0] = 0x61707865;
+    ctx->state[1] = 0x3320646e;
+    ctx->state[2] = 0x79622d32;
+    ctx->state[3] = 0x6b206574;
+    for (int i = 0; i<8; i++)
+        ctx->state[4+i] = load32_le(key+i*4);
+    ctx->state[12] = (uint32_t)counter;
+    ctx->state[13] = (uint32_t)(counter>>32);
+    ctx->state[14] = load32_le(nonce);
+    ctx->state[15] = load32_le(nonce+4);
+    ctx->used = CHACHA20_BLOCK_SIZE;
+}
+
+static void chacha20_block(chacha20_t *ctx)
+{
+    uint32_t x[16];
+    memcpy(x, ctx->state, sizeof(x));
+    for (int i = 0; i<10; i++)
+    {
+        QUARTERROUND(x, 0, 4, 8, 12);
+        QUARTERROUND(x, 1, 5, 9, 13);
+        QUARTERROUND(x, 2, 6, 10, 14);
+        QUARTERROUND(x, 3, 7, 11, 15);
+        QUARTERROUND(x, 0, 5, 10, 15);
+        QUARTERROUND(x, 1, 6, 11, 12);
+        QUARTERROUND(x, 2, 7, 8, 13);
+        QUARTERROUND(x, 3, 4, 9, 14);
+    }
+    for (int i = 0; i<16; i++)
+        store32_le(ctx->keystream+i*4, x[i]+ctx->state[i]);
+    // 64-bit block counter
+    if (!++ctx->state[12])
+        ctx->state[13]++;
+    ctx->used = 0;
+}
+
+// Four consecutive blocks with the lanes innermost, so every quarter round
+// step is a plain loop the compiler can map onto 128-bit vector registers.
+#define QUARTERROUND4(x, a, b, c, d) \
+    for (int l = 0; l<4; l++) \
+    { \
+        x[a][l] += x[b][l]; x[d][l] = ROTL32(x[d][l]^x[a][l], 16); \
+        x[c][l] += x[d][l]; x[b][l] = ROTL32(x[b][l]^x[c][l], 12); \
+        x[a][l] += x[b][l]; x[d][l] = ROTL32(x[d][l]^x[a][l], 8); \
+        x[c][l] += x[d][l]; x[b][l] = ROTL32(x[b][l]^x[c][l], 7); \
+    }
+
+static void chacha20_xor4(chacha20_t *ctx, const uint8_t *src, uint8_t *dst)
+{
+    uint32_t x[16][4], in[16][4];
+    uint64_t counter = ctx->state[12] | (uint64_t)ctx->state[13]<<32;
+    for (int i = 0; i<16; i++)
+    {
+        for (int l = 0; l<4; l++)
+            in[i][l] = ctx->state[i];
+    }
+    for (int l = 0; l<4; l++)
+    {
+        in[12][l] = (uint32_t)(counter+l);
+        in[13][l] = (uint32_t)((counter+l)>>32);
+    }
+    memcpy(x, in, sizeof(x));
+    for (int i = 0; i<10; i++)
+    {
+        QUARTERROUND4(x, 0, 4, 8, 12);
+        QUARTERROUND4(x, 1, 5, 9, 13);
+        QUARTERROUND4(x, 2, 6, 10, 14);
+        QUARTERROUND4(x, 3, 7, 11, 15);
+        QUARTERROUND4(x, 0, 5, 10, 15);
+        QUARTERROUND4(x, 1, 6, 11, 12);
+        QUARTERROUND4(x, 2, 7, 8, 13);
+        QUARTERROUND4(x, 3, 4, 9, 14);
+    }
+    for (int l = 0; l<4; l++)
+    {
+        for (int i = 0; i<16; i++)
+        {
+            size_t off = l*CHACHA20_BLOCK_SIZE+i*4;
+            store32_le(dst+off, load32_le(src+off)^(x[i][l]+in[i][l]));
+        }
+    }
+    counter += 4;
+    ctx->state[12] = (uint32_t)counter;
+    ctx->state[13] = (uint32_t)(counter>>32);
+}
+
+void chacha20_xor(chacha20_t *ctx, const uint8_t *src, uint8_t *dst,
+    size_t size)
+{
+    // drain the keystream left over from the previous call
+    while (size && ctx->used<CHACHA20_BLOCK_SIZE)
+    {
+        *dst++ = *src++ ^ ctx->keystream[ctx->used++];
+        size--;
+    }
+    while (size>=4*CHACHA20_BLOCK_SIZE)
+    {
+        chacha20_xor4(ctx, src, dst);
+        src += 4*CHACHA20_BLOCK_SIZE;
+        dst += 4*CHACHA20_BLOCK_SIZE;
+        size -= 4*CHACHA20_BLOCK_SIZE;
+    }
+    while (size>=CHACHA20_BLOCK_SIZE)
+    {
+        chacha20_block(ctx);
+        for (int i = 0; i<CHACHA20_BLOCK_SIZE; i++)
+            dst[i] = src[i]^ctx->keystream[i];
+        ctx->used = CHACHA20_BLOCK_SIZE;
+        src += CHACHA20_BLOCK_SIZE;
+        dst += CHACHA20_BLOCK_SIZE;
+        size -= CHACHA20_BLOCK_SIZE;
+    }
+    if (size)
+    {
+        chacha20_block(ctx);
+        for (size_t i = 0; i<size; i++)
+            dst[i] = src[i]^ctx->keystream[i];
+        ctx->used = size;
+    }
+}
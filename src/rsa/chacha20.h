@@ -0,0 +1,22 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+#define CHACHA20_KEY_SIZE 32
+#define CHACHA20_NONCE_SIZE 8
+#define CHACHA20_BLOCK_SIZE 64
+
+// ChaCha20 stream cipher state. Uses the original 64-bit block counter
+// and 64-bit nonce layout, so a single stream is not limited to 256 GiB.
+typedef struct
+{
+    uint32_t state[16];
+    uint8_t keystream[CHACHA20_BLOCK_SIZE];
+    size_t used; // bytes of 'keystream' already consumed
+} chacha20_t;
+
+void chacha20_init(chacha20_t *ctx, const uint8_t key[CHACHA20_KEY_SIZE],
+    const uint8_t nonce[CHACHA20_NONCE_SIZE], uint64_t counter);
+// dst = src^keystream; src and dst may be the same buffer
+void chacha20_xor(chacha20_t *ctx, const uint8_t *src, uint8_t *dst,
+    size_t size);
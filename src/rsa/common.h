@@ -1,7 +1,35 @@
 #pragma once
 #include "config.h"
+#include <stddef.h>
 #include <stdint.h>
 
 #ifndef NULL
 #define NULL ((void *)0)
 #endif
+
+// provided by <stdlib.h> on MSVC only
+#ifndef min
+#define min(a, b) ((a)<(b) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) ((a)>(b) ? (a) : (b))
+#endif
+
+// little endian loads and stores, whatever the host byte order
+static inline uint32_t load32_le(const uint8_t *p)
+{ return p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24; }
+
+static inline uint64_t load64_le(const uint8_t *p)
+{ return load32_le(p) | (uint64_t)load32_le(p+4)<<32; }
+
+static inline void store32_le(uint8_t *p, uint32_t v)
+{
+    for (int i = 0; i<4; i++)
+        p[i] = (uint8_t)(v>>i*8);
+}
+
+static inline void store64_le(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i<8; i++)
+        p[i] = (uint8_t)(v>>i*8);
+}
@@ -3,3 +3,8 @@
 #ifdef _WIN32
 #define _CRT_SECURE_NO_WARNINGS
 #endif
+
+// hot-path counters and timers, see stats.h; 0 compiles them out
+#ifndef RSA_STATS
+#define RSA_STATS 1
+#endif
@@ -0,0 +1,299 @@
+#include "config.h"
+#include "container.h"
+#include "rsa_util.h"
+#include "crc32.h"
+#include "entropy.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t ct_magic[4] = {'R', 'S', 'A', 'C'};
+
+static int ct_seek(FILE *f, uint64_t offset)
+{
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(f, (off_t)offset, SEEK_SET);
+#endif
+}
+
+static int ct_file_size(FILE *f, uint64_t *size)
+{
+#ifdef _WIN32
+    if (_fseeki64(f, 0, SEEK_END))
+        return 1;
+    __int64 pos = _ftelli64(f);
+#else
+    if (fseeko(f, 0, SEEK_END))
+        return 1;
+    off_t pos = ftello(f);
+#endif
+    if (pos<0)
+        return 1;
+    *size = (uint64_t)pos;
+    return 0;
+}
+
+uint64_t ct_fingerprint(bigint_t *n)
+{
+    size_t size = n->size;
+    while (size && !n->data[size-1])
+        size--;
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i<size; i++)
+    {
+        for (int j = 0; j<4; j++)
+        {
+            hash ^= (uint8_t)(n->data[i]>>j*8);
+            hash *= 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+static int ct_write_header(FILE *f, const ct_header_t *header)
+{
+    uint8_t buf[CT_HEADER_SIZE] = {0};
+    memcpy(buf, ct_magic, sizeof(ct_magic));
+    buf[4] = CT_VERSION;
+    store64_le(buf+8, header->plain_size);
+    store32_le(buf+16, header->src_block_size);
+    store32_le(buf+20, header->dst_block_size);
+    store64_le(buf+24, header->fingerprint);
+    if (ct_seek(f, 0) || fwrite(buf, 1, CT_HEADER_SIZE, f)!=CT_HEADER_SIZE)
+        return CT_ERR_IO;
+    return CT_OK;
+}
+
+int ct_read_header(FILE *f, ct_header_t *header)
+{
+    uint8_t buf[CT_HEADER_SIZE];
+    if (ct_seek(f, 0) || fread(buf, 1, CT_HEADER_SIZE, f)!=CT_HEADER_SIZE)
+        return CT_ERR_FORMAT;
+    if (memcmp(buf, ct_magic, sizeof(ct_magic)) || buf[4]!=CT_VERSION)
+        return CT_ERR_FORMAT;
+    header->plain_size = load64_le(buf+8);
+    header->src_block_size = load32_le(buf+16);
+    header->dst_block_size = load32_le(buf+20);
+    header->fingerprint = load64_le(buf+24);
+    if (!header->src_block_size ||
+        header->src_block_size>=header->dst_block_size)
+    {
+        return CT_ERR_FORMAT;
+    }
+    return CT_OK;
+}
+
+// Header this key would write for a 'plain_size' byte payload.
+static void ct_make_header(bigint_t *n, uint64_t plain_size,
+    ct_header_t *header)
+{
+    size_t msg_size, block_size;
+    rsa_get_block_sizes('e', n, &msg_size, &block_size);
+    header->plain_size = plain_size;
+    header->src_block_size = (uint32_t)msg_size;
+    header->dst_block_size = (uint32_t)block_size;
+    header->fingerprint = ct_fingerprint(n);
+}
+
+static uint64_t ct_block_count(const ct_header_t *header)
+{
+    return (header->plain_size+header->src_block_size-1)/
+        header->src_block_size;
+}
+
+static uint64_t ct_record_offset(const ct_header_t *header, uint64_t block)
+{
+    return CT_HEADER_SIZE+block*(header->dst_block_size+CT_RECORD_EXTRA);
+}
+
+// Find the number of leading records in 'dst' that are complete and
+// intact. Only the last complete one is checked, earlier records were
+// written before it.
+static int ct_completed_blocks(FILE *dst, const ct_header_t *header,
+    uint8_t *buf, uint64_t *blocks)
+{
+    uint64_t dst_size;
+    if (ct_file_size(dst, &dst_size))
+        return CT_ERR_IO;
+    size_t record_size = header->dst_block_size+CT_RECORD_EXTRA;
+    uint64_t count = dst_size<CT_HEADER_SIZE ? 0 :
+        (dst_size-CT_HEADER_SIZE)/record_size;
+    count = min(count, ct_block_count(header));
+    while (count)
+    {
+        if (ct_seek(dst, ct_record_offset(header, count-1)) ||
+            fread(buf, 1, record_size, dst)!=record_size)
+        {
+            return CT_ERR_IO;
+        }
+        uint32_t crc = crc32_update(0, buf, header->dst_block_size);
+        if (crc==load32_le(buf+header->dst_block_size))
+            break;
+        count--;
+    }
+    *blocks = count;
+    return CT_OK;
+}
+
+int ct_encrypt(rsa_ctx_t *ctx, bigint_t *n, FILE *src, FILE *dst,
+    int resume)
+{
+    uint64_t plain_size;
+    if (ct_file_size(src, &plain_size))
+        return CT_ERR_IO;
+    ct_header_t header;
+    ct_make_header(n, plain_size, &header);
+    if (header.dst_block_size!=ctx->block_size)
+        return CT_ERR_KEY;
+    size_t block_size = ctx->block_size;
+    size_t msg_size = header.src_block_size;
+    size_t record_size = block_size+CT_RECORD_EXTRA;
+    size_t batch = ctx->mb->lanes;
+    uint8_t *buf = malloc(batch*block_size+record_size);
+    uint8_t *record = buf+batch*block_size;
+    uint64_t block = 0;
+    int result = CT_OK;
+    uint64_t dst_size = 0;
+    if (resume && ct_file_size(dst, &dst_size))
+        result = CT_ERR_IO;
+    // a run interrupted before its header was complete left nothing to keep
+    else if (resume && dst_size>=CT_HEADER_SIZE)
+    {
+        ct_header_t prev;
+        result = ct_read_header(dst, &prev);
+        if (result==CT_OK)
+        {
+            if (prev.plain_size!=header.plain_size ||
+                prev.src_block_size!=header.src_block_size ||
+                prev.dst_block_size!=header.dst_block_size ||
+                prev.fingerprint!=header.fingerprint)
+            {
+                result = CT_ERR_KEY;
+            }
+            else
+                result = ct_completed_blocks(dst, &header, record, &block);
+        }
+    }
+    else
+        result = ct_write_header(dst, &header);
+    uint64_t block_count = ct_block_count(&header);
+    if (result==CT_OK && (ct_seek(src, block*msg_size) ||
+        ct_seek(dst, ct_record_offset(&header, block))))
+    {
+        result = CT_ERR_IO;
+    }
+    while (result==CT_OK && block<block_count)
+    {
+        size_t blocks = (size_t)min(batch, block_count-block);
+        memset(buf, 0, blocks*block_size);
+        for (size_t i = 0; i<blocks; i++)
+        {
+            // XXX: valid for little endian only!
+            uint8_t *p = buf+i*block_size;
+            uint64_t left = plain_size-(block+i)*msg_size;
+            size_t chunk = (size_t)min(left, msg_size);
+            if (fread(p, 1, chunk, src)!=chunk)
+            {
+                result = CT_ERR_IO;
+                break;
+            }
+            // the header records the length, so the tail is just noise
+            if (chunk<msg_size && entropy_read(p+chunk, msg_size-chunk))
+            {
+                result = CT_ERR_ENTROPY;
+                break;
+            }
+        }
+        if (result!=CT_OK)
+            break;
+        rsa_transform_batch(ctx, buf, buf, blocks);
+        for (size_t i = 0; i<blocks; i++)
+        {
+            memcpy(record, buf+i*block_size, block_size);
+            store32_le(record+block_size, crc32_update(0, record, block_size));
+            if (fwrite(record, 1, record_size, dst)!=record_size)
+            {
+                result = CT_ERR_IO;
+                break;
+            }
+        }
+        block += blocks;
+    }
+    free(buf);
+    return result;
+}
+
+int ct_decrypt(rsa_ctx_t *ctx, bigint_t *n, FILE *src, FILE *dst,
+    uint64_t offset, uint64_t size, int resume)
+{
+    ct_header_t header;
+    int result = ct_read_header(src, &header);
+    if (result!=CT_OK)
+        return result;
+    if (header.fingerprint!=ct_fingerprint(n) ||
+        header.dst_block_size!=ctx->block_size)
+    {
+        return CT_ERR_KEY;
+    }
+    if (offset>header.plain_size)
+        return CT_ERR_RANGE;
+    size = min(size, header.plain_size-offset);
+    uint64_t done = 0;
+    if (resume)
+    {
+        if (ct_file_size(dst, &done))
+            return CT_ERR_IO;
+        done = min(done, size);
+    }
+    size_t block_size = ctx->block_size;
+    size_t msg_size = header.src_block_size;
+    size_t record_size = block_size+CT_RECORD_EXTRA;
+    size_t batch = ctx->mb->lanes;
+    uint8_t *buf = malloc(batch*block_size+record_size);
+    uint8_t *record = buf+batch*block_size;
+    uint64_t pos = offset+done;
+    uint64_t end = offset+size;
+    uint64_t block = pos/msg_size;
+    if (ct_seek(src, ct_record_offset(&header, block)) || ct_seek(dst, done))
+        result = CT_ERR_IO;
+    while (result==CT_OK && pos<end)
+    {
+        uint64_t last_block = (end-1)/msg_size;
+        size_t blocks = (size_t)min(batch, last_block-block+1);
+        for (size_t i = 0; i<blocks; i++)
+        {
+            if (fread(record, 1, record_size, src)!=record_size)
+            {
+                result = CT_ERR_FORMAT;
+                break;
+            }
+            uint32_t crc = crc32_update(0, record, block_size);
+            if (crc!=load32_le(record+block_size))
+            {
+                result = CT_ERR_CORRUPT;
+                break;
+            }
+            memcpy(buf+i*block_size, record, block_size);
+        }
+        if (result!=CT_OK)
+            break;
+        rsa_transform_batch(ctx, buf, buf, blocks);
+        for (size_t i = 0; i<blocks && pos<end; i++)
+        {
+            // XXX: valid for little endian only!
+            uint64_t block_start = (block+i)*msg_size;
+            size_t skip = (size_t)(pos-block_start);
+            size_t chunk = (size_t)min(msg_size-skip, end-pos);
+            if (fwrite(buf+i*block_size+skip, 1, chunk, dst)!=chunk)
+            {
+                result = CT_ERR_IO;
+                break;
+            }
+            pos += chunk;
+        }
+        block += blocks;
+    }
+    free(buf);
+    return result;
+}
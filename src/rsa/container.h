@@ -0,0 +1,63 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+#include "bigint.h"
+#include "rsa.h"
+#include <stdio.h>
+
+// Seekable block container. All integers are little endian.
+//
+// offset  size  field
+// 0       4     magic "RSAC"
+// 4       1     format version (CT_VERSION)
+// 5       3     reserved, zero
+// 8       8     plaintext length in bytes
+// 16      4     plaintext bytes per block
+// 20      4     ciphertext bytes per block
+// 24      8     key fingerprint (FNV-1a of the modulus limbs)
+// 32      ...   block records
+//
+// Blocks have a fixed size, so the block index is positional: record i
+// starts at CT_HEADER_SIZE+i*(ciphertext block size+4) and holds the
+// ciphertext followed by its CRC-32. Any byte range can be decrypted by
+// reading only the records that cover it, and an interrupted run resumes
+// after the last record whose checksum is intact.
+
+#define CT_VERSION 1
+#define CT_HEADER_SIZE 32
+#define CT_RECORD_EXTRA 4
+#define CT_TO_END UINT64_MAX
+
+enum
+{
+    CT_OK = 0,
+    CT_ERR_IO = -1,
+    CT_ERR_FORMAT = -2,
+    CT_ERR_KEY = -3,
+    CT_ERR_CORRUPT = -4,
+    CT_ERR_RANGE = -5,
+    CT_ERR_ENTROPY = -6
+};
+
+typedef struct
+{
+    uint64_t plain_size;
+    uint32_t src_block_size;
+    uint32_t dst_block_size;
+    uint64_t fingerprint;
+} ct_header_t;
+
+uint64_t ct_fingerprint(bigint_t *n);
+int ct_read_header(FILE *f, ct_header_t *header);
+
+// Encrypt all of 'src' into a container. With 'resume' set, 'dst' must be
+// opened for update and may hold a partial container of the same source
+// and key, which is continued from its last intact record; if it is
+// shorter than a header it is started afresh.
+int ct_encrypt(rsa_ctx_t *ctx, bigint_t *n, FILE *src, FILE *dst,
+    int resume);
+// Decrypt 'size' plaintext bytes starting at 'offset' (CT_TO_END for the
+// rest of the payload). With 'resume' set, whatever 'dst' already holds
+// is taken as the beginning of the requested range.
+int ct_decrypt(rsa_ctx_t *ctx, bigint_t *n, FILE *src, FILE *dst,
+    uint64_t offset, uint64_t size, int resume);
@@ -0,0 +1,81 @@
+#include "config.h"
+#include "cpu.h"
+#include "thread.h"
+#include <stdlib.h>
+
+#if CPU_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+static void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t regs[4])
+{
+#ifdef _MSC_VER
+    __cpuidex((int *)regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+// XCR0: register state the OS saves on context switch
+static uint64_t xgetbv0()
+{
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return lo | (uint64_t)hi<<32;
+#endif
+}
+
+static unsigned cpu_detect()
+{
+    uint32_t regs[4];
+    unsigned features = 0;
+    cpuid(0, 0, regs);
+    if (regs[0]<7)
+        return 0;
+    cpuid(7, 0, regs);
+    uint32_t ebx7 = regs[1];
+    if (ebx7 & 1<<8)
+        features |= CPU_BMI2;
+    if (ebx7 & 1<<19)
+        features |= CPU_ADX;
+    cpuid(1, 0, regs);
+    // OSXSAVE and AVX
+    if ((regs[2] & 3<<27)!=3<<27)
+        return features;
+    uint64_t xcr0 = xgetbv0();
+    // XMM and YMM state
+    if ((xcr0 & 0x6)==0x6 && ebx7 & 1<<5)
+        features |= CPU_AVX2;
+    // XMM, YMM, opmask and ZMM state
+    if ((xcr0 & 0xe6)==0xe6 && ebx7 & 1<<16)
+        features |= CPU_AVX512F;
+    return features;
+}
+#else
+static unsigned cpu_detect()
+{ return 0; }
+#endif
+
+unsigned cpu_features()
+{
+    static unsigned *volatile features = NULL;
+    unsigned *detected = features;
+    if (detected)
+        return *detected;
+    detected = malloc(sizeof(unsigned));
+    *detected = cpu_detect();
+    // a racing initializer got there first
+    if (!atomic_cas_ptr((void *volatile *)&features, NULL, detected))
+    {
+        free(detected);
+        detected = features;
+    }
+    return *detected;
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || \
+    defined(_M_IX86)
+#define CPU_X86 1
+#else
+#define CPU_X86 0
+#endif
+
+// Enables instruction set extensions for a single function, so optional
+// kernels can live next to portable code built for the baseline target.
+#if defined(__GNUC__) || defined(__clang__)
+#define CPU_TARGET(features) __attribute__((target(features)))
+#else
+#define CPU_TARGET(features)
+#endif
+
+enum
+{
+    CPU_AVX2 = 1<<0,
+    CPU_AVX512F = 1<<1,
+    CPU_BMI2 = 1<<2,
+    CPU_ADX = 1<<3
+};
+
+// returns a mask of CPU_* features supported by both the CPU and the OS
+unsigned cpu_features();
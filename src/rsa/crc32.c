@@ -0,0 +1,28 @@
+#include "config.h"
+#include "crc32.h"
+
+static uint32_t crc32_table[256];
+static volatile int crc32_table_ready = 0;
+
+static void crc32_init_table()
+{
+    for (uint32_t i = 0; i<256; i++)
+    {
+        uint32_t c = i;
+        for (int k = 0; k<8; k++)
+            c = c & 1 ? 0xedb88320^(c>>1) : c>>1;
+        crc32_table[i] = c;
+    }
+    crc32_table_ready = 1;
+}
+
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size)
+{
+    // racing initializers store the same values
+    if (!crc32_table_ready)
+        crc32_init_table();
+    crc = ~crc;
+    for (size_t i = 0; i<size; i++)
+        crc = crc32_table[(crc^data[i]) & 0xff]^(crc>>8);
+    return ~crc;
+}
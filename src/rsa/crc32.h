@@ -0,0 +1,7 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+// CRC-32 (IEEE 802.3). Pass 0 as 'crc' to start a new checksum, or a
+// previous result to continue it over more data.
+uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size);
@@ -1,27 +1,30 @@
 #include "config.h"
 #include "dumb_padding.h"
-#include <limits.h>
 #include <stdlib.h>
 
-int dp_pad(uint8_t *block, size_t block_size, size_t filled, size_t *param)
+// the length word is little-endian, with the compressed flag in bit 63
+#define DP_LEN_SIZE 8
+#define DP_LEN_COMPRESSED ((uint64_t)1<<63)
+
+int dp_pad(rnd_t *rnd, uint8_t *block, size_t block_size, size_t filled,
+    size_t *param)
 {
-    if (block_size<sizeof(uint32_t) || block_size>UINT_MAX)
+    if (block_size<DP_LEN_SIZE || block_size>DP_MAX_BLOCK_SIZE)
         return DP_ERR;
     if (!filled) // fill empty block
     {
         // ... with random data
-        for (size_t i = filled; i<block_size-sizeof(uint32_t); i++)
-            block[i] = (uint8_t)(rand()%255);
-        // XXX: respect endianness
+        rnd_bytes(rnd, block, block_size-DP_LEN_SIZE);
         // ... followed by length
-        uint32_t *len = block+block_size-sizeof(uint32_t);
-        *len = (uint32_t)(*param+block_size);
+        uint64_t len = (*param&~DP_COMPRESSED)+block_size;
+        if (*param&DP_COMPRESSED)
+            len |= DP_LEN_COMPRESSED;
+        store64_le(block+block_size-DP_LEN_SIZE, len);
         return DP_OK;
     }
     else
     {
-        for (size_t i = filled; i<block_size; i++)
-            block[i] = (uint8_t)(rand()%255);
+        rnd_bytes(rnd, block+filled, block_size-filled);
         *param = block_size-filled;
         return DP_MORE;
     }
@@ -29,12 +32,22 @@ int dp_pad(uint8_t *block, size_t block_size, size_t filled, size_t *param)
 
 int dp_depad(const uint8_t *block, size_t block_size, size_t *pad_size)
 {
-    const uint32_t *len = block+block_size-sizeof(uint32_t);
-    size_t sz = *len;
-    if (sz>=block_size)
+    if (block_size<DP_LEN_SIZE)
+        return DP_ERR;
+    uint64_t len = load64_le(block+block_size-DP_LEN_SIZE);
+    // Older files end in a native (in practice little-endian) 32-bit
+    // word of the same meaning, flag in bit 31. Its length is never 0,
+    // while the high half of a 64-bit word holds nothing but the flag.
+    uint32_t old = (uint32_t)(len>>32);
+    int compressed = (len&DP_LEN_COMPRESSED)!=0;
+    len &= ~DP_LEN_COMPRESSED;
+    if (old&0x7fffffff)
     {
-        *pad_size = sz;
-        return DP_OK;
+        compressed = (old&0x80000000)!=0;
+        len = old&0x7fffffff;
     }
-    return DP_ERR;
+    if (len<block_size || len>2*(uint64_t)block_size)
+        return DP_ERR;
+    *pad_size = (size_t)len|(compressed ? DP_COMPRESSED : 0);
+    return DP_OK;
 }
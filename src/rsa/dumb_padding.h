@@ -1,6 +1,7 @@
 #pragma once
 #include "config.h"
 #include "common.h"
+#include "rnd.h"
 
 enum
 {
@@ -9,5 +10,17 @@ enum
     DP_ERR = -1
 };
 
-int dp_pad(uint8_t *block, size_t block_size, size_t filled, size_t *param);
+// The last block ends in a 64-bit little-endian word holding the number
+// of padding bytes, at most two blocks' worth; dp_depad() still reads the
+// 32-bit word of older files. Blocks are limited so the length always
+// fits in 31 bits, which keeps the two formats apart.
+#define DP_MAX_BLOCK_SIZE ((size_t)1<<30)
+
+// Flag stored in the length word along with the padding size: the
+// plaintext is compressed. Set it in '*param' for the call that fills an
+// empty block; dp_depad() returns it as part of '*pad_size'.
+#define DP_COMPRESSED ((size_t)1<<31)
+
+int dp_pad(rnd_t *rnd, uint8_t *block, size_t block_size, size_t filled,
+    size_t *param);
 int dp_depad(const uint8_t *block, size_t block_size, size_t *pad_size);
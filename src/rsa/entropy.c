@@ -0,0 +1,35 @@
+#include "config.h"
+#ifdef _WIN32
+#define _CRT_RAND_S
+#endif
+#include "entropy.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+int entropy_read(uint8_t *buf, size_t size)
+{
+    while (size)
+    {
+        unsigned int r;
+        if (rand_s(&r))
+            return 1;
+        size_t n = min(size, sizeof(r));
+        memcpy(buf, &r, n);
+        buf += n;
+        size -= n;
+    }
+    return 0;
+}
+#else
+int entropy_read(uint8_t *buf, size_t size)
+{
+    FILE *f = fopen("/dev/urandom", "rb");
+    if (!f)
+        return 1;
+    size_t bytes_read = fread(buf, 1, size, f);
+    fclose(f);
+    return bytes_read!=size;
+}
+#endif
@@ -0,0 +1,7 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+// Fill 'buf' with 'size' bytes from the operating system CSPRNG.
+// returns nonzero on failure
+int entropy_read(uint8_t *buf, size_t size);
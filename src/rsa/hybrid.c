@@ -0,0 +1,174 @@
+#include "config.h"
+#include "hybrid.h"
+#include "rsa.h"
+#include "rsa_util.h"
+#include "chacha20.h"
+#include "sha256.h"
+#include "entropy.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define HY_CHUNK_SIZE (1<<20)
+
+static const uint8_t hy_magic[4] = {'R', 'S', 'A', 'H'};
+
+// One-off transform of the session block in place.
+static int hy_transform(const rsa_key_t *key, uint8_t *block)
+{
+    rsa_ctx_t ctx;
+    if (rsa_ctx_init_key(&ctx, key))
+        return HY_ERR_KEY;
+    rsa_transform_ctx(&ctx, block, block);
+    rsa_ctx_free(&ctx);
+    return HY_OK;
+}
+
+// Payload cipher and MAC for a session block.
+static void hy_session(const uint8_t *block, chacha20_t *cipher,
+    hmac_sha256_t *mac)
+{
+    uint8_t mac_key[CHACHA20_BLOCK_SIZE] = {0};
+    chacha20_init(cipher, block, block+CHACHA20_KEY_SIZE, 0);
+    chacha20_xor(cipher, mac_key, mac_key, sizeof(mac_key));
+    hmac_sha256_init(mac, mac_key, HY_MAC_SIZE);
+    memset(mac_key, 0, sizeof(mac_key));
+}
+
+// Encrypt or decrypt the rest of 'src' into 'dst' with the session key,
+// MACing the ciphertext. Decrypting, pass 'tag': the last HY_MAC_SIZE
+// bytes of 'src' are held back and stored there.
+static int hy_stream(chacha20_t *cipher, hmac_sha256_t *mac, FILE *src,
+    FILE *dst, uint8_t *tag)
+{
+    uint8_t *buf = malloc(HY_MAC_SIZE+HY_CHUNK_SIZE);
+    size_t held = 0; // bytes at the start of 'buf' that may be the tag
+    int result = HY_OK;
+    while (1)
+    {
+        size_t bytes_read = fread(buf+held, 1, HY_CHUNK_SIZE, src);
+        if (!bytes_read)
+            break;
+        size_t size = held+bytes_read;
+        held = tag ? min(size, HY_MAC_SIZE) : 0;
+        size -= held;
+        if (tag)
+            hmac_sha256_update(mac, buf, size);
+        chacha20_xor(cipher, buf, buf, size);
+        if (!tag)
+            hmac_sha256_update(mac, buf, size);
+        if (fwrite(buf, 1, size, dst)!=size)
+        {
+            result = HY_ERR_IO;
+            break;
+        }
+        memmove(buf, buf+size, held);
+    }
+    if (ferror(src))
+        result = HY_ERR_IO;
+    else if (result==HY_OK && tag && held!=HY_MAC_SIZE)
+        result = HY_ERR_FORMAT;
+    if (result==HY_OK && tag)
+        memcpy(tag, buf, HY_MAC_SIZE);
+    free(buf);
+    return result;
+}
+
+int hy_encrypt(FILE *src, FILE *dst, const rsa_key_t *key)
+{
+    size_t msg_size, block_size;
+    rsa_get_block_sizes('e', key->n, &msg_size, &block_size);
+    if (msg_size<CHACHA20_KEY_SIZE+CHACHA20_NONCE_SIZE)
+        return HY_ERR_KEY;
+    uint8_t header[HY_HEADER_SIZE] = {0};
+    memcpy(header, hy_magic, sizeof(hy_magic));
+    header[4] = HY_VERSION;
+    header[5] = HY_CIPHER_CHACHA20;
+    store32_le(header+8, (uint32_t)block_size);
+    // session block: key, nonce, random filler up to the message size
+    uint8_t *block = calloc(block_size, 1);
+    if (entropy_read(block, msg_size))
+    {
+        free(block);
+        return HY_ERR_ENTROPY;
+    }
+    chacha20_t cipher;
+    hmac_sha256_t mac;
+    hy_session(block, &cipher, &mac);
+    int result = hy_transform(key, block);
+    if (result==HY_OK && (fwrite(header, 1, HY_HEADER_SIZE, dst)!=HY_HEADER_SIZE ||
+        fwrite(block, 1, block_size, dst)!=block_size))
+    {
+        result = HY_ERR_IO;
+    }
+    hmac_sha256_update(&mac, header, HY_HEADER_SIZE);
+    hmac_sha256_update(&mac, block, block_size);
+    free(block);
+    if (result==HY_OK)
+        result = hy_stream(&cipher, &mac, src, dst, NULL);
+    uint8_t tag[HY_MAC_SIZE];
+    hmac_sha256_final(&mac, tag);
+    if (result==HY_OK && fwrite(tag, 1, HY_MAC_SIZE, dst)!=HY_MAC_SIZE)
+        result = HY_ERR_IO;
+    memset(&cipher, 0, sizeof(cipher));
+    return result;
+}
+
+int hy_decrypt(FILE *src, FILE *dst, const rsa_key_t *key)
+{
+    size_t block_size, msg_size;
+    rsa_get_block_sizes('d', key->n, &block_size, &msg_size);
+    uint8_t header[HY_HEADER_SIZE];
+    if (fread(header, 1, HY_HEADER_SIZE, src)!=HY_HEADER_SIZE ||
+        memcmp(header, hy_magic, sizeof(hy_magic)))
+    {
+        return HY_ERR_FORMAT;
+    }
+    if (header[4]!=HY_VERSION || header[5]!=HY_CIPHER_CHACHA20)
+        return HY_ERR_FORMAT;
+    if (load32_le(header+8)!=block_size)
+        return HY_ERR_KEY;
+    // the wrapped block, then the session block it decrypts to
+    uint8_t *wrapped = malloc(2*block_size);
+    uint8_t *block = wrapped+block_size;
+    if (fread(wrapped, 1, block_size, src)!=block_size)
+    {
+        free(wrapped);
+        return HY_ERR_FORMAT;
+    }
+    memcpy(block, wrapped, block_size);
+    if (hy_transform(key, block))
+    {
+        free(wrapped);
+        return HY_ERR_KEY;
+    }
+    // bytes above the message size are zero unless the key is wrong
+    for (size_t i = msg_size; i<block_size; i++)
+    {
+        if (block[i])
+        {
+            free(wrapped);
+            return HY_ERR_KEY;
+        }
+    }
+    chacha20_t cipher;
+    hmac_sha256_t mac;
+    hy_session(block, &cipher, &mac);
+    hmac_sha256_update(&mac, header, HY_HEADER_SIZE);
+    hmac_sha256_update(&mac, wrapped, block_size);
+    memset(block, 0, block_size);
+    free(wrapped);
+    uint8_t tag[HY_MAC_SIZE], expected[HY_MAC_SIZE];
+    int result = hy_stream(&cipher, &mac, src, dst, tag);
+    hmac_sha256_final(&mac, expected);
+    if (result==HY_OK)
+    {
+        // constant time, a mismatch doesn't tell where
+        uint8_t diff = 0;
+        for (size_t i = 0; i<HY_MAC_SIZE; i++)
+            diff |= tag[i]^expected[i];
+        if (diff)
+            result = HY_ERR_AUTH;
+    }
+    memset(&cipher, 0, sizeof(cipher));
+    return result;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+#include "rsa.h"
+#include <stdio.h>
+
+// Hybrid container: a random ChaCha20 session key wrapped in a single RSA
+// block, followed by the payload encrypted with that key and a MAC.
+//
+// offset  size  field
+// 0       4     magic "RSAH"
+// 4       1     format version (HY_VERSION)
+// 5       1     cipher (HY_CIPHER_CHACHA20)
+// 6       2     reserved, zero
+// 8       4     wrapped key block size in bytes (little endian)
+// 12      N     RSA-encrypted session block: key, nonce, random filler
+// 12+N    L     payload ciphertext, same length as the plaintext
+// 12+N+L  32    HMAC-SHA-256 of everything before it
+//
+// The first keystream block of the session key is the MAC key and the
+// payload is encrypted from the second one on.
+
+#define HY_VERSION 2
+#define HY_CIPHER_CHACHA20 1
+#define HY_HEADER_SIZE 12
+#define HY_MAC_SIZE 32
+
+enum
+{
+    HY_OK = 0,
+    HY_ERR_IO = -1,
+    HY_ERR_FORMAT = -2,
+    HY_ERR_KEY = -3,
+    HY_ERR_ENTROPY = -4,
+    HY_ERR_AUTH = -5 // payload or header modified
+};
+
+int hy_encrypt(FILE *src, FILE *dst, const rsa_key_t *key);
+// Plaintext is written as it is decrypted and only checked at the end:
+// on any error 'dst' holds unauthenticated data and must be discarded.
+int hy_decrypt(FILE *src, FILE *dst, const rsa_key_t *key);
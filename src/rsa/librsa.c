@@ -0,0 +1,269 @@
+#include "config.h"
+#include "librsa.h"
+#include "rsa.h"
+#include "rsa_util.h"
+#include "dumb_padding.h"
+#include "thread.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Per-thread working state: the transform context owns scratch buffers
+// and the generator feeds padding, so neither can be shared. Idle ones
+// are kept on the key for reuse.
+typedef struct librsa_slot
+{
+    rsa_ctx_t ctx;
+    rnd_t rnd;
+    struct librsa_slot *next;
+} librsa_slot_t;
+
+struct librsa_key
+{
+    rsa_key_t rsa;
+    size_t src_block_size; // plaintext bytes per block
+    size_t dst_block_size; // ciphertext bytes per block
+    mutex_t lock;
+    librsa_slot_t *idle;
+};
+
+// the checks rsa_ctx_init_key() would fail on, without its setup cost
+static int key_usable(const rsa_key_t *rsa)
+{
+    if (bigint_iszero(rsa->n) || !(rsa->n->data[0] & 1) ||
+        rsa->prime_count==1 || rsa->prime_count>RSA_MAX_PRIMES)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i<rsa->prime_count; i++)
+    {
+        if (bigint_iszero(rsa->primes[i]) || !(rsa->primes[i]->data[0] & 1))
+            return 0;
+    }
+    return 1;
+}
+
+// takes over 'rsa' on success
+static librsa_key_t *key_create(rsa_key_t *rsa)
+{
+    if (!key_usable(rsa))
+        return NULL;
+    librsa_key_t *key = malloc(sizeof(librsa_key_t));
+    key->rsa = *rsa;
+    rsa_get_block_sizes('e', rsa->n, &key->src_block_size,
+        &key->dst_block_size);
+    mutex_init(&key->lock);
+    key->idle = NULL;
+    return key;
+}
+
+static librsa_slot_t *slot_acquire(librsa_key_t *key)
+{
+    mutex_lock(&key->lock);
+    librsa_slot_t *slot = key->idle;
+    if (slot)
+        key->idle = slot->next;
+    mutex_unlock(&key->lock);
+    if (slot)
+        return slot;
+    slot = malloc(sizeof(librsa_slot_t));
+    if (rnd_init(&slot->rnd))
+    {
+        free(slot);
+        return NULL;
+    }
+    if (rsa_ctx_init_key(&slot->ctx, &key->rsa))
+    {
+        memset(slot, 0, sizeof(librsa_slot_t));
+        free(slot);
+        return NULL;
+    }
+    return slot;
+}
+
+static void slot_release(librsa_key_t *key, librsa_slot_t *slot)
+{
+    mutex_lock(&key->lock);
+    slot->next = key->idle;
+    key->idle = slot;
+    mutex_unlock(&key->lock);
+}
+
+int librsa_key_load(const uint8_t *data, size_t size, librsa_key_t **key)
+{
+    rsa_key_t rsa;
+    *key = NULL;
+    if (!rsa_key_parse(data, size, &rsa))
+    {
+        *key = key_create(&rsa);
+        if (!*key)
+            rsa_key_free(&rsa);
+    }
+    return *key ? LIBRSA_OK : LIBRSA_ERR_KEY;
+}
+
+int librsa_key_save(const librsa_key_t *key, uint8_t *buf, size_t *size)
+{
+    size_t key_size = rsa_key_serialize(&key->rsa, NULL);
+    if (buf)
+    {
+        if (*size<key_size)
+            return LIBRSA_ERR_ARG;
+        rsa_key_serialize(&key->rsa, buf);
+    }
+    *size = key_size;
+    return LIBRSA_OK;
+}
+
+void librsa_key_free(librsa_key_t *key)
+{
+    if (!key)
+        return;
+    while (key->idle)
+    {
+        librsa_slot_t *slot = key->idle;
+        key->idle = slot->next;
+        rsa_ctx_free(&slot->ctx);
+        memset(slot, 0, sizeof(librsa_slot_t));
+        free(slot);
+    }
+    mutex_destroy(&key->lock);
+    rsa_key_free(&key->rsa);
+    free(key);
+}
+
+size_t librsa_key_bits(const librsa_key_t *key)
+{ return key->dst_block_size*8; }
+
+int librsa_keygen(size_t bits, librsa_key_t **public_key,
+    librsa_key_t **private_key)
+{
+    *public_key = NULL;
+    *private_key = NULL;
+    if (bits<LIBRSA_MIN_BITS || bits>LIBRSA_MAX_BITS || bits%32)
+        return LIBRSA_ERR_ARG;
+    rnd_t rnd;
+    if (rnd_init(&rnd))
+        return LIBRSA_ERR_ENTROPY;
+    rsa_key_t pub, priv;
+    rsa_generate_key(&rnd, bits, 2, &pub, &priv);
+    memset(&rnd, 0, sizeof(rnd));
+    *public_key = key_create(&pub);
+    if (!*public_key)
+    {
+        rsa_key_free(&pub);
+        rsa_key_free(&priv);
+        return LIBRSA_ERR_KEY;
+    }
+    *private_key = key_create(&priv);
+    if (!*private_key)
+    {
+        librsa_key_free(*public_key);
+        *public_key = NULL;
+        rsa_key_free(&priv);
+        return LIBRSA_ERR_KEY;
+    }
+    return LIBRSA_OK;
+}
+
+size_t librsa_encrypt_size(const librsa_key_t *key, size_t src_size)
+{
+    // full blocks, then one or two blocks carrying the padding
+    size_t blocks = src_size/key->src_block_size;
+    blocks += src_size%key->src_block_size ? 2 : 1;
+    return blocks*key->dst_block_size;
+}
+
+size_t librsa_decrypt_size(const librsa_key_t *key, size_t src_size)
+{ return src_size/key->dst_block_size*key->src_block_size; }
+
+int librsa_encrypt(librsa_key_t *key, const uint8_t *src, size_t src_size,
+    uint8_t *dst, size_t *dst_size)
+{
+    size_t msg_size = key->src_block_size;
+    size_t block_size = key->dst_block_size;
+    size_t out_size = librsa_encrypt_size(key, src_size);
+    if (*dst_size<out_size)
+        return LIBRSA_ERR_ARG;
+    librsa_slot_t *slot = slot_acquire(key);
+    if (!slot)
+        return LIBRSA_ERR_ENTROPY;
+    // lay out full blocks in place, then transform them in batches
+    size_t full_blocks = src_size/msg_size;
+    for (size_t i = 0; i<full_blocks; i++)
+    {
+        uint8_t *block = dst+i*block_size;
+        memcpy(block, src+i*msg_size, msg_size);
+        memset(block+msg_size, 0, block_size-msg_size);
+    }
+    rsa_transform_batch(&slot->ctx, dst, dst, full_blocks);
+    uint8_t *block = dst+full_blocks*block_size;
+    size_t filled = src_size-full_blocks*msg_size;
+    size_t param = 0;
+    memset(block, 0, block_size);
+    memcpy(block, src+full_blocks*msg_size, filled);
+    if (dp_pad(&slot->rnd, block, msg_size, filled, &param)==DP_MORE)
+    {
+        rsa_transform_ctx(&slot->ctx, block, block);
+        block += block_size;
+        memset(block, 0, block_size);
+        dp_pad(&slot->rnd, block, msg_size, 0, &param);
+    }
+    rsa_transform_ctx(&slot->ctx, block, block);
+    slot_release(key, slot);
+    *dst_size = out_size;
+    return LIBRSA_OK;
+}
+
+int librsa_decrypt(librsa_key_t *key, const uint8_t *src, size_t src_size,
+    uint8_t *dst, size_t *dst_size)
+{
+    size_t msg_size = key->src_block_size;
+    size_t block_size = key->dst_block_size;
+    if (!src_size || src_size%block_size)
+        return LIBRSA_ERR_PADDING;
+    size_t blocks = src_size/block_size;
+    size_t plain_size = blocks*msg_size;
+    if (*dst_size<plain_size)
+        return LIBRSA_ERR_ARG;
+    librsa_slot_t *slot = slot_acquire(key);
+    if (!slot)
+        return LIBRSA_ERR_ENTROPY;
+    // the last block carries the padding length, transform it first
+    uint8_t *last = malloc(block_size);
+    rsa_transform_ctx(&slot->ctx, src+(blocks-1)*block_size, last);
+    size_t padding = 0;
+    int result = LIBRSA_OK;
+    if (dp_depad(last, msg_size, &padding)!=DP_OK)
+        result = LIBRSA_ERR_PADDING;
+    // the chunk stream of 'rsa --compress encrypt' is left to the tool
+    else if (padding&DP_COMPRESSED)
+        result = LIBRSA_ERR_COMPRESSED;
+    else if (padding>plain_size)
+        result = LIBRSA_ERR_PADDING;
+    if (result==LIBRSA_OK)
+    {
+        // transform the other blocks through a bounded batch buffer
+        size_t batch = slot->ctx.mb->lanes;
+        uint8_t *buf = malloc(batch*block_size);
+        size_t out_size = plain_size-padding;
+        size_t written = 0;
+        for (size_t i = 0; i<blocks-1 && written<out_size; i += batch)
+        {
+            size_t count = min(batch, blocks-1-i);
+            rsa_transform_batch(&slot->ctx, src+i*block_size, buf, count);
+            for (size_t j = 0; j<count && written<out_size; j++)
+            {
+                size_t chunk = min(msg_size, out_size-written);
+                memcpy(dst+written, buf+j*block_size, chunk);
+                written += chunk;
+            }
+        }
+        if (written<out_size)
+            memcpy(dst+written, last, out_size-written);
+        free(buf);
+        *dst_size = out_size;
+    }
+    free(last);
+    slot_release(key, slot);
+    return result;
+}
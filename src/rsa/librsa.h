@@ -0,0 +1,48 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Embeddable in-memory API. All state lives in the objects below, so
+// independent calls may run concurrently; a single librsa_key_t may be
+// shared between threads. Buffers use the same formats as the command
+// line tool: key files as written by 'rsa keygen' and ciphertext as
+// written by 'rsa encrypt' without --compress.
+
+enum
+{
+    LIBRSA_OK = 0,
+    LIBRSA_ERR_ARG = -1, // bad argument or output buffer too small
+    LIBRSA_ERR_KEY = -2, // malformed key
+    LIBRSA_ERR_PADDING = -3, // corrupted ciphertext or wrong key
+    LIBRSA_ERR_ENTROPY = -4, // operating system CSPRNG unavailable
+    LIBRSA_ERR_COMPRESSED = -5 // ciphertext of compressed plaintext
+};
+
+typedef struct librsa_key librsa_key_t;
+
+// Load a public or private key from a key file image.
+int librsa_key_load(const uint8_t *data, size_t size, librsa_key_t **key);
+// Write the key file image to 'buf' (may be NULL to query the size).
+// '*size' holds the buffer capacity on input and the image size on output.
+int librsa_key_save(const librsa_key_t *key, uint8_t *buf, size_t *size);
+void librsa_key_free(librsa_key_t *key);
+// modulus size in bits
+size_t librsa_key_bits(const librsa_key_t *key);
+
+#define LIBRSA_MIN_BITS 512
+#define LIBRSA_MAX_BITS 16384
+
+// 'bits' must be a multiple of 32 from LIBRSA_MIN_BITS to LIBRSA_MAX_BITS.
+// both keys are left NULL on failure
+int librsa_keygen(size_t bits, librsa_key_t **public_key,
+    librsa_key_t **private_key);
+
+// upper bounds for the output buffers of librsa_encrypt/librsa_decrypt
+size_t librsa_encrypt_size(const librsa_key_t *key, size_t src_size);
+size_t librsa_decrypt_size(const librsa_key_t *key, size_t src_size);
+// '*dst_size' holds the capacity of 'dst' on input and the number of
+// bytes written on output. 'src' and 'dst' must not overlap.
+int librsa_encrypt(librsa_key_t *key, const uint8_t *src, size_t src_size,
+    uint8_t *dst, size_t *dst_size);
+int librsa_decrypt(librsa_key_t *key, const uint8_t *src, size_t src_size,
+    uint8_t *dst, size_t *dst_size);
@@ -0,0 +1,136 @@
+#include "config.h"
+#include "lz.h"
+#include <string.h>
+
+#define LZ_HASH_BITS 14
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+
+static uint32_t load32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static size_t lz_hash(uint32_t v)
+{ return (v*2654435761u)>>(32-LZ_HASH_BITS); }
+
+// the part of a count above the 15 its nibble holds
+static uint8_t *put_count(uint8_t *op, size_t count)
+{
+    for (; count>=255; count -= 255)
+        *op++ = 255;
+    *op++ = (uint8_t)count;
+    return op;
+}
+
+static int get_count(const uint8_t **ip, const uint8_t *end, size_t *count)
+{
+    uint8_t b;
+    do
+    {
+        if (*ip==end)
+            return 1;
+        b = *(*ip)++;
+        *count += b;
+    } while (b==255);
+    return 0;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *literals,
+    size_t lit, size_t offset, size_t len)
+{
+    uint8_t *token = op++;
+    *token = (uint8_t)(min(lit, 15)<<4);
+    if (lit>=15)
+        op = put_count(op, lit-15);
+    memcpy(op, literals, lit);
+    op += lit;
+    if (!len)
+        return op;
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset>>8);
+    len -= LZ_MIN_MATCH;
+    *token |= (uint8_t)min(len, 15);
+    if (len>=15)
+        op = put_count(op, len-15);
+    return op;
+}
+
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst)
+{
+    // positions of the last 4-byte strings seen; stale entries are
+    // harmless since every candidate is compared
+    uint32_t table[1<<LZ_HASH_BITS];
+    memset(table, 0, sizeof(table));
+    const uint8_t *ip = src, *anchor = src, *end = src+size;
+    const uint8_t *limit = size>LZ_MIN_MATCH ? end-LZ_MIN_MATCH : src;
+    uint8_t *op = dst;
+    while (ip<limit)
+    {
+        uint32_t v = load32(ip);
+        size_t h = lz_hash(v);
+        const uint8_t *ref = src+table[h];
+        table[h] = (uint32_t)(ip-src);
+        if (ref>=ip || ip-ref>LZ_MAX_OFFSET || load32(ref)!=v)
+        {
+            // step faster through data that doesn't match
+            ip += 1+((ip-anchor)>>6);
+            continue;
+        }
+        size_t len = LZ_MIN_MATCH;
+        while (ip+len<end && ref[len]==ip[len])
+            len++;
+        op = put_sequence(op, anchor, ip-anchor, ip-ref, len);
+        ip += len;
+        anchor = ip;
+    }
+    return put_sequence(op, anchor, end-anchor, 0, 0)-dst;
+}
+
+int lz_decompress(const uint8_t *src, size_t size, uint8_t *dst,
+    size_t capacity, size_t *dst_size)
+{
+    const uint8_t *ip = src, *end = src+size;
+    uint8_t *op = dst, *op_end = dst+capacity;
+    while (ip<end)
+    {
+        uint8_t token = *ip++;
+        size_t lit = token>>4;
+        if (lit==15 && get_count(&ip, end, &lit))
+            return LZ_ERR_DATA;
+        if (lit>(size_t)(end-ip) || lit>(size_t)(op_end-op))
+            return LZ_ERR_DATA;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip==end)
+            break;
+        if (end-ip<2)
+            return LZ_ERR_DATA;
+        size_t offset = ip[0] | ip[1]<<8;
+        ip += 2;
+        size_t len = token&15;
+        if (len==15 && get_count(&ip, end, &len))
+            return LZ_ERR_DATA;
+        len += LZ_MIN_MATCH;
+        if (!offset || offset>(size_t)(op-dst) ||
+            len>(size_t)(op_end-op))
+        {
+            return LZ_ERR_DATA;
+        }
+        const uint8_t *ref = op-offset;
+        if (offset>=len)
+            memcpy(op, ref, len);
+        else
+        {
+            // overlapping: the match repeats its last 'offset' bytes
+            for (size_t i = 0; i<len; i++)
+                op[i] = ref[i];
+        }
+        op += len;
+    }
+    *dst_size = op-dst;
+    return LZ_OK;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+// Byte-oriented LZ77 block codec in the style of LZ4: a sequence is a
+// token byte with the literal count in the high nibble and the match
+// length minus 4 in the low one, longer counts continued in extra bytes
+// of 255, then the literals, then a 2-byte little-endian match offset.
+// The last sequence of a block has literals only. It favours speed over
+// ratio, so it can run in front of every RSA block.
+
+enum
+{
+    LZ_OK = 0,
+    LZ_ERR_DATA = -1 // malformed input or output buffer too small
+};
+
+// largest compressed size of a 'size'-byte block
+#define LZ_BOUND(size) ((size)+(size)/255+16)
+
+// Compress a block into 'dst', which must hold LZ_BOUND(size) bytes.
+// returns the compressed size
+size_t lz_compress(const uint8_t *src, size_t size, uint8_t *dst);
+// Decompress a block into at most 'capacity' bytes of 'dst'.
+int lz_decompress(const uint8_t *src, size_t size, uint8_t *dst,
+    size_t capacity, size_t *dst_size);
@@ -3,45 +3,200 @@
 #include "rsa.h"
 #include "dumb_padding.h"
 #include "rsa_util.h"
+#include "hybrid.h"
+#include "container.h"
+#include "rsad.h"
+#include "librsa.h"
+#include "batch.h"
+#include "audit.h"
+#include "tuner.h"
+#include "sign.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <assert.h>
 #ifndef _WIN32
 #include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
 #else
 #include <io.h>
+#include <windows.h>
+#include <psapi.h>
 #endif
 
 static void print_usage()
 {
-    const char *usage_str = "usage: rsa {keygen|encrypt|decrypt} <args>\n"
+    const char *usage_str =
+        "usage: rsa [options] {keygen|encrypt|decrypt|hencrypt|hdecrypt|\n"
+        "           cencrypt|cdecrypt|bencrypt|bdecrypt|sign|verify|\n"
+        "           bverify|audit|daemon|bench|tune}\n"
+        "           <args>\n"
         "args:\n"
-        "  keygen:          <key size> <public key file> <private key file>\n"
-        "  encrypt/decrypt: <key file> <source file> <destination file>";
+        "  keygen:            <key size> <public key file> <private key file>\n"
+        "  encrypt/decrypt:   <key file> <source file> <destination file>\n"
+        "  hencrypt/hdecrypt: <key file> <source file> <destination file>\n"
+        "                     (hybrid: RSA-wrapped ChaCha20 session key)\n"
+        "  cencrypt/cdecrypt: <key file> <source file> <destination file>\n"
+        "                     (seekable container)\n"
+        "  bencrypt/bdecrypt: <key file> <source> <destination dir>\n"
+        "                     (many files; the source is a directory, a list\n"
+        "                     file or - for a list on stdin)\n"
+        "  sign:              <private key file> <file> <signature file>\n"
+        "  verify:            <public key file> <file> <signature file>\n"
+        "                     (RSASSA-PKCS1-v1_5 with SHA-256)\n"
+        "  bverify:           <public key file> <source>\n"
+        "                     (checks every file against <file>.sig; the\n"
+        "                     source is as for bencrypt)\n"
+        "  audit:             <source>\n"
+        "                     (finds public keys sharing a prime factor; the\n"
+        "                     source is as for bencrypt)\n"
+        "  daemon:            <unix socket path>\n"
+        "  bench:             [<key size> | <public key> <private key>]\n"
+        "                     (default: a generated 1024-bit key)\n"
+        "  tune:              [<tuning file>]\n"
+        "                     (measures algorithm cutoffs, window sizes and\n"
+        "                     kernels; default file: $RSA_TUNE_FILE, else\n"
+        "                     ~/.rsa_tune, read by every later run)\n"
+        "options:\n"
+        "  --resume           continue an interrupted cencrypt/cdecrypt\n"
+        "  --range=<off>:<n>  cdecrypt only n bytes starting at offset off\n"
+        "  --workers=<n>      daemon, batch and audit worker threads (default:\n"
+        "                     one per cpu)\n"
+        "  --cache=<n>        daemon key cache size (default: 256)\n"
+        "  --key-dir=<dir>    daemon key directory, requests name keys\n"
+        "                     relative to it (default: .)\n"
+        "  --legacy           keygen writes keys in the old format\n"
+        "  --primes=<n>       keygen splits the modulus into 2 to 4 primes,\n"
+        "                     more are faster to use (default: 2)\n"
+        "  --parallel-crt     decrypt, cdecrypt and sign run the per-prime\n"
+        "                     exponentiations of each block on two threads\n"
+        "  --compress         encrypt and bencrypt compress the data first;\n"
+        "                     decrypt and bdecrypt detect it\n"
+        "  --bench-sizes=<n>[,...]  bench input sizes in bytes, k/m/g\n"
+        "                     suffixes allowed (default: 64k,1m)\n"
+        "  --bench-dir=<dir>  bench scratch file directory (default: .)\n"
+        "  --stats[=json]     print hot-path counters and phase timings\n"
+        "  --trace=<file>     write phase timings as a Chrome trace";
     puts(usage_str);
 }
 
-static int fsize(const char *path, size_t *size)
+#define MAX_BENCH_SIZES 8
+
+// command line options, accepted anywhere after the program name
+typedef struct
 {
-    struct stat buffer;    
-    if (stat(path, &buffer))
-        return 1;
-    *size = buffer.st_size;
-    return 0;
+    int resume;
+    uint64_t range_offset;
+    uint64_t range_size;
+    unsigned workers;
+    unsigned cache_size;
+    const char *key_dir;
+    int legacy_keys;
+    unsigned primes;
+    int parallel_crt;
+    int compress;
+    size_t bench_sizes[MAX_BENCH_SIZES];
+    size_t bench_size_count;
+    const char *bench_dir;
+    int stats; // 1: human-readable, 2: json
+    const char *trace_path;
+} options_t;
+
+static options_t options = {0, 0, CT_TO_END, 0, 256, ".", 0, 2, 0, 0,
+    {64<<10, 1<<20}, 2, ".", 0, NULL};
+
+static int parse_bench_sizes(const char *list)
+{
+    options.bench_size_count = 0;
+    while (*list)
+    {
+        char *end;
+        unsigned long long size = strtoull(list, &end, 10);
+        if (end==list || options.bench_size_count==MAX_BENCH_SIZES)
+            return 1;
+        switch (*end)
+        {
+        case 'g': size <<= 10; // fall through
+        case 'm': size <<= 10; // fall through
+        case 'k': size <<= 10; end++;
+        }
+        if ((*end && *end!=',') || size>SIZE_MAX)
+            return 1;
+        options.bench_sizes[options.bench_size_count++] = (size_t)size;
+        list = *end ? end+1 : end;
+    }
+    return !options.bench_size_count;
 }
 
-static int ftrim(FILE *f, size_t new_size)
+// Remove recognized options from argv.
+// returns nonzero on an unknown or malformed option
+static int parse_options(int *argc, char *argv[])
 {
-#ifndef _WIN32
-    return ftruncate(fileno(f), new_size);
-#else
-    return _chsize(_fileno(f), (long)new_size)==-1;
-#endif
+    int count = 1;
+    for (int i = 1; i<*argc; i++)
+    {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--", 2))
+        {
+            argv[count++] = argv[i];
+            continue;
+        }
+        unsigned long long offset, size;
+        if (!strcmp(arg, "--resume"))
+            options.resume = 1;
+        else if (!strcmp(arg, "--legacy"))
+            options.legacy_keys = 1;
+        else if (!strcmp(arg, "--parallel-crt"))
+            options.parallel_crt = 1;
+        else if (!strcmp(arg, "--compress"))
+            options.compress = 1;
+        else if (!strcmp(arg, "--stats"))
+            options.stats = 1;
+        else if (!strcmp(arg, "--stats=json"))
+            options.stats = 2;
+        else if (!strncmp(arg, "--trace=", 8))
+            options.trace_path = arg+8;
+        else if (!strncmp(arg, "--key-dir=", 10))
+            options.key_dir = arg+10;
+        else if (!strncmp(arg, "--bench-dir=", 12))
+            options.bench_dir = arg+12;
+        else if (!strncmp(arg, "--bench-sizes=", 14))
+        {
+            if (parse_bench_sizes(arg+14))
+            {
+                printf("invalid option %s.\n", arg);
+                return 1;
+            }
+        }
+        else if (sscanf(arg, "--workers=%u", &options.workers)==1)
+            ;
+        else if (sscanf(arg, "--cache=%u", &options.cache_size)==1)
+            ;
+        else if (sscanf(arg, "--primes=%u", &options.primes)==1 &&
+            options.primes>=2 && options.primes<=RSA_MAX_PRIMES)
+            ;
+        else if (sscanf(arg, "--range=%llu:%llu", &offset, &size)==2)
+        {
+            options.range_offset = offset;
+            options.range_size = size;
+        }
+        else
+        {
+            printf("unknown option %s.\n", arg);
+            return 1;
+        }
+    }
+    *argc = count;
+    argv[count] = NULL;
+    return 0;
 }
 
+// smallest prime --primes may split a key into
+#define MIN_PRIME_BITS 256
+
 static int run_keygen(int argc, char *argv[])
 {
     // 0    1      2      3       4
@@ -57,6 +212,11 @@ static int run_keygen(int argc, char *argv[])
         puts("invalid key size (must me a multiple of 32).");
         return 1;
     }
+    if (key_size/options.primes<MIN_PRIME_BITS)
+    {
+        printf("key size too small for %u primes.\n", options.primes);
+        return 1;
+    }
     FILE *public_key = fopen(argv[3], "wb");
     if (!public_key)
     {
@@ -70,21 +230,117 @@ static int run_keygen(int argc, char *argv[])
         puts("can't open private key file.");
         return 1;
     }
-    bigint_t *e = bigint_alloc();
-    bigint_t *d = bigint_alloc();
-    bigint_t *n = bigint_alloc();
-    rsa_generate_keypair(e, d, n, key_size);
-    rsa_save_key(public_key, n, e);
-    rsa_save_key(private_key, n, d);
+    rnd_t rnd;
+    if (rnd_init(&rnd))
+    {
+        fclose(public_key);
+        fclose(private_key);
+        puts("can't initialize random number generator.");
+        return 1;
+    }
+    rsa_key_t pub, priv;
+    rsa_generate_key(&rnd, key_size, options.primes, &pub, &priv);
+    if (options.legacy_keys)
+    {
+        rsa_save_key(public_key, pub.n, pub.exp);
+        rsa_save_key(private_key, priv.n, priv.exp);
+    }
+    else
+    {
+        rsa_key_write(public_key, &pub);
+        rsa_key_write(private_key, &priv);
+    }
     // XXX: zeroize keys before free?
-    bigint_free(e);
-    bigint_free(d);
-    bigint_free(n);
+    rsa_key_free(&pub);
+    rsa_key_free(&priv);
     fclose(public_key);
     fclose(private_key);
     return 0;
 }
 
+static int load_key_file(const char *path, rsa_key_t *key)
+{
+    if (rsa_key_map(path, key))
+    {
+        puts("can't open key file or invalid key file.");
+        return 1;
+    }
+    return 0;
+}
+
+// Private keys without CRT components aren't blinded (see rsa.h).
+static void warn_unblinded(const rsa_key_t *key)
+{
+    if (!key->prime_count)
+    {
+        puts("warning: key has no CRT components, private operations are "
+            "not blinded; generate a new key to fix this.");
+    }
+}
+
+// --parallel-crt, staying on one thread if the helper can't start
+static void set_parallel_crt(rsa_ctx_t *ctx)
+{
+    if (options.parallel_crt)
+        rsa_ctx_set_concurrent(ctx, 1);
+}
+
+// mode is 'e' or 'd'
+static int transform_file(char mode, const char *key_path,
+    const char *src_path, const char *dst_path)
+{
+    FILE *src = fopen(src_path, "rb");
+    if (!src)
+    {
+        puts("can't open source file.");
+        return 1;
+    }
+    FILE *dst = fopen(dst_path, "wb");
+    if (!dst)
+    {
+        fclose(src);
+        puts("can't open destination file.");
+        return 1;
+    }
+    rsa_key_t key;
+    if (load_key_file(key_path, &key))
+    {
+        fclose(src);
+        fclose(dst);
+        return 1;
+    }
+    if (mode=='d')
+        warn_unblinded(&key);
+    rsa_ctx_t ctx;
+    int ctx_ready = !rsa_ctx_init_key(&ctx, &key);
+    if (ctx_ready)
+        set_parallel_crt(&ctx);
+    int result = 1;
+    rnd_t rnd;
+    if (!ctx_ready)
+        puts("invalid key file.");
+    else if (mode=='e' && rnd_init(&rnd))
+        puts("can't initialize random number generator.");
+    else
+    {
+        result = batch_transform(mode, &ctx, key.n, &rnd, options.compress,
+            src, dst);
+        if (result==BATCH_ERR_PADDING)
+        {
+            puts(mode=='d' ? "padding is invalid and cannot be removed." :
+                "cannot apply padding.");
+        }
+        else if (result!=BATCH_OK)
+            printf("%s.\n", batch_error(result));
+    }
+    if (ctx_ready)
+        rsa_ctx_free(&ctx);
+    rsa_key_free(&key);
+    fclose(src);
+    fclose(dst);
+    return result!=BATCH_OK;
+}
+
 static int run_transform(int argc, char *argv[])
 {
     // 0    1         2   3   4
@@ -99,112 +355,602 @@ static int run_transform(int argc, char *argv[])
         print_usage();
         return 1;
     }
-    FILE *key = fopen(argv[2], "rb");
-    if (!key)
+    return transform_file(mode, argv[2], argv[3], argv[4]);
+}
+
+static int run_batch(int argc, char *argv[])
+{
+    // 0    1        2   3   4
+    // rsa bencrypt key src dst_dir
+    // rsa bverify  key src
+    char mode = !strcmp(argv[1], "bverify") ? 'v' :
+        !strcmp(argv[1], "bencrypt") ? 'e' : 'd';
+    rsa_key_t key;
+    if (load_key_file(argv[2], &key))
+        return 1;
+    if (mode=='d')
+        warn_unblinded(&key);
+    batch_config_t config;
+    config.workers = options.workers;
+    config.compress = options.compress;
+    int result = batch_run(mode, &key, argv[3], mode=='v' ? NULL : argv[4],
+        &config);
+    rsa_key_free(&key);
+    return result;
+}
+
+static int run_sign(int argc, char *argv[])
+{
+    // 0    1    2   3    4
+    // rsa sign key file sig
+    int sign = !strcmp(argv[1], "sign");
+    FILE *src = fopen(argv[3], "rb");
+    if (!src)
+    {
+        puts("can't open source file.");
+        return 1;
+    }
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    int result = sign_digest_file(src, digest);
+    fclose(src);
+    if (result!=SIGN_OK)
+    {
+        puts("can't read source file.");
+        return 1;
+    }
+    rsa_key_t key;
+    if (load_key_file(argv[2], &key))
+        return 1;
+    if (sign)
+        warn_unblinded(&key);
+    rsa_ctx_t ctx;
+    if (rsa_ctx_init_key(&ctx, &key))
+    {
+        rsa_key_free(&key);
+        puts("invalid key file.");
+        return 1;
+    }
+    set_parallel_crt(&ctx);
+    size_t sig_size = sign_size(key.n);
+    // one byte over, to tell an oversized signature from a valid one
+    uint8_t *sig = malloc(sig_size+1);
+    if (sign)
+    {
+        result = SIGN_ERR_IO;
+        FILE *dst = NULL;
+        if (sign_create(&ctx, key.n, digest, sig)!=SIGN_OK)
+            puts("key is too small for a SHA-256 signature.");
+        else if (!(dst = fopen(argv[4], "wb")))
+            puts("can't open signature file.");
+        else
+        {
+            size_t written = fwrite(sig, 1, sig_size, dst);
+            if (fclose(dst) || written!=sig_size)
+                puts("can't write signature file.");
+            else
+                result = SIGN_OK;
+        }
+        result = result!=SIGN_OK;
+    }
+    else
+    {
+        FILE *sig_file = fopen(argv[4], "rb");
+        if (!sig_file)
+        {
+            puts("can't open signature file.");
+            result = 1;
+        }
+        else
+        {
+            size_t bytes_read = fread(sig, 1, sig_size+1, sig_file);
+            fclose(sig_file);
+            result = sign_check(&ctx, key.n, digest, sig, bytes_read);
+            puts(result==SIGN_OK ? "signature is valid." :
+                "signature is invalid.");
+            result = result!=SIGN_OK;
+        }
+    }
+    free(sig);
+    rsa_ctx_free(&ctx);
+    rsa_key_free(&key);
+    return result;
+}
+
+static int run_audit(int argc, char *argv[])
+{
+    // 0    1     2
+    // rsa audit src
+    batch_config_t config;
+    config.workers = options.workers;
+    return audit_run(argv[2], &config);
+}
+
+static int run_tune(int argc, char *argv[])
+{
+    // 0    1    2
+    // rsa tune [file]
+    return tuner_run(argc==3 ? argv[2] : NULL);
+}
+
+static int run_container(int argc, char *argv[])
+{
+    // 0    1        2   3   4
+    // rsa cencrypt key src dst
+    int encrypt = !strcmp(argv[1], "cencrypt");
+    if (encrypt && (options.range_offset || options.range_size!=CT_TO_END))
     {
-        puts("can't open key file.");
+        puts("--range applies to cdecrypt only.");
         return 1;
     }
-    size_t src_size;
-    if (fsize(argv[3], &src_size))
+    rsa_key_t key;
+    if (load_key_file(argv[2], &key))
+        return 1;
+    if (!encrypt)
+        warn_unblinded(&key);
+    rsa_ctx_t ctx;
+    if (rsa_ctx_init_key(&ctx, &key))
     {
-        printf("can't stat %s.\n", argv[3]);
+        rsa_key_free(&key);
+        puts("invalid key file.");
         return 1;
     }
+    set_parallel_crt(&ctx);
+    FILE *src = fopen(argv[3], "rb");
+    FILE *dst = NULL;
+    if (src)
+    {
+        // resuming continues what is there, a missing file is created
+        if (options.resume)
+            dst = fopen(argv[4], "r+b");
+        if (!dst)
+            dst = fopen(argv[4], "wb");
+    }
+    int result = CT_ERR_IO;
+    if (!src)
+        puts("can't open source file.");
+    else if (!dst)
+        puts("can't open destination file.");
+    else if (encrypt)
+        result = ct_encrypt(&ctx, key.n, src, dst, options.resume);
+    else
+    {
+        result = ct_decrypt(&ctx, key.n, src, dst, options.range_offset,
+            options.range_size, options.resume);
+    }
+    if (src)
+        fclose(src);
+    if (dst)
+    {
+        fclose(dst);
+        // a resumed run keeps what it wrote so it can be resumed again
+        if (result!=CT_OK && !options.resume)
+            remove(argv[4]);
+    }
+    rsa_ctx_free(&ctx);
+    rsa_key_free(&key);
+    switch (result)
+    {
+    case CT_OK:
+        return 0;
+    case CT_ERR_IO:
+        if (src && dst)
+            puts("i/o error.");
+        break;
+    case CT_ERR_FORMAT:
+        puts("not a container, unsupported version or truncated.");
+        break;
+    case CT_ERR_KEY:
+        puts("key or source does not match the container.");
+        break;
+    case CT_ERR_CORRUPT:
+        puts("container block checksum mismatch.");
+        break;
+    case CT_ERR_RANGE:
+        puts("range starts past the end of the plaintext.");
+        break;
+    case CT_ERR_ENTROPY:
+        puts("can't obtain random padding.");
+        break;
+    }
+    return 1;
+}
+
+static int run_hybrid(int argc, char *argv[])
+{
+    // 0    1        2   3   4
+    // rsa hencrypt key src dst
+    int encrypt = !strcmp(argv[1], "hencrypt");
+    rsa_key_t key;
+    if (load_key_file(argv[2], &key))
+        return 1;
+    if (!encrypt)
+        warn_unblinded(&key);
     FILE *src = fopen(argv[3], "rb");
     if (!src)
     {
+        rsa_key_free(&key);
         puts("can't open source file.");
         return 1;
     }
     FILE *dst = fopen(argv[4], "wb");
-    if (!src)
+    if (!dst)
     {
+        fclose(src);
+        rsa_key_free(&key);
         puts("can't open destination file.");
         return 1;
     }
-    bigint_t *n = bigint_alloc();
-    bigint_t *exp = bigint_alloc();
-    // XXX: free allocated resources on failure
-    if (rsa_load_key(key, n, exp))
+    int result = encrypt ? hy_encrypt(src, dst, &key) :
+        hy_decrypt(src, dst, &key);
+    fclose(src);
+    fclose(dst);
+    rsa_key_free(&key);
+    // never leave partial or unauthenticated output behind
+    if (result!=HY_OK)
+        remove(argv[4]);
+    switch (result)
     {
-        puts("invalid key file.");
+    case HY_OK:
+        return 0;
+    case HY_ERR_IO:
+        puts("i/o error.");
+        break;
+    case HY_ERR_FORMAT:
+        puts("not a hybrid container or unsupported version.");
+        break;
+    case HY_ERR_KEY:
+        puts("key does not match the container.");
+        break;
+    case HY_ERR_ENTROPY:
+        puts("can't obtain random session key.");
+        break;
+    case HY_ERR_AUTH:
+        puts("container was modified or is corrupt.");
+        break;
+    }
+    return 1;
+}
+
+static int run_daemon(int argc, char *argv[])
+{
+    // 0    1      2
+    // rsa daemon socket
+    rsad_config_t config;
+    config.workers = options.workers;
+    config.cache_size = options.cache_size;
+    config.key_dir = options.key_dir;
+    return rsad_run(argv[2], &config);
+}
+
+static double now_seconds()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart/freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+#endif
+}
+
+// peak resident set size in KiB
+static size_t peak_rss()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+        sizeof(counters)))
+    {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize/1024;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss/1024; // bytes there
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+static void print_bench_row(size_t size, const char *mode, const char *where,
+    double seconds, size_t blocks)
+{
+    printf("%12zu %-8s %-7s %10.2f %12.0f %12.2f\n", size, mode, where,
+        size/seconds/(1<<20), blocks/seconds, seconds/blocks*1e6);
+}
+
+static int load_library_key(const char *path, librsa_key_t **key)
+{
+    rsa_key_t rsa;
+    if (load_key_file(path, &rsa))
         return 1;
+    size_t size = rsa_key_serialize(&rsa, NULL);
+    uint8_t *image = malloc(size);
+    rsa_key_serialize(&rsa, image);
+    int result = librsa_key_load(image, size, key)!=LIBRSA_OK;
+    free(image);
+    rsa_key_free(&rsa);
+    if (result)
+        puts("invalid key file.");
+    return result;
+}
+
+// Same data through the in-memory library calls and through the exact
+// file path of the encrypt/decrypt commands, checking the round trip.
+static int bench_size(const char *pub_path, const char *priv_path,
+    librsa_key_t *pub, librsa_key_t *priv, size_t size, rnd_t *rnd)
+{
+    char src_path[1024], enc_path[1024], dec_path[1024];
+    snprintf(src_path, sizeof(src_path), "%s/rsa_bench.src",
+        options.bench_dir);
+    snprintf(enc_path, sizeof(enc_path), "%s/rsa_bench.enc",
+        options.bench_dir);
+    snprintf(dec_path, sizeof(dec_path), "%s/rsa_bench.dec",
+        options.bench_dir);
+    size_t block_size = librsa_key_bits(pub)/8;
+    size_t enc_size = librsa_encrypt_size(pub, size);
+    size_t blocks = enc_size/block_size;
+    uint8_t *plain = malloc(size+1);
+    uint8_t *cipher = malloc(enc_size);
+    uint8_t *check = malloc(librsa_decrypt_size(priv, enc_size)+1);
+    rnd_bytes(rnd, plain, size);
+    int result = 1;
+    double start = now_seconds();
+    size_t out_size = enc_size;
+    if (librsa_encrypt(pub, plain, size, cipher, &out_size)!=LIBRSA_OK)
+    {
+        puts("in-memory encryption failed.");
+        goto done;
     }
-    size_t src_block_size, dst_block_size;
-    rsa_get_block_sizes(mode, n, &src_block_size, &dst_block_size);
-    // decrypting: transform plain_blocks-1, apply special case for last block
-    // encrypting: transform plain_blocks, apply special case for the rest
-    size_t buf_sz = max(src_block_size, dst_block_size);
-    uint8_t *buf = malloc(buf_sz);
-    size_t zbytes = mode=='e' ? dst_block_size-src_block_size : 0;
-    assert(zbytes<=sizeof(uint32_t));
-    size_t bytes_read = 0;
-    while (1)
-    {
-        // XXX: valid for little endian only!
-        bytes_read = fread(buf, 1, src_block_size, src);        
-        memset(buf+buf_sz-zbytes, 0, zbytes);
-        if (bytes_read!=src_block_size)
+    double mid = now_seconds();
+    size_t check_size = librsa_decrypt_size(priv, enc_size);
+    if (librsa_decrypt(priv, cipher, out_size, check, &check_size)!=
+        LIBRSA_OK || check_size!=size || memcmp(plain, check, size))
+    {
+        puts("in-memory round trip failed.");
+        goto done;
+    }
+    double end = now_seconds();
+    print_bench_row(size, "encrypt", "memory", mid-start, blocks);
+    print_bench_row(size, "decrypt", "memory", end-mid, blocks);
+    FILE *f = fopen(src_path, "wb");
+    if (!f || fwrite(plain, 1, size, f)!=size)
+    {
+        if (f)
+            fclose(f);
+        printf("can't write %s.\n", src_path);
+        goto done;
+    }
+    fclose(f);
+    start = now_seconds();
+    if (transform_file('e', pub_path, src_path, enc_path))
+        goto done;
+    mid = now_seconds();
+    if (transform_file('d', priv_path, enc_path, dec_path))
+        goto done;
+    end = now_seconds();
+    f = fopen(dec_path, "rb");
+    if (!f || fread(check, 1, size+1, f)!=size || memcmp(plain, check, size))
+    {
+        if (f)
+            fclose(f);
+        puts("on-disk round trip failed.");
+        goto done;
+    }
+    fclose(f);
+    print_bench_row(size, "encrypt", "disk", mid-start, blocks);
+    print_bench_row(size, "decrypt", "disk", end-mid, blocks);
+    result = 0;
+done:
+    remove(src_path);
+    remove(enc_path);
+    remove(dec_path);
+    free(plain);
+    free(cipher);
+    free(check);
+    return result;
+}
+
+static int compare_seconds(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x>y)-(x<y);
+}
+
+#define LATENCY_RUNS 400
+
+// Single-block private operations one at a time, as an interactive
+// decrypt does, on one thread and with --parallel-crt.
+static void bench_latency(const char *priv_path, rnd_t *rnd)
+{
+    rsa_key_t key;
+    if (rsa_key_map(priv_path, &key))
+        return;
+    rsa_ctx_t ctx;
+    if (!key.prime_count || rsa_ctx_init_key(&ctx, &key))
+    {
+        rsa_key_free(&key);
+        return;
+    }
+    uint8_t *block = malloc(ctx.block_size);
+    double *samples = malloc(LATENCY_RUNS*sizeof(double));
+    double p50[2];
+    puts("single-block private op latency:");
+    for (int parallel = 0; parallel<2; parallel++)
+    {
+        if (parallel && rsa_ctx_set_concurrent(&ctx, 1))
+        {
+            puts("  can't start the CRT helper thread.");
             break;
-        rsa_transform(buf, buf_sz, buf, exp, n);
-        fwrite(buf, 1, dst_block_size, dst);
+        }
+        for (size_t i = 0; i<LATENCY_RUNS; i++)
+        {
+            rnd_bytes(rnd, block, ctx.block_size);
+            double start = now_seconds();
+            rsa_transform_ctx(&ctx, block, block);
+            samples[i] = now_seconds()-start;
+        }
+        qsort(samples, LATENCY_RUNS, sizeof(double), compare_seconds);
+        p50[parallel] = samples[LATENCY_RUNS/2];
+        printf("  %-13s p50 %9.1f us   p99 %9.1f us\n",
+            parallel ? "parallel CRT" : "serial", p50[parallel]*1e6,
+            samples[LATENCY_RUNS*99/100]*1e6);
+        if (parallel)
+            printf("  p50 speedup   %.2fx\n", p50[0]/p50[1]);
     }
-    // process last block
-    if (mode=='d')
+    free(samples);
+    free(block);
+    rsa_ctx_free(&ctx);
+    rsa_key_free(&key);
+}
+
+static int run_bench(int argc, char *argv[])
+{
+    // 0    1     2        3
+    // rsa bench [key_sz | pub_key priv_key]
+    char pub_path[1024], priv_path[1024];
+    int generated = argc!=4;
+    rnd_t rnd;
+    if (rnd_init(&rnd))
+    {
+        puts("can't initialize random number generator.");
+        return 1;
+    }
+    if (generated)
     {
-        size_t src_plain_size = src_size/src_block_size*dst_block_size;
-        size_t padding = 0;
-        if (dp_depad(buf, dst_block_size, &padding)!=DP_OK ||
-            padding>src_plain_size)
+        uint32_t key_size = 1024;
+        if (argc==3 && (sscanf(argv[2], "%u", &key_size)!=1 ||
+            !key_size || key_size%32))
+        {
+            puts("invalid key size (must me a multiple of 32).");
+            return 1;
+        }
+        if (key_size/options.primes<MIN_PRIME_BITS)
         {
-            puts("padding is invalid and cannot be removed.");
+            printf("key size too small for %u primes.\n", options.primes);
             return 1;
         }
-        // trim to the actual plaintext size
-        if (fseek(dst, 0, SEEK_SET) || ftrim(dst, src_plain_size-padding))
+        snprintf(pub_path, sizeof(pub_path), "%s/rsa_bench.pub",
+            options.bench_dir);
+        snprintf(priv_path, sizeof(priv_path), "%s/rsa_bench.priv",
+            options.bench_dir);
+        rsa_key_t pub, priv;
+        double start = now_seconds();
+        rsa_generate_key(&rnd, key_size, options.primes, &pub, &priv);
+        double seconds = now_seconds()-start;
+        FILE *pub_file = fopen(pub_path, "wb");
+        FILE *priv_file = fopen(priv_path, "wb");
+        int failed = !pub_file || !priv_file ||
+            rsa_key_write(pub_file, &pub) || rsa_key_write(priv_file, &priv);
+        if (pub_file)
+            fclose(pub_file);
+        if (priv_file)
+            fclose(priv_file);
+        rsa_key_free(&pub);
+        rsa_key_free(&priv);
+        if (failed)
         {
-            puts("can't set destination file size.");
+            puts("can't write key files.");
+            remove(pub_path);
+            remove(priv_path);
             return 1;
         }
+        printf("keygen: %u bits, %u primes in %.3f s\n", key_size,
+            options.primes, seconds);
     }
     else
     {
-        size_t param = 0;
-        int pad_result = dp_pad(buf, src_block_size, bytes_read, &param);
-        if (pad_result!=DP_OK)
+        snprintf(pub_path, sizeof(pub_path), "%s", argv[2]);
+        snprintf(priv_path, sizeof(priv_path), "%s", argv[3]);
+    }
+    librsa_key_t *pub = NULL, *priv = NULL;
+    int result = 1;
+    if (!load_library_key(pub_path, &pub) &&
+        !load_library_key(priv_path, &priv))
+    {
+        printf("key: %zu bits\n", librsa_key_bits(pub));
+        printf("%12s %-8s %-7s %10s %12s %12s\n", "bytes", "mode", "path",
+            "MB/s", "blocks/s", "us/block");
+        result = 0;
+        for (size_t i = 0; i<options.bench_size_count && !result; i++)
         {
-            if (pad_result!=DP_MORE)
-            {
-                puts("cannot apply padding.");
-                return 1;
-            }
-            rsa_transform(buf, buf_sz, buf, exp, n);
-            fwrite(buf, 1, buf_sz, dst);
-            if (dp_pad(buf, src_block_size, 0, &param)!=DP_OK)
-            {
-                puts("cannot apply padding.");
-                return 1;
-            }
+            result = bench_size(pub_path, priv_path, pub, priv,
+                options.bench_sizes[i], &rnd);
         }
-        rsa_transform(buf, buf_sz, buf, exp, n);
-        fwrite(buf, 1, buf_sz, dst);
+        if (!result)
+            bench_latency(priv_path, &rnd);
+        printf("peak rss: %zu KiB\n", peak_rss());
     }
-    free(buf);
-    bigint_free(n);
-    bigint_free(exp);
-    fclose(key);
-    fclose(src);
-    fclose(dst);
-    return 0;
+    librsa_key_free(pub);
+    librsa_key_free(priv);
+    if (generated)
+    {
+        remove(pub_path);
+        remove(priv_path);
+    }
+    return result;
 }
 
-int main(int argc, char *argv[])
+static int run_command(int argc, char *argv[])
 {
     if (argc==5 && !strcmp(argv[1], "keygen"))
         return run_keygen(argc, argv);
+    if (argc==3 && !strcmp(argv[1], "daemon"))
+        return run_daemon(argc, argv);
+    if (argc==3 && !strcmp(argv[1], "audit"))
+        return run_audit(argc, argv);
+    if (argc>=2 && argc<=3 && !strcmp(argv[1], "tune"))
+        return run_tune(argc, argv);
+    if (argc>=2 && argc<=4 && !strcmp(argv[1], "bench"))
+        return run_bench(argc, argv);
+    if (argc==5 && (!strcmp(argv[1], "hencrypt") ||
+        !strcmp(argv[1], "hdecrypt")))
+    {
+        return run_hybrid(argc, argv);
+    }
+    if (argc==5 && (!strcmp(argv[1], "bencrypt") ||
+        !strcmp(argv[1], "bdecrypt")))
+    {
+        return run_batch(argc, argv);
+    }
+    if (argc==4 && !strcmp(argv[1], "bverify"))
+        return run_batch(argc, argv);
+    if (argc==5 && (!strcmp(argv[1], "sign") ||
+        !strcmp(argv[1], "verify")))
+    {
+        return run_sign(argc, argv);
+    }
+    if (argc==5 && (!strcmp(argv[1], "cencrypt") ||
+        !strcmp(argv[1], "cdecrypt")))
+    {
+        return run_container(argc, argv);
+    }
     if (argc==5)
         return run_transform(argc, argv);
     print_usage();
     return 1;
 }
+
+int main(int argc, char *argv[])
+{
+    if (parse_options(&argc, argv))
+        return 1;
+    if (options.trace_path)
+        stats_trace_enable();
+    int result = run_command(argc, argv);
+    if (options.stats)
+        stats_print(stdout, options.stats==2);
+    if (options.trace_path && stats_write_trace(options.trace_path))
+    {
+        printf("can't write %s.\n", options.trace_path);
+        result = 1;
+    }
+    return result;
+}
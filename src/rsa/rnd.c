@@ -0,0 +1,33 @@
+#include "config.h"
+#include "rnd.h"
+#include "entropy.h"
+#include <string.h>
+
+int rnd_init(rnd_t *rnd)
+{
+    uint8_t seed[CHACHA20_KEY_SIZE];
+    if (entropy_read(seed, sizeof(seed)))
+        return 1;
+    rnd_seed(rnd, seed);
+    memset(seed, 0, sizeof(seed));
+    return 0;
+}
+
+void rnd_seed(rnd_t *rnd, const uint8_t seed[CHACHA20_KEY_SIZE])
+{
+    static const uint8_t nonce[CHACHA20_NONCE_SIZE] = {0};
+    chacha20_init(&rnd->stream, seed, nonce, 0);
+}
+
+void rnd_bytes(rnd_t *rnd, uint8_t *buf, size_t size)
+{
+    memset(buf, 0, size);
+    chacha20_xor(&rnd->stream, buf, buf, size);
+}
+
+uint32_t rnd_u32(rnd_t *rnd)
+{
+    uint8_t buf[4];
+    rnd_bytes(rnd, buf, sizeof(buf));
+    return load32_le(buf);
+}
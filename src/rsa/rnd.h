@@ -0,0 +1,19 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+#include "chacha20.h"
+
+// Deterministic random bit generator: the ChaCha20 keystream under a
+// 256-bit seed. Each caller owns its generator, so there is no shared
+// state between threads and no dependency on srand()/rand().
+typedef struct
+{
+    chacha20_t stream;
+} rnd_t;
+
+// seed from the operating system CSPRNG, returns nonzero on failure
+int rnd_init(rnd_t *rnd);
+// reproducible sequences for tests and benchmarks
+void rnd_seed(rnd_t *rnd, const uint8_t seed[CHACHA20_KEY_SIZE]);
+void rnd_bytes(rnd_t *rnd, uint8_t *buf, size_t size);
+uint32_t rnd_u32(rnd_t *rnd);
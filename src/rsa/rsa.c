@@ -2,10 +2,13 @@
 #include "rsa.h"
 #include "bigint.h"
 #include "solovay_strassen.h"
+#include "cpu.h"
+#include "thread.h"
+#include "stats.h"
+#include "tune.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <time.h>
 #include <assert.h>
 
 #define ACCURACY 20
@@ -15,31 +18,34 @@ static const char hex_digits[16] = {
     '8','9','a','b','c','d','e','f'
 };
 
-static void rand_prime(size_t digit_count, bigint_t *result)
+static void rand_prime(rnd_t *rnd, size_t digit_count, bigint_t *result)
 {
+    assert(digit_count>=2);
     char *str = malloc(digit_count+1);
-    str[0] = hex_digits[rand()%9+1]; // 1..f
-    str[digit_count-1] = hex_digits[(rand()%8)*2+1]; // odd digit
+    str[0] = hex_digits[rnd_u32(rnd)%9+1]; // 1..f
+    str[digit_count-1] = hex_digits[(rnd_u32(rnd)%8)*2+1]; // odd digit
     for (int i = 1; i<digit_count-1; i++)
-        str[i] = hex_digits[rand()%16];
+        str[i] = hex_digits[rnd_u32(rnd)%16];
     str[digit_count] = 0;
     bigint_fromstring(result, str, 'h');
     while (1)
     {
-        if (is_prime_ss(result, ACCURACY))
+        STATS_ADD(STAT_PRIME_CANDIDATES, 1);
+        if (is_prime_ss(rnd, result, ACCURACY))
         {
             free(str);
             return;
         }
+        STATS_ADD(STAT_PRIME_REJECTED, 1);
         bigint_iadd(result, &small_bigint[2]);
     }
 }
 
 // the result is less than n and coprime to phi
-static void rand_exponent(bigint_t *phi, int n, bigint_t *result)
+static void rand_exponent(rnd_t *rnd, bigint_t *phi, int n, bigint_t *result)
 {
     bigint_t *gcd = bigint_alloc();
-    int e = rand()%n;
+    int e = rnd_u32(rnd)%n;
     while (1)
     {
         bigint_fromint(result, e);
@@ -55,43 +61,812 @@ static void rand_exponent(bigint_t *phi, int n, bigint_t *result)
     }
 }
 
-void rsa_generate_keypair(bigint_t *e, bigint_t *d, bigint_t *n,
-    size_t keysize)
+void rsa_generate_key(rnd_t *rnd, size_t keysize, size_t prime_count,
+    rsa_key_t *public_key, rsa_key_t *private_key)
 {
     assert(keysize%32==0);
-    size_t factor_digits = keysize/8;
-    bigint_t *p = bigint_alloc();
-    bigint_t *q = bigint_alloc();
+    assert(prime_count>=2 && prime_count<=RSA_MAX_PRIMES);
+    STATS_BEGIN(start);
+    memset(public_key, 0, sizeof(rsa_key_t));
+    memset(private_key, 0, sizeof(rsa_key_t));
+    bigint_t **primes = private_key->primes;
+    bigint_t *n = bigint_alloc();
+    bigint_t *e = bigint_alloc();
+    bigint_t *d = bigint_alloc();
     bigint_t *phi = bigint_alloc();
-    srand((uint32_t)time(NULL));
-    // 1] pick two primes: p, q
-    rand_prime(factor_digits, p);
-    rand_prime(factor_digits, q);
-    // 2] calculate modulus = p*q
-    bigint_mul(n, p, q);
-    // 3] calculate phi = (p-1)*(q-1)
-    bigint_t *ps = bigint_alloc();
-    bigint_t *qs = bigint_alloc();
-    bigint_sub(ps, p, &small_bigint[1]);
-    bigint_sub(qs, q, &small_bigint[1]);
-    bigint_mul(phi, ps, qs);
+    bigint_t *rs = bigint_alloc();
+    bigint_t *temp = bigint_alloc();
+    // 1] pick distinct primes r_i splitting the key size between them, in
+    // 64-bit steps where possible so the 64-bit kernels apply to each,
+    // else in single hex digits so every prime gets at least two
+    size_t unit = keysize%64 || keysize/64<prime_count ? 1 : 16; // hex digits
+    size_t units = keysize/4/unit;
+    for (size_t i = 0; i<prime_count; i++)
+    {
+        primes[i] = bigint_alloc();
+        size_t factor_digits = (units/prime_count+(i<units%prime_count))*
+            unit;
+        int unique = 0;
+        while (!unique)
+        {
+            rand_prime(rnd, factor_digits, primes[i]);
+            unique = 1;
+            for (size_t j = 0; j<i; j++)
+                unique &= !bigint_equal(primes[i], primes[j]);
+        }
+    }
+    // 2] calculate modulus = r_0*...*r_{k-1}
+    // 3] calculate phi = (r_0-1)*...*(r_{k-1}-1)
+    bigint_copy(primes[0], n);
+    bigint_sub(phi, primes[0], &small_bigint[1]);
+    for (size_t i = 1; i<prime_count; i++)
+    {
+        bigint_mul(temp, n, primes[i]);
+        bigint_copy(temp, n);
+        bigint_sub(rs, primes[i], &small_bigint[1]);
+        bigint_mul(temp, phi, rs);
+        bigint_copy(temp, phi);
+    }
     // 4] pick e (public exponent)
-    rand_exponent(phi, RAND_MAX, e);
+    rand_exponent(rnd, phi, RAND_MAX, e);
     // 5] calculate d (private exponent)
     bigint_inv(e, phi, d);
-    bigint_free(p);
-    bigint_free(q);
+    // 6] CRT components: d mod (r_i-1), (r_0*...*r_{i-1})^-1 mod r_i
+    bigint_t *prod = phi; // no longer needed
+    bigint_copy(&small_bigint[1], prod);
+    for (size_t i = 0; i<prime_count; i++)
+    {
+        private_key->prime_exps[i] = bigint_alloc();
+        bigint_sub(rs, primes[i], &small_bigint[1]);
+        bigint_rem(d, rs, private_key->prime_exps[i]);
+        if (i)
+        {
+            private_key->coeffs[i] = bigint_alloc();
+            bigint_rem(prod, primes[i], rs);
+            bigint_inv(rs, primes[i], private_key->coeffs[i]);
+        }
+        bigint_mul(temp, prod, primes[i]);
+        bigint_copy(temp, prod);
+    }
     bigint_free(phi);
+    bigint_free(rs);
+    bigint_free(temp);
+    public_key->n = n;
+    public_key->exp = e;
+    private_key->n = bigint_alloc();
+    bigint_copy(n, private_key->n);
+    private_key->exp = d;
+    private_key->prime_count = prime_count;
+    STATS_END(STAT_KEYGEN, start);
+}
+
+void rsa_generate_keypair(rnd_t *rnd, bigint_t *e, bigint_t *d, bigint_t *n,
+    size_t keysize)
+{
+    rsa_key_t public_key, private_key;
+    rsa_generate_key(rnd, keysize, 2, &public_key, &private_key);
+    bigint_copy(public_key.exp, e);
+    bigint_copy(private_key.exp, d);
+    bigint_copy(public_key.n, n);
+    bigint_free(public_key.n);
+    bigint_free(public_key.exp);
+    bigint_free(private_key.n);
+    bigint_free(private_key.exp);
+    for (size_t i = 0; i<private_key.prime_count; i++)
+    {
+        bigint_free(private_key.primes[i]);
+        bigint_free(private_key.prime_exps[i]);
+        if (private_key.coeffs[i])
+            bigint_free(private_key.coeffs[i]);
+    }
+}
+
+static size_t bit_length(bigint_t *b)
+{
+    for (size_t i = b->size; i--;)
+    {
+        if (b->data[i])
+        {
+            size_t bits = i*32;
+            for (uint32_t top = b->data[i]; top; top >>= 1)
+                bits++;
+            return bits;
+        }
+    }
+    return 0;
+}
+
+// 'mont' holds cached constants for 'mod' or has size 0
+static int pow_init(rsa_pow_t *pow, bigint_t *exp, bigint_t *mod,
+    const bigint_mont_t *mont)
+{
+    memset(pow, 0, sizeof(rsa_pow_t));
+    if (mont && mont->size)
+    {
+        pow->mont = *mont;
+        pow->mont.borrowed = 1;
+    }
+    else if (bigint_mont_init(&pow->mont, mod))
+        return 1;
+    size_t s = pow->mont.size;
+    pow->kernel = bigint_fixed_select(s, cpu_features());
+    size_t bits = bit_length(exp);
+    pow->window = tune_window(bits);
+    pow->digit_count = (bits+pow->window-1)/pow->window;
+    pow->digits = bigint_mem_alloc(pow->digit_count+1);
+    for (size_t i = 0; i<pow->digit_count; i++)
+    {
+        size_t pos = (pow->digit_count-1-i)*pow->window;
+        uint8_t digit = 0;
+        for (size_t j = pow->window; j--;)
+        {
+            size_t bit = pos+j;
+            digit <<= 1;
+            if (bit<bits)
+                digit |= exp->data[bit/32]>>(bit%32) & 1;
+        }
+        pow->digits[i] = digit;
+        pow->mul_count += (i ? pow->window : 0)+(digit!=0);
+    }
+    size_t table_size = (size_t)1<<pow->window;
+    pow->mul_count += table_size-2;
+    pow->table = bigint_mem_alloc((table_size*s+4*s+2)*sizeof(uint32_t));
+    pow->acc = pow->table+table_size*s;
+    pow->tmp = pow->acc+s;
+    pow->scratch = pow->tmp+s;
+    return 0;
+}
+
+// Multi-buffer state takes 'lanes' times the single-block space, so it
+// is only set up once a batch needs it.
+static void pow_init_lanes(rsa_pow_t *pow, size_t lanes)
+{
+    if (pow->mb_table)
+        return;
+    size_t s = pow->mont.size;
+    size_t table_size = (size_t)1<<pow->window;
+    pow->mb_table = bigint_mem_alloc(
+        (table_size*s+6*s+2)*lanes*sizeof(uint64_t));
+    pow->mb_acc = pow->mb_table+table_size*s*lanes;
+    pow->mb_tmp = pow->mb_acc+s*lanes;
+    pow->mb_rr = pow->mb_tmp+s*lanes;
+    pow->mb_unit = pow->mb_rr+s*lanes;
+    pow->mb_scratch = pow->mb_unit+s*lanes;
+    for (size_t j = 0; j<s; j++)
+    {
+        for (size_t l = 0; l<lanes; l++)
+        {
+            pow->mb_table[j*lanes+l] = pow->mont.one[j];
+            pow->mb_rr[j*lanes+l] = pow->mont.rr[j];
+            pow->mb_unit[j*lanes+l] = !j;
+        }
+    }
+}
+
+static void pow_free(rsa_pow_t *pow)
+{
+    bigint_mont_free(&pow->mont);
+    bigint_mem_free(pow->digits);
+    bigint_mem_free(pow->table);
+    bigint_mem_free(pow->mb_table);
+    memset(pow, 0, sizeof(rsa_pow_t));
+}
+
+// acc = table[1]^exp, both in Montgomery form; the caller fills table[1]
+static void pow_run(rsa_pow_t *pow)
+{
+    bigint_mont_t *mont = &pow->mont;
+    size_t s = mont->size;
+    size_t table_size = (size_t)1<<pow->window;
+    uint32_t *table = pow->table;
+    uint32_t *acc = pow->acc;
+    uint32_t *t = pow->scratch;
+    const bigint_fixed_kernel_t *kernel = pow->kernel;
+    STATS_ADD(STAT_MODPOW, 1);
+    memcpy(table, mont->one, s*sizeof(uint32_t));
+    for (size_t i = 2; i<table_size; i++)
+        kernel->mul(mont, table+i*s, table+(i-1)*s, table+s, t);
+    memcpy(acc, mont->one, s*sizeof(uint32_t));
+    for (size_t i = 0; i<pow->digit_count; i++)
+    {
+        if (i)
+        {
+            for (size_t j = 0; j<pow->window; j++)
+                kernel->sqr(mont, acc, acc, t);
+        }
+        if (pow->digits[i])
+            kernel->mul(mont, acc, acc, table+pow->digits[i]*s, t);
+    }
+}
+
+// pow_run() over 'lanes' interleaved bases in mb_table[1]
+static void pow_run_lanes(rsa_pow_t *pow, bigint_mb_mul_t mul, size_t lanes)
+{
+    bigint_mont_t *mont = &pow->mont;
+    size_t slots = mont->size*lanes;
+    size_t table_size = (size_t)1<<pow->window;
+    uint64_t *table = pow->mb_table;
+    uint64_t *acc = pow->mb_acc;
+    uint64_t *t = pow->mb_scratch;
+    STATS_ADD(STAT_MODPOW, lanes);
+    STATS_ADD(STAT_MONT_MUL, pow->mul_count*lanes);
+    STATS_ADD(STAT_LIMB_OPS, pow->mul_count*lanes*2*mont->size*mont->size);
+    // table[0] is 1 in Montgomery form, set up once by pow_init_lanes()
+    for (size_t i = 2; i<table_size; i++)
+        mul(mont, table+i*slots, table+(i-1)*slots, table+slots, t);
+    memcpy(acc, table, slots*sizeof(uint64_t));
+    for (size_t i = 0; i<pow->digit_count; i++)
+    {
+        if (i)
+        {
+            for (size_t j = 0; j<pow->window; j++)
+                mul(mont, acc, acc, acc, t);
+        }
+        if (pow->digits[i])
+            mul(mont, acc, acc, table+pow->digits[i]*slots, t);
+    }
+}
+
+// r[0, r_size) += a*b, the sum must fit
+static void mul_add(uint32_t *r, size_t r_size, const uint32_t *a,
+    size_t a_size, const uint32_t *b, size_t b_size)
+{
+    for (size_t i = 0; i<b_size; i++)
+    {
+        uint64_t c = 0;
+        for (size_t j = 0; j<a_size; j++)
+        {
+            c += (uint64_t)a[j]*b[i]+r[i+j];
+            r[i+j] = (uint32_t)c;
+            c >>= 32;
+        }
+        for (size_t j = i+a_size; c && j<r_size; j++)
+        {
+            c += r[j];
+            r[j] = (uint32_t)c;
+            c >>= 32;
+        }
+    }
+}
+
+// see rsa_ctx_t
+struct rsa_blind
+{
+    rsa_pow_t pow; // x^e mod n; its kernel and scratch serve every product
+    rnd_t rnd;
+    // pair i: r_i^e at 2*i*size limbs, r_i^-1 right after, Montgomery form
+    uint32_t *pairs;
+    uint32_t *work; // 2*RSA_BLIND_PAIRS*size limbs for blind_generate()
+    size_t in; // next pair to blind a block with
+    size_t out; // ... and to unblind one with
+    size_t uses; // blocks since the last blind_generate()
+};
+
+// Public exponent of a CRT key: d^-1 mod lcm(r_i-1), which is e for keys
+// from rsa_generate_key() and works the same for others.
+// returns nonzero if there is none
+static int public_exp(const rsa_key_t *key, bigint_t *e)
+{
+    bigint_t *lambda = bigint_alloc();
+    bigint_t *r = bigint_alloc();
+    bigint_t *g = bigint_alloc();
+    bigint_t *t = bigint_alloc();
+    bigint_sub(lambda, key->primes[0], &small_bigint[1]);
+    for (size_t i = 1; i<key->prime_count; i++)
+    {
+        bigint_sub(r, key->primes[i], &small_bigint[1]);
+        bigint_gcd(lambda, r, g);
+        bigint_idiv(r, g);
+        bigint_mul(t, lambda, r);
+        bigint_copy(t, lambda);
+    }
+    bigint_rem(key->exp, lambda, r);
+    bigint_inv(r, lambda, e);
+    // bigint_inv() doesn't tell if there is no inverse
+    bigint_mul(t, r, e);
+    bigint_rem(t, lambda, g);
+    int result = !bigint_equal(g, &small_bigint[1]);
+    bigint_free(lambda);
+    bigint_free(r);
+    bigint_free(g);
+    bigint_free(t);
+    return result;
+}
+
+// Replace every pair: random r_i, their inverses from one inverse of the
+// product (Montgomery's trick: prefix products up, then back down) and
+// r_i^e. returns nonzero if the product kept coming out not invertible,
+// the old pairs stay valid then.
+static int blind_generate(rsa_blind_t *blind)
+{
+    rsa_pow_t *pow = &blind->pow;
+    bigint_mont_t *mont = &pow->mont;
+    const bigint_fixed_kernel_t *kernel = pow->kernel;
+    size_t s = mont->size;
+    uint32_t *r = blind->work; // Montgomery form
+    uint32_t *prefix = r+RSA_BLIND_PAIRS*s; // r_0*...*r_i
+    uint32_t *last = prefix+(RSA_BLIND_PAIRS-1)*s;
+    uint32_t *x = pow->tmp;
+    uint32_t *q = pow->acc;
+    uint32_t *t = pow->scratch;
+    bigint_t n = {s, s, mont->n};
+    bigint_t *a = bigint_alloc_reserve(s);
+    bigint_t *inv = bigint_alloc_reserve(s);
+    int result = 1;
+    for (int attempt = 0; attempt<4 && result; attempt++)
+    {
+        for (size_t i = 0; i<RSA_BLIND_PAIRS; i++)
+        {
+            rnd_bytes(&blind->rnd, (uint8_t *)x, s*sizeof(uint32_t));
+            x[s-1] %= mont->n[s-1];
+            kernel->mul(mont, r+i*s, x, mont->rr, t);
+            if (i)
+                kernel->mul(mont, prefix+i*s, prefix+(i-1)*s, r+i*s, t);
+            else
+                memcpy(prefix, r, s*sizeof(uint32_t));
+        }
+        // the product leaves Montgomery form for bigint_inv() and its
+        // inverse comes back
+        memset(x, 0, s*sizeof(uint32_t));
+        x[0] = 1;
+        kernel->mul(mont, x, last, x, t);
+        memcpy(a->data, x, s*sizeof(uint32_t));
+        for (a->size = s; a->size>1 && !a->data[a->size-1]; a->size--)
+            ;
+        bigint_inv(a, &n, inv);
+        memset(x, 0, s*sizeof(uint32_t));
+        memcpy(x, inv->data, min(inv->size, s)*sizeof(uint32_t));
+        kernel->mul(mont, q, x, mont->rr, t);
+        kernel->mul(mont, x, q, last, t);
+        result = memcmp(x, mont->one, s*sizeof(uint32_t))!=0;
+    }
+    if (!result)
+    {
+        for (size_t i = RSA_BLIND_PAIRS-1; i; i--)
+        {
+            uint32_t *pair = blind->pairs+2*i*s;
+            kernel->mul(mont, pair+s, q, prefix+(i-1)*s, t);
+            kernel->mul(mont, q, q, r+i*s, t);
+        }
+        memcpy(blind->pairs+s, q, s*sizeof(uint32_t));
+        // pow_run() takes over q's space
+        for (size_t i = 0; i<RSA_BLIND_PAIRS; i++)
+        {
+            memcpy(pow->table+s, r+i*s, s*sizeof(uint32_t));
+            pow_run(pow);
+            memcpy(blind->pairs+2*i*s, pow->acc, s*sizeof(uint32_t));
+        }
+        blind->uses = 0;
+    }
+    bigint_free(a);
+    bigint_free(inv);
+    return result;
+}
+
+static int blind_init(rsa_ctx_t *ctx, const rsa_key_t *key)
+{
+    // holds the generator key, so it goes through the bigint heap hooks
+    rsa_blind_t *blind = bigint_mem_alloc(sizeof(rsa_blind_t));
+    memset(blind, 0, sizeof(rsa_blind_t));
+    ctx->blind = blind;
+    bigint_t *e = bigint_alloc();
+    int result = public_exp(key, e) || rnd_init(&blind->rnd) ||
+        pow_init(&blind->pow, e, key->n, &key->mont[0]);
+    bigint_free(e);
+    if (result)
+        return 1;
+    size_t s = blind->pow.mont.size;
+    blind->pairs = bigint_mem_alloc(4*RSA_BLIND_PAIRS*s*sizeof(uint32_t));
+    blind->work = blind->pairs+2*RSA_BLIND_PAIRS*s;
+    return blind_generate(blind);
+}
+
+static void blind_free(rsa_blind_t *blind)
+{
+    pow_free(&blind->pow);
+    bigint_mem_free(blind->pairs);
+    memset(&blind->rnd, 0, sizeof(blind->rnd));
+    bigint_mem_free(blind);
+}
+
+// accounts for 'count' blocks about to be blinded
+static void blind_begin(rsa_blind_t *blind, size_t count)
+{
+    if (blind->uses>=RSA_BLIND_PAIRS*RSA_BLIND_REFRESH)
+        blind_generate(blind);
+    blind->uses += count;
+}
+
+// x = x*r^e mod n, x a block of n's size
+static void blind_in(rsa_blind_t *blind, uint32_t *x)
+{
+    rsa_pow_t *pow = &blind->pow;
+    uint32_t *pair = blind->pairs+2*blind->in*pow->mont.size;
+    pow->kernel->mul(&pow->mont, x, x, pair, pow->scratch);
+    blind->in = (blind->in+1)%RSA_BLIND_PAIRS;
+}
+
+// x = x*r^-1 mod n with the pair of the matching blind_in(), which then
+// moves on to r^2
+static void blind_out(rsa_blind_t *blind, uint32_t *x)
+{
+    rsa_pow_t *pow = &blind->pow;
+    bigint_mont_t *mont = &pow->mont;
+    size_t s = mont->size;
+    uint32_t *pair = blind->pairs+2*blind->out*s;
+    pow->kernel->mul(mont, x, x, pair+s, pow->scratch);
+    pow->kernel->sqr(mont, pair, pair, pow->scratch);
+    pow->kernel->sqr(mont, pair+s, pair+s, pow->scratch);
+    blind->out = (blind->out+1)%RSA_BLIND_PAIRS;
+}
+
+int rsa_ctx_init_key(rsa_ctx_t *ctx, const rsa_key_t *key)
+{
+    memset(ctx, 0, sizeof(rsa_ctx_t));
+    size_t s = (bit_length(key->n)+31)/32;
+    if (!s || key->prime_count==1 || key->prime_count>RSA_MAX_PRIMES)
+        return 1;
+    ctx->block_size = s*sizeof(uint32_t);
+    ctx->mb = bigint_mb_select(cpu_features());
+    if (!key->prime_count)
+        return pow_init(&ctx->pow, key->exp, key->n, &key->mont[0]);
+    ctx->prime_count = key->prime_count;
+    ctx->crt_acc = bigint_mem_alloc((s+1)*sizeof(uint32_t));
+    memset(ctx->crt_acc, 0, (s+1)*sizeof(uint32_t));
+    bigint_t *prod = bigint_alloc();
+    bigint_t *next = bigint_alloc();
+    bigint_copy(&small_bigint[1], prod);
+    for (size_t i = 0; i<ctx->prime_count; i++)
+    {
+        rsa_pow_t *pow = &ctx->crt[i];
+        if (pow_init(pow, key->prime_exps[i], key->primes[i],
+            &key->mont[1+i]))
+        {
+            bigint_free(prod);
+            bigint_free(next);
+            rsa_ctx_free(ctx);
+            return 1;
+        }
+        size_t ps = pow->mont.size;
+        if (i)
+        {
+            // both padded to the limb counts Garner's step works with
+            size_t prod_size = min(prod->size, s);
+            ctx->crt_coeff[i] = bigint_mem_alloc(ps*sizeof(uint32_t));
+            memset(ctx->crt_coeff[i], 0, ps*sizeof(uint32_t));
+            memcpy(ctx->crt_coeff[i], key->coeffs[i]->data,
+                min(key->coeffs[i]->size, ps)*sizeof(uint32_t));
+            ctx->crt_prod[i] = bigint_mem_alloc(prod_size*sizeof(uint32_t));
+            memcpy(ctx->crt_prod[i], prod->data,
+                prod_size*sizeof(uint32_t));
+            ctx->crt_prod_size[i] = prod_size;
+        }
+        bigint_mul(next, prod, key->primes[i]);
+        bigint_copy(next, prod);
+    }
+    bigint_free(prod);
+    bigint_free(next);
+    if (blind_init(ctx, key))
+    {
+        rsa_ctx_free(ctx);
+        return 1;
+    }
+    return 0;
+}
+
+int rsa_ctx_init(rsa_ctx_t *ctx, bigint_t *exp, bigint_t *n)
+{
+    rsa_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.n = n;
+    key.exp = exp;
+    return rsa_ctx_init_key(ctx, &key);
+}
+
+void rsa_ctx_free(rsa_ctx_t *ctx)
+{
+    rsa_ctx_set_concurrent(ctx, 0);
+    pow_free(&ctx->pow);
+    for (size_t i = 0; i<ctx->prime_count; i++)
+    {
+        pow_free(&ctx->crt[i]);
+        bigint_mem_free(ctx->crt_coeff[i]);
+        bigint_mem_free(ctx->crt_prod[i]);
+    }
+    bigint_mem_free(ctx->crt_acc);
+    if (ctx->blind)
+        blind_free(ctx->blind);
+    memset(ctx, 0, sizeof(rsa_ctx_t));
+}
+
+// Garner's recombination of the per-prime results in crt[i].acc
+// (Montgomery form) into the block at dst:
+// m = m_0; m += (r_0*...*r_{i-1})*((m_i-m)*coeff_i mod r_i) for i > 0
+static void crt_combine(rsa_ctx_t *ctx, uint8_t *dst)
+{
+    size_t s = ctx->block_size/sizeof(uint32_t);
+    uint32_t *m = ctx->crt_acc;
+    rsa_pow_t *pow = &ctx->crt[0];
+    memset(m, 0, (s+1)*sizeof(uint32_t));
+    memset(pow->tmp, 0, pow->mont.size*sizeof(uint32_t));
+    pow->tmp[0] = 1;
+    pow->kernel->mul(&pow->mont, m, pow->acc, pow->tmp, pow->scratch);
+    for (size_t i = 1; i<ctx->prime_count; i++)
+    {
+        pow = &ctx->crt[i];
+        bigint_mont_t *mont = &pow->mont;
+        uint32_t *h = pow->tmp;
+        bigint_mont_from_wide(mont, h, m, s, pow->scratch);
+        pow->kernel->sub(mont, h, pow->acc, h);
+        // Montgomery form times a plain coefficient gives a plain result
+        pow->kernel->mul(mont, h, h, ctx->crt_coeff[i], pow->scratch);
+        mul_add(m, s+1, ctx->crt_prod[i], ctx->crt_prod_size[i], h,
+            mont->size);
+    }
+    blind_out(ctx->blind, m);
+    memcpy(dst, m, ctx->block_size);
+}
+
+// exponentiations of crt[first, last) for the block in crt_acc
+static void crt_run(rsa_ctx_t *ctx, size_t first, size_t last)
+{
+    size_t s = ctx->block_size/sizeof(uint32_t);
+    for (size_t i = first; i<last; i++)
+    {
+        rsa_pow_t *pow = &ctx->crt[i];
+        bigint_mont_from_wide(&pow->mont, pow->table+pow->mont.size,
+            ctx->crt_acc, s, pow->scratch);
+        pow_run(pow);
+    }
+}
+
+// Every prime has its own rsa_pow_t, so the helper and the caller share
+// nothing but the input in crt_acc until crt_combine().
+struct rsa_helper
+{
+    rsa_ctx_t *ctx;
+    size_t first; // the helper runs crt[first, prime_count)
+    thread_t thread;
+    mutex_t lock;
+    cond_t start;
+    cond_t done;
+    int busy; // a block was handed over and isn't finished yet
+    int quit;
+};
+
+static void helper_proc(void *arg)
+{
+    rsa_helper_t *helper = arg;
+    mutex_lock(&helper->lock);
+    while (1)
+    {
+        while (!helper->busy && !helper->quit)
+            cond_wait(&helper->start, &helper->lock);
+        if (helper->quit)
+            break;
+        mutex_unlock(&helper->lock);
+        crt_run(helper->ctx, helper->first, helper->ctx->prime_count);
+        mutex_lock(&helper->lock);
+        helper->busy = 0;
+        cond_signal(&helper->done);
+    }
+    mutex_unlock(&helper->lock);
+}
+
+int rsa_ctx_set_concurrent(rsa_ctx_t *ctx, int enable)
+{
+    rsa_helper_t *helper = ctx->helper;
+    if (enable && !helper && ctx->prime_count)
+    {
+        helper = malloc(sizeof(rsa_helper_t));
+        helper->ctx = ctx;
+        helper->first = (ctx->prime_count+1)/2;
+        helper->busy = helper->quit = 0;
+        mutex_init(&helper->lock);
+        cond_init(&helper->start);
+        cond_init(&helper->done);
+        if (thread_create(&helper->thread, helper_proc, helper))
+        {
+            cond_destroy(&helper->done);
+            cond_destroy(&helper->start);
+            mutex_destroy(&helper->lock);
+            free(helper);
+            return 1;
+        }
+        ctx->helper = helper;
+    }
+    else if (!enable && helper)
+    {
+        mutex_lock(&helper->lock);
+        helper->quit = 1;
+        cond_signal(&helper->start);
+        mutex_unlock(&helper->lock);
+        thread_join(helper->thread);
+        cond_destroy(&helper->done);
+        cond_destroy(&helper->start);
+        mutex_destroy(&helper->lock);
+        free(helper);
+        ctx->helper = NULL;
+    }
+    return 0;
+}
+
+static void transform_crt(rsa_ctx_t *ctx, const uint8_t *src, uint8_t *dst)
+{
+    // XXX: valid for little endian only!
+    memcpy(ctx->crt_acc, src, ctx->block_size);
+    blind_begin(ctx->blind, 1);
+    blind_in(ctx->blind, ctx->crt_acc);
+    rsa_helper_t *helper = ctx->helper;
+    if (!helper)
+        crt_run(ctx, 0, ctx->prime_count);
+    else
+    {
+        mutex_lock(&helper->lock);
+        helper->busy = 1;
+        cond_signal(&helper->start);
+        mutex_unlock(&helper->lock);
+        crt_run(ctx, 0, helper->first);
+        mutex_lock(&helper->lock);
+        while (helper->busy)
+            cond_wait(&helper->done, &helper->lock);
+        mutex_unlock(&helper->lock);
+    }
+    crt_combine(ctx, dst);
+}
+
+void rsa_transform_ctx(rsa_ctx_t *ctx, const uint8_t *src, uint8_t *dst)
+{
+    if (ctx->prime_count)
+    {
+        transform_crt(ctx, src, dst);
+        return;
+    }
+    rsa_pow_t *pow = &ctx->pow;
+    bigint_mont_t *mont = &pow->mont;
+    size_t s = mont->size;
+    uint32_t *acc = pow->acc;
+    uint32_t *t = pow->scratch;
+    // XXX: valid for little endian only!
+    memcpy(pow->tmp, src, ctx->block_size);
+    pow->kernel->mul(mont, pow->table+s, pow->tmp, mont->rr, t);
+    pow_run(pow);
+    // leave Montgomery form: acc = acc*1/R
+    memset(pow->tmp, 0, s*sizeof(uint32_t));
+    pow->tmp[0] = 1;
+    pow->kernel->mul(mont, acc, acc, pow->tmp, t);
+    memcpy(dst, acc, ctx->block_size);
+}
+
+// Same exponentiation as rsa_transform_ctx() over 'lanes' blocks at once;
+// lanes past 'count' are filled with zeros and discarded.
+static void transform_lanes(rsa_ctx_t *ctx, const uint8_t *src, uint8_t *dst,
+    size_t count)
+{
+    rsa_pow_t *pow = &ctx->pow;
+    bigint_mont_t *mont = &pow->mont;
+    bigint_mb_mul_t mul = ctx->mb->mul;
+    size_t s = mont->size;
+    size_t lanes = ctx->mb->lanes;
+    size_t slots = s*lanes;
+    uint64_t *acc = pow->mb_acc;
+    uint64_t *t = pow->mb_scratch;
+    // XXX: valid for little endian only!
+    memset(pow->mb_tmp, 0, slots*sizeof(uint64_t));
+    for (size_t l = 0; l<count; l++)
+    {
+        const uint8_t *block = src+l*ctx->block_size;
+        for (size_t j = 0; j<s; j++)
+        {
+            uint32_t limb;
+            memcpy(&limb, block+j*sizeof(uint32_t), sizeof(uint32_t));
+            pow->mb_tmp[j*lanes+l] = limb;
+        }
+    }
+    mul(mont, pow->mb_table+slots, pow->mb_tmp, pow->mb_rr, t);
+    pow_run_lanes(pow, mul, lanes);
+    mul(mont, acc, acc, pow->mb_unit, t);
+    for (size_t l = 0; l<count; l++)
+    {
+        uint8_t *block = dst+l*ctx->block_size;
+        for (size_t j = 0; j<s; j++)
+        {
+            uint32_t limb = (uint32_t)acc[j*lanes+l];
+            memcpy(block+j*sizeof(uint32_t), &limb, sizeof(uint32_t));
+        }
+    }
+}
+
+// CRT counterpart of transform_lanes(): reduction and recombination are
+// per block, the per-prime exponentiations run on all lanes at once.
+static void transform_crt_lanes(rsa_ctx_t *ctx, const uint8_t *src,
+    uint8_t *dst, size_t count)
+{
+    bigint_mb_mul_t mul = ctx->mb->mul;
+    size_t s = ctx->block_size/sizeof(uint32_t);
+    size_t lanes = ctx->mb->lanes;
+    for (size_t i = 0; i<ctx->prime_count; i++)
+    {
+        rsa_pow_t *pow = &ctx->crt[i];
+        size_t slots = pow->mont.size*lanes;
+        memset(pow->mb_table+slots, 0, slots*sizeof(uint64_t));
+    }
+    blind_begin(ctx->blind, count);
+    for (size_t l = 0; l<count; l++)
+    {
+        // XXX: valid for little endian only!
+        memcpy(ctx->crt_acc, src+l*ctx->block_size, ctx->block_size);
+        blind_in(ctx->blind, ctx->crt_acc);
+        for (size_t i = 0; i<ctx->prime_count; i++)
+        {
+            rsa_pow_t *pow = &ctx->crt[i];
+            size_t ps = pow->mont.size;
+            uint64_t *base = pow->mb_table+ps*lanes;
+            bigint_mont_from_wide(&pow->mont, pow->tmp, ctx->crt_acc, s,
+                pow->scratch);
+            for (size_t j = 0; j<ps; j++)
+                base[j*lanes+l] = pow->tmp[j];
+        }
+    }
+    for (size_t i = 0; i<ctx->prime_count; i++)
+        pow_run_lanes(&ctx->crt[i], mul, lanes);
+    for (size_t l = 0; l<count; l++)
+    {
+        for (size_t i = 0; i<ctx->prime_count; i++)
+        {
+            rsa_pow_t *pow = &ctx->crt[i];
+            for (size_t j = 0; j<pow->mont.size; j++)
+                pow->acc[j] = (uint32_t)pow->mb_acc[j*lanes+l];
+        }
+        crt_combine(ctx, dst+l*ctx->block_size);
+    }
+}
+
+void rsa_transform_batch(rsa_ctx_t *ctx, const uint8_t *src, uint8_t *dst,
+    size_t count)
+{
+    size_t lanes = ctx->mb->lanes;
+    if (count>1 && ctx->prime_count)
+    {
+        for (size_t i = 0; i<ctx->prime_count; i++)
+            pow_init_lanes(&ctx->crt[i], lanes);
+    }
+    else if (count>1)
+        pow_init_lanes(&ctx->pow, lanes);
+    while (count>1)
+    {
+        size_t blocks = min(count, lanes);
+        if (ctx->prime_count)
+            transform_crt_lanes(ctx, src, dst, blocks);
+        else
+            transform_lanes(ctx, src, dst, blocks);
+        src += blocks*ctx->block_size;
+        dst += blocks*ctx->block_size;
+        count -= blocks;
+    }
+    // a lone block is cheaper on the single-buffer path
+    if (count)
+        rsa_transform_ctx(ctx, src, dst);
 }
 
 void rsa_transform(uint8_t *src, size_t src_size, uint8_t *dst,
     bigint_t *exp, bigint_t *n)
 {
+    // whole blocks under an odd modulus take the Montgomery path
+    rsa_ctx_t ctx;
+    size_t block_size = (bit_length(n)+31)/32*sizeof(uint32_t);
+    if (src_size==block_size && !rsa_ctx_init(&ctx, exp, n))
+    {
+        rsa_transform_ctx(&ctx, src, dst);
+        rsa_ctx_free(&ctx);
+        return;
+    }
     bigint_t *m = bigint_alloc();
     bigint_load(m, src, src_size);
     bigint_t *result = bigint_alloc();
     bigint_modpow(m, exp, n, result);
     assert(bigint_get_size(result)<=src_size);
+    memset(dst, 0, src_size);
     bigint_save(result, dst);
     bigint_free(result);
     bigint_free(m);
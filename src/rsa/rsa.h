@@ -2,12 +2,134 @@
 #include "config.h"
 #include "common.h"
 #include "bigint.h"
+#include "bigint_mb.h"
+#include "bigint_fixed.h"
+#include "rnd.h"
+
+// most primes a key can be built from, see rsa_key_t
+#define RSA_MAX_PRIMES 4
+// blinding factor pairs per private context, one per lane so a batch
+// never uses a pair twice, and uses of each pair before all are replaced
+#define RSA_BLIND_PAIRS BIGINT_MB_MAX_LANES
+#define RSA_BLIND_REFRESH 32
+
+// A key with optional private CRT components and cached Montgomery
+// constants. The constants may live in a mapped key file (see
+// rsa_key_map()), so they are read-only once loaded.
+typedef struct
+{
+    bigint_t *n;
+    bigint_t *exp;
+    // 0 for keys without CRT components, else n = r_0*...*r_{k-1}
+    size_t prime_count;
+    bigint_t *primes[RSA_MAX_PRIMES];
+    bigint_t *prime_exps[RSA_MAX_PRIMES]; // exp mod (r_i-1)
+    bigint_t *coeffs[RSA_MAX_PRIMES]; // (r_0*...*r_{i-1})^-1 mod r_i, [0] unused
+    // cached Montgomery constants, [0] for n and [1+i] for primes[i];
+    // size is 0 where the key file carried none
+    bigint_mont_t mont[RSA_MAX_PRIMES+1];
+    // the mapped key file backing 'mont', if any
+    void *mapping;
+    size_t mapping_size;
+} rsa_key_t;
 
 // generates 3 parameters:
 // e - public exponent, d - secret exponent, n - modulus
 // keysize must be a multiple of 32
-void rsa_generate_keypair(bigint_t *e, bigint_t *d, bigint_t *n,
+void rsa_generate_keypair(rnd_t *rnd, bigint_t *e, bigint_t *d, bigint_t *n,
     size_t keysize);
+// Same as rsa_generate_keypair() filling two zeroed keys; the private one
+// also gets its CRT components. 'prime_count' from 2 to RSA_MAX_PRIMES
+// picks two-prime or multi-prime RSA (RFC 8017): the modulus is split
+// into that many smaller primes and private operations run one
+// exponentiation per prime. Release the keys with rsa_key_free().
+void rsa_generate_key(rnd_t *rnd, size_t keysize, size_t prime_count,
+    rsa_key_t *public_key, rsa_key_t *private_key);
 
+// dst = src^exp mod n, both 'src_size' bytes. Any modulus and length
+// work; whole blocks under an odd modulus are fastest.
 void rsa_transform(uint8_t *src, size_t src_size, uint8_t *dst,
     bigint_t *exp, bigint_t *n);
+
+// Fixed-window exponentiation by one exponent modulo one odd modulus:
+// Montgomery constants, the exponent recoded into fixed-size windows and
+// all scratch space.
+typedef struct
+{
+    bigint_mont_t mont;
+    // single-block Montgomery kernels, fixed-width when the size allows
+    const bigint_fixed_kernel_t *kernel;
+    size_t window; // exponent window width in bits
+    size_t digit_count;
+    uint8_t *digits; // exponent windows, most significant first
+    size_t mul_count; // products per exponentiation, for stats.h
+    uint32_t *table; // base^i for i in [0, 2^window), Montgomery form
+    uint32_t *acc;
+    uint32_t *tmp;
+    uint32_t *scratch;
+    // multi-buffer state, every array is limb-interleaved across lanes;
+    // NULL until the first rsa_transform_batch() call
+    uint64_t *mb_table;
+    uint64_t *mb_acc;
+    uint64_t *mb_tmp;
+    uint64_t *mb_scratch;
+    uint64_t *mb_rr; // R^2 mod n broadcast to every lane
+    uint64_t *mb_unit; // plain 1 in every lane, used to leave Montgomery form
+} rsa_pow_t;
+
+typedef struct rsa_helper rsa_helper_t;
+typedef struct rsa_blind rsa_blind_t;
+
+// Per-key state for transforming many blocks with the same key. Built
+// once by rsa_ctx_init(), after that rsa_transform_ctx() does no
+// allocation or setup but for a batch of fresh blinding factors every
+// few hundred blocks; the first rsa_transform_batch() call adds the
+// multi-buffer tables. Keys with CRT components run one half-size (or
+// smaller) exponentiation per prime and recombine with Garner's formula.
+//
+// Those are private keys, and every block they transform is blinded: c
+// is multiplied by r^e before the exponentiation and the result by r^-1
+// after it, so the exponentiations never see c itself. Each pair is
+// squared after use, which keeps it valid at the cost of two products,
+// and replaced along with the others every RSA_BLIND_REFRESH uses by
+// factors made with a single modular inverse (Montgomery's trick).
+// Private keys without CRT components, which includes every key in the
+// original format, carry no public exponent to blind with: their blocks
+// are exponentiated unblinded.
+typedef struct
+{
+    size_t block_size; // bytes, equals the normalized modulus size
+    // kernel for rsa_transform_batch(), runs 'mb->lanes' blocks at once
+    const bigint_mb_kernel_t *mb;
+    rsa_pow_t pow; // whole modulus, unused when prime_count is set
+    size_t prime_count;
+    rsa_pow_t crt[RSA_MAX_PRIMES];
+    uint32_t *crt_coeff[RSA_MAX_PRIMES]; // padded to the prime size
+    uint32_t *crt_prod[RSA_MAX_PRIMES]; // r_0*...*r_{i-1}, [0] unused
+    size_t crt_prod_size[RSA_MAX_PRIMES];
+    uint32_t *crt_acc; // block limbs+1
+    rsa_helper_t *helper; // see rsa_ctx_set_concurrent()
+    rsa_blind_t *blind; // keys with CRT components only
+} rsa_ctx_t;
+
+// returns nonzero if 'n' is not a valid (odd) modulus
+int rsa_ctx_init(rsa_ctx_t *ctx, bigint_t *exp, bigint_t *n);
+// Same for a whole key, using its cached constants and CRT components.
+// returns nonzero if the key is malformed or there is no random source
+// for the blinding factors
+int rsa_ctx_init_key(rsa_ctx_t *ctx, const rsa_key_t *key);
+void rsa_ctx_free(rsa_ctx_t *ctx);
+// Latency mode for single private blocks: a helper thread, started here
+// and parked between calls, runs half of the CRT exponentiations of each
+// rsa_transform_ctx() while the caller runs the other half. It only pays
+// off with a spare core. No-op for keys without CRT components; the ctx
+// must stay at the same address while it is on.
+// returns nonzero if the helper thread can't be started
+int rsa_ctx_set_concurrent(rsa_ctx_t *ctx, int enable);
+// src and dst are 'ctx->block_size' bytes long and may overlap
+void rsa_transform_ctx(rsa_ctx_t *ctx, const uint8_t *src, uint8_t *dst);
+// Transform 'count' consecutive blocks, running up to 'ctx->mb->lanes' of
+// them at once on independent SIMD lanes. Same contract per block as
+// rsa_transform_ctx().
+void rsa_transform_batch(rsa_ctx_t *ctx, const uint8_t *src, uint8_t *dst,
+    size_t count);
@@ -1,6 +1,16 @@
 #include "config.h"
 #include "rsa_util.h"
+#include "crc32.h"
 #include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 int rsa_load_key(FILE *f, bigint_t *n, bigint_t *exp)
 {
@@ -34,6 +44,432 @@ void rsa_save_key(FILE *f, bigint_t *n, bigint_t *exp)
     free(buf);
 }
 
+int rsa_parse_key(const uint8_t *data, size_t size, bigint_t *n,
+    bigint_t *exp)
+{
+    uint32_t n_size, exp_size;
+    // read n_size, n, exp_size, exp
+    if (size<sizeof(uint32_t))
+        return 1;
+    memcpy(&n_size, data, sizeof(uint32_t));
+    data += sizeof(uint32_t);
+    size -= sizeof(uint32_t);
+    if (!n_size || n_size%4 || n_size>size ||
+        size-n_size<sizeof(uint32_t))
+    {
+        return 1;
+    }
+    bigint_load(n, (uint8_t *)data, n_size);
+    data += n_size;
+    size -= n_size;
+    memcpy(&exp_size, data, sizeof(uint32_t));
+    data += sizeof(uint32_t);
+    size -= sizeof(uint32_t);
+    if (!exp_size || exp_size%4 || exp_size>size)
+        return 1;
+    bigint_load(exp, (uint8_t *)data, exp_size);
+    return 0;
+}
+
+size_t rsa_serialize_key(bigint_t *n, bigint_t *exp, uint8_t *buf)
+{
+    uint32_t n_size = (uint32_t)bigint_get_size(n);
+    uint32_t exp_size = (uint32_t)bigint_get_size(exp);
+    if (buf)
+    {
+        // write n_size, n, exp_size, exp
+        memcpy(buf, &n_size, sizeof(uint32_t));
+        bigint_save(n, buf+sizeof(uint32_t));
+        buf += sizeof(uint32_t)+n_size;
+        memcpy(buf, &exp_size, sizeof(uint32_t));
+        bigint_save(exp, buf+sizeof(uint32_t));
+    }
+    return 2*sizeof(uint32_t)+n_size+exp_size;
+}
+
+static const uint8_t key_magic[4] = {'R', 'S', 'A', 'K'};
+
+#define KEY_HEADER_SIZE 64
+#define KEY_ENTRY_SIZE 16
+#define KEY_ALIGN 64
+#define KEY_MAX_SECTIONS (2+6*RSA_MAX_PRIMES+3)
+
+// Section ids. Per-prime ones are offset by the prime index, Montgomery
+// ones by 0 for n and 1+i for primes[i].
+enum
+{
+    KEY_N = 0x01,
+    KEY_EXP = 0x02,
+    KEY_PRIME = 0x10,
+    KEY_PRIME_EXP = 0x20,
+    KEY_COEFF = 0x30,
+    KEY_MONT_RR = 0x40,
+    KEY_MONT_ONE = 0x50,
+    KEY_MONT_N0INV = 0x60,
+    KEY_ID_LIMIT = 0x70
+};
+
+// header: magic, u16 version, u16 reserved, u32 section count,
+// u32 crc-32 of the file with this field zeroed, u64 file size, zeros;
+// section table entry: u32 id, u32 limb count, u64 offset
+
+typedef struct
+{
+    uint32_t id;
+    const uint32_t *limbs;
+    size_t count;
+} key_section_t;
+
+static size_t key_align(size_t offset)
+{ return (offset+KEY_ALIGN-1)/KEY_ALIGN*KEY_ALIGN; }
+
+static uint32_t key_checksum(const uint8_t *data, size_t size)
+{
+    static const uint8_t zero[4] = {0};
+    uint32_t crc = crc32_update(0, data, 12);
+    crc = crc32_update(crc, zero, sizeof(zero));
+    return crc32_update(crc, data+16, size-16);
+}
+
+// limbs without leading zeros, at least one
+static size_t limb_count(const bigint_t *b)
+{
+    size_t count = b->size;
+    while (count>1 && !b->data[count-1])
+        count--;
+    return count;
+}
+
+// Numbers are always copied, even from a mapped key: bigint_t owns and
+// may grow its limbs, the read-only mapping can't be handed to it.
+static bigint_t *key_number(const uint8_t *limbs, size_t count)
+{
+    bigint_t *b = bigint_alloc();
+    // XXX: valid for little endian only!
+    bigint_load(b, (uint8_t *)limbs, count*sizeof(uint32_t));
+    return b;
+}
+
+static int parse_v2(const uint8_t *data, size_t size, rsa_key_t *key,
+    int borrow)
+{
+    const uint8_t *sections[KEY_ID_LIMIT] = {0};
+    size_t counts[KEY_ID_LIMIT] = {0};
+    if (size<KEY_HEADER_SIZE || data[4]!=RSA_KEY_VERSION || data[5])
+        return 1;
+    uint32_t section_count = load32_le(data+8);
+    if (load64_le(data+16)!=size ||
+        section_count>(size-KEY_HEADER_SIZE)/KEY_ENTRY_SIZE ||
+        load32_le(data+12)!=key_checksum(data, size))
+    {
+        return 1;
+    }
+    for (uint32_t i = 0; i<section_count; i++)
+    {
+        const uint8_t *entry = data+KEY_HEADER_SIZE+i*KEY_ENTRY_SIZE;
+        uint32_t id = load32_le(entry);
+        uint32_t count = load32_le(entry+4);
+        uint64_t offset = load64_le(entry+8);
+        if (id>=KEY_ID_LIMIT || sections[id] || !count ||
+            offset%KEY_ALIGN || offset>size ||
+            count>(size-offset)/sizeof(uint32_t))
+        {
+            return 1;
+        }
+        sections[id] = data+offset;
+        counts[id] = count;
+    }
+    if (!sections[KEY_N] || !sections[KEY_EXP])
+        return 1;
+    size_t prime_count = 0;
+    while (prime_count<RSA_MAX_PRIMES && sections[KEY_PRIME+prime_count])
+        prime_count++;
+    // more primes than this build supports
+    if (prime_count==1 || sections[KEY_PRIME+prime_count])
+        return 1;
+    for (size_t i = 0; i<prime_count; i++)
+    {
+        if (!sections[KEY_PRIME_EXP+i] || (i && !sections[KEY_COEFF+i]))
+            return 1;
+    }
+    // Montgomery constants come as a complete set matching their modulus.
+    // The checksum doesn't tie n0inv to it, check that it inverts the odd
+    // modulus: n0inv*n = -1 mod 2^32
+    for (size_t j = 0; j<=prime_count; j++)
+    {
+        uint32_t mod_id = j ? KEY_PRIME+(uint32_t)j-1 : KEY_N;
+        size_t s = counts[mod_id];
+        if (!sections[KEY_MONT_RR+j] && !sections[KEY_MONT_ONE+j] &&
+            !sections[KEY_MONT_N0INV+j])
+        {
+            continue;
+        }
+        if (counts[KEY_MONT_RR+j]!=s || counts[KEY_MONT_ONE+j]!=s ||
+            counts[KEY_MONT_N0INV+j]!=1 ||
+            !load32_le(sections[mod_id]+(s-1)*sizeof(uint32_t)) ||
+            load32_le(sections[mod_id])*
+            load32_le(sections[KEY_MONT_N0INV+j])!=UINT32_MAX)
+        {
+            return 1;
+        }
+    }
+    memset(key, 0, sizeof(rsa_key_t));
+    key->n = key_number(sections[KEY_N], counts[KEY_N]);
+    key->exp = key_number(sections[KEY_EXP], counts[KEY_EXP]);
+    key->prime_count = prime_count;
+    for (size_t i = 0; i<prime_count; i++)
+    {
+        key->primes[i] = key_number(sections[KEY_PRIME+i],
+            counts[KEY_PRIME+i]);
+        key->prime_exps[i] = key_number(sections[KEY_PRIME_EXP+i],
+            counts[KEY_PRIME_EXP+i]);
+        if (i)
+        {
+            key->coeffs[i] = key_number(sections[KEY_COEFF+i],
+                counts[KEY_COEFF+i]);
+        }
+    }
+    for (size_t j = 0; j<=prime_count; j++)
+    {
+        if (!sections[KEY_MONT_RR+j])
+            continue;
+        bigint_mont_t *mont = &key->mont[j];
+        size_t s = counts[KEY_MONT_RR+j];
+        const uint8_t *n = sections[j ? KEY_PRIME+j-1 : KEY_N];
+        mont->size = s;
+        mont->n0inv = load32_le(sections[KEY_MONT_N0INV+j]);
+        mont->borrowed = borrow;
+        if (borrow)
+        {
+            mont->n = (uint32_t *)n;
+            mont->rr = (uint32_t *)sections[KEY_MONT_RR+j];
+            mont->one = (uint32_t *)sections[KEY_MONT_ONE+j];
+        }
+        else
+        {
+            // same single allocation as bigint_mont_init()
+            mont->n = bigint_mem_alloc(3*s*sizeof(uint32_t));
+            mont->rr = mont->n+s;
+            mont->one = mont->rr+s;
+            // XXX: valid for little endian only!
+            memcpy(mont->n, n, s*sizeof(uint32_t));
+            memcpy(mont->rr, sections[KEY_MONT_RR+j], s*sizeof(uint32_t));
+            memcpy(mont->one, sections[KEY_MONT_ONE+j],
+                s*sizeof(uint32_t));
+        }
+    }
+    return 0;
+}
+
+int rsa_key_parse(const uint8_t *data, size_t size, rsa_key_t *key)
+{
+    memset(key, 0, sizeof(rsa_key_t));
+    if (size>=sizeof(key_magic) && !memcmp(data, key_magic, sizeof(key_magic)))
+        return parse_v2(data, size, key, 0);
+    key->n = bigint_alloc();
+    key->exp = bigint_alloc();
+    if (rsa_parse_key(data, size, key->n, key->exp))
+    {
+        rsa_key_free(key);
+        return 1;
+    }
+    return 0;
+}
+
+int rsa_key_read(FILE *f, rsa_key_t *key)
+{
+    size_t size = 0, capacity = 4096;
+    uint8_t *buf = malloc(capacity);
+    while (1)
+    {
+        size += fread(buf+size, 1, capacity-size, f);
+        if (size<capacity)
+            break;
+        capacity *= 2;
+        buf = realloc(buf, capacity);
+    }
+    int result = ferror(f) || rsa_key_parse(buf, size, key);
+    free(buf);
+    return result;
+}
+
+static void *key_map_file(const char *path, size_t *size)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file==INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER file_size;
+    void *view = NULL;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart &&
+        (uint64_t)file_size.QuadPart<=SIZE_MAX)
+    {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0,
+            NULL);
+        if (mapping)
+        {
+            // the view keeps the mapping alive after both handles close
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        *size = (size_t)file_size.QuadPart;
+    }
+    CloseHandle(file);
+    return view;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd<0)
+        return NULL;
+    struct stat st;
+    void *view = NULL;
+    if (!fstat(fd, &st) && st.st_size>0 && (uint64_t)st.st_size<=SIZE_MAX)
+    {
+        view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (view==MAP_FAILED)
+            view = NULL;
+        *size = (size_t)st.st_size;
+    }
+    close(fd);
+    return view;
+#endif
+}
+
+static void key_unmap_file(void *view, size_t size)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+#else
+    munmap(view, size);
+#endif
+}
+
+int rsa_key_map(const char *path, rsa_key_t *key)
+{
+    memset(key, 0, sizeof(rsa_key_t));
+    size_t size = 0;
+    uint8_t *view = key_map_file(path, &size);
+    if (!view)
+        return 1;
+    if (size<sizeof(key_magic) || memcmp(view, key_magic, sizeof(key_magic)))
+    {
+        // legacy keys are tiny, just copy them out
+        int result = rsa_key_parse(view, size, key);
+        key_unmap_file(view, size);
+        return result;
+    }
+    if (parse_v2(view, size, key, 1))
+    {
+        key_unmap_file(view, size);
+        return 1;
+    }
+    key->mapping = view;
+    key->mapping_size = size;
+    return 0;
+}
+
+size_t rsa_key_serialize(const rsa_key_t *key, uint8_t *buf)
+{
+    key_section_t sections[KEY_MAX_SECTIONS];
+    bigint_mont_t computed[RSA_MAX_PRIMES+1];
+    size_t count = 0;
+    memset(computed, 0, sizeof(computed));
+    sections[count++] = (key_section_t){KEY_N, key->n->data,
+        limb_count(key->n)};
+    sections[count++] = (key_section_t){KEY_EXP, key->exp->data,
+        limb_count(key->exp)};
+    for (uint32_t i = 0; i<key->prime_count; i++)
+    {
+        sections[count++] = (key_section_t){KEY_PRIME+i,
+            key->primes[i]->data, limb_count(key->primes[i])};
+        sections[count++] = (key_section_t){KEY_PRIME_EXP+i,
+            key->prime_exps[i]->data, limb_count(key->prime_exps[i])};
+        if (i)
+        {
+            sections[count++] = (key_section_t){KEY_COEFF+i,
+                key->coeffs[i]->data, limb_count(key->coeffs[i])};
+        }
+    }
+    // a CRT key never exponentiates modulo n, skip its constants
+    for (uint32_t j = key->prime_count ? 1 : 0; j<=key->prime_count; j++)
+    {
+        const bigint_mont_t *mont = &key->mont[j];
+        if (!mont->size)
+        {
+            bigint_t *mod = j ? key->primes[j-1] : key->n;
+            if (bigint_mont_init(&computed[j], mod))
+                continue;
+            mont = &computed[j];
+        }
+        sections[count++] = (key_section_t){KEY_MONT_RR+j, mont->rr,
+            mont->size};
+        sections[count++] = (key_section_t){KEY_MONT_ONE+j, mont->one,
+            mont->size};
+        sections[count++] = (key_section_t){KEY_MONT_N0INV+j, &mont->n0inv,
+            1};
+    }
+    size_t size = key_align(KEY_HEADER_SIZE+count*KEY_ENTRY_SIZE);
+    if (buf)
+        memset(buf, 0, size);
+    for (size_t i = 0; i<count; i++)
+    {
+        size_t bytes = sections[i].count*sizeof(uint32_t);
+        if (buf)
+        {
+            uint8_t *entry = buf+KEY_HEADER_SIZE+i*KEY_ENTRY_SIZE;
+            store32_le(entry, sections[i].id);
+            store32_le(entry+4, (uint32_t)sections[i].count);
+            store64_le(entry+8, size);
+            // XXX: valid for little endian only!
+            memcpy(buf+size, sections[i].limbs, bytes);
+            memset(buf+size+bytes, 0, key_align(bytes)-bytes);
+        }
+        size += key_align(bytes);
+    }
+    for (size_t j = 0; j<=RSA_MAX_PRIMES; j++)
+        bigint_mont_free(&computed[j]);
+    if (buf)
+    {
+        memcpy(buf, key_magic, sizeof(key_magic));
+        buf[4] = RSA_KEY_VERSION;
+        store32_le(buf+8, (uint32_t)count);
+        store64_le(buf+16, size);
+        store32_le(buf+12, key_checksum(buf, size));
+    }
+    return size;
+}
+
+int rsa_key_write(FILE *f, const rsa_key_t *key)
+{
+    size_t size = rsa_key_serialize(key, NULL);
+    uint8_t *buf = malloc(size);
+    rsa_key_serialize(key, buf);
+    int result = fwrite(buf, 1, size, f)!=size;
+    free(buf);
+    return result;
+}
+
+void rsa_key_free(rsa_key_t *key)
+{
+    bigint_t *numbers[2+3*RSA_MAX_PRIMES] = {key->n, key->exp};
+    for (size_t i = 0; i<RSA_MAX_PRIMES; i++)
+    {
+        numbers[2+3*i] = key->primes[i];
+        numbers[3+3*i] = key->prime_exps[i];
+        numbers[4+3*i] = key->coeffs[i];
+    }
+    for (size_t i = 0; i<sizeof(numbers)/sizeof(numbers[0]); i++)
+    {
+        if (numbers[i])
+            bigint_free(numbers[i]);
+    }
+    for (size_t j = 0; j<=RSA_MAX_PRIMES; j++)
+        bigint_mont_free(&key->mont[j]);
+    if (key->mapping)
+        key_unmap_file(key->mapping, key->mapping_size);
+    memset(key, 0, sizeof(rsa_key_t));
+}
+
 static size_t bsize(uint32_t n)
 {
     if (n & 0xff000000)
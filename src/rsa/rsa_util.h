@@ -2,9 +2,40 @@
 #include "config.h"
 #include "common.h"
 #include "bigint.h"
+#include "rsa.h"
 #include <stdio.h>
 
 int rsa_load_key(FILE *f, bigint_t *n, bigint_t *exp);
 void rsa_save_key(FILE *f, bigint_t *n, bigint_t *exp);
+// In-memory counterparts of rsa_load_key()/rsa_save_key().
+// rsa_parse_key() returns nonzero on a truncated or malformed buffer,
+// rsa_serialize_key() returns the key size and writes it to 'buf'
+// unless 'buf' is NULL.
+int rsa_parse_key(const uint8_t *data, size_t size, bigint_t *n,
+    bigint_t *exp);
+size_t rsa_serialize_key(bigint_t *n, bigint_t *exp, uint8_t *buf);
+
+// Key file format 2: a 64-byte header with a CRC-32 over the whole file,
+// a section table and one 64-byte aligned section of little-endian limbs
+// per number (modulus, exponent, CRT components, Montgomery constants),
+// so a mapped file is used in place without parsing.
+#define RSA_KEY_MAGIC "RSAK"
+#define RSA_KEY_VERSION 2
+
+// All of these accept both the legacy format and format 2 and return
+// nonzero on a malformed, truncated or corrupt key. rsa_key_map() uses
+// the Montgomery constants of a format 2 file straight from the mapping
+// and copies the rest.
+int rsa_key_parse(const uint8_t *data, size_t size, rsa_key_t *key);
+int rsa_key_read(FILE *f, rsa_key_t *key);
+int rsa_key_map(const char *path, rsa_key_t *key);
+// Write 'key' in format 2, adding Montgomery constants it doesn't carry
+// yet. rsa_key_serialize() returns the file size and writes it to 'buf'
+// unless 'buf' is NULL.
+size_t rsa_key_serialize(const rsa_key_t *key, uint8_t *buf);
+int rsa_key_write(FILE *f, const rsa_key_t *key);
+// releases a key filled by any of the above or by rsa_generate_key()
+void rsa_key_free(rsa_key_t *key);
+
 void rsa_get_block_sizes(char mode, bigint_t *n,
     size_t *src_block_size, size_t *dst_block_size);
@@ -0,0 +1,595 @@
+#include "config.h"
+#include "rsad.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+int rsad_run(const char *socket_path, const rsad_config_t *config)
+{
+    puts("daemon mode is not supported on this platform.");
+    return 1;
+}
+#else
+#include "librsa.h"
+#include "thread.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+
+#define RSAD_MAX_CONNECTIONS 1024
+// a peer that takes longer to send a request or to take the response
+// loses its connection
+#define RSAD_IO_TIMEOUT 10 // seconds
+
+typedef struct rsad_key
+{
+    char *path;
+    uint64_t hash;
+    // file identity at load time, a change triggers a reload
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    librsa_key_t *key;
+    size_t refs; // requests using 'key', guarded by the cache lock
+    int evicted;
+    struct rsad_key *prev;
+    struct rsad_key *next;
+} rsad_key_t;
+
+// most recently used first
+typedef struct
+{
+    mutex_t lock;
+    rsad_key_t *head;
+    rsad_key_t *tail;
+    size_t count;
+    size_t capacity;
+} rsad_cache_t;
+
+// accepted connections waiting for a worker
+typedef struct
+{
+    mutex_t lock;
+    cond_t ready;
+    int *fds;
+    size_t capacity;
+    size_t head;
+    size_t count;
+} rsad_queue_t;
+
+typedef struct
+{
+    rsad_cache_t cache;
+    rsad_queue_t queue;
+    char *key_dir; // resolved, no trailing separator except for the root
+    int returns[2]; // workers hand connections back to the poller, -1
+                    // for one they closed
+} rsad_t;
+
+static uint64_t hash_path(const char *path)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (; *path; path++)
+    {
+        hash ^= (uint8_t)*path;
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+static void cache_unlink(rsad_cache_t *cache, rsad_key_t *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        cache->head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        cache->tail = entry->prev;
+    entry->prev = entry->next = NULL;
+    cache->count--;
+}
+
+static void cache_push_front(rsad_cache_t *cache, rsad_key_t *entry)
+{
+    entry->prev = NULL;
+    entry->next = cache->head;
+    if (cache->head)
+        cache->head->prev = entry;
+    else
+        cache->tail = entry;
+    cache->head = entry;
+    cache->count++;
+}
+
+static void entry_free(rsad_key_t *entry)
+{
+    librsa_key_free(entry->key);
+    free(entry->path);
+    free(entry);
+}
+
+// Drop an entry from the cache; in-flight users keep it alive.
+static void cache_evict(rsad_cache_t *cache, rsad_key_t *entry)
+{
+    cache_unlink(cache, entry);
+    entry->evicted = 1;
+    if (!entry->refs)
+        entry_free(entry);
+}
+
+static rsad_key_t *key_load(const char *path, uint64_t hash,
+    const struct stat *st)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    size_t size = (size_t)st->st_size;
+    uint8_t *data = malloc(size ? size : 1);
+    size_t bytes_read = fread(data, 1, size, f);
+    fclose(f);
+    librsa_key_t *key = NULL;
+    if (bytes_read==size)
+        librsa_key_load(data, size, &key);
+    free(data);
+    if (!key)
+        return NULL;
+    rsad_key_t *entry = calloc(1, sizeof(rsad_key_t));
+    entry->path = strdup(path);
+    entry->hash = hash;
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtime;
+    entry->key = key;
+    return entry;
+}
+
+static rsad_key_t *cache_acquire(rsad_cache_t *cache, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st))
+        return NULL;
+    uint64_t hash = hash_path(path);
+    mutex_lock(&cache->lock);
+    rsad_key_t *entry = cache->head;
+    while (entry && (entry->hash!=hash || strcmp(entry->path, path)))
+        entry = entry->next;
+    if (entry && (entry->dev!=st.st_dev || entry->ino!=st.st_ino ||
+        entry->size!=st.st_size || entry->mtime!=st.st_mtime))
+    {
+        cache_evict(cache, entry);
+        entry = NULL;
+    }
+    if (entry)
+    {
+        cache_unlink(cache, entry);
+        cache_push_front(cache, entry);
+        entry->refs++;
+        mutex_unlock(&cache->lock);
+        return entry;
+    }
+    mutex_unlock(&cache->lock);
+    // parse outside the lock; a racing loader of the same key just
+    // produces a duplicate that ages out
+    entry = key_load(path, hash, &st);
+    if (!entry)
+        return NULL;
+    mutex_lock(&cache->lock);
+    entry->refs = 1;
+    cache_push_front(cache, entry);
+    while (cache->count>cache->capacity && cache->tail!=entry)
+        cache_evict(cache, cache->tail);
+    mutex_unlock(&cache->lock);
+    return entry;
+}
+
+static void cache_release(rsad_cache_t *cache, rsad_key_t *entry)
+{
+    mutex_lock(&cache->lock);
+    if (!--entry->refs && entry->evicted)
+        entry_free(entry);
+    mutex_unlock(&cache->lock);
+}
+
+// never full, it holds no more than the open connections
+static void queue_push(rsad_queue_t *queue, int fd)
+{
+    mutex_lock(&queue->lock);
+    queue->fds[(queue->head+queue->count)%queue->capacity] = fd;
+    queue->count++;
+    cond_signal(&queue->ready);
+    mutex_unlock(&queue->lock);
+}
+
+static int queue_pop(rsad_queue_t *queue)
+{
+    mutex_lock(&queue->lock);
+    while (!queue->count)
+        cond_wait(&queue->ready, &queue->lock);
+    int fd = queue->fds[queue->head];
+    queue->head = (queue->head+1)%queue->capacity;
+    queue->count--;
+    mutex_unlock(&queue->lock);
+    return fd;
+}
+
+static int64_t now_ms()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec*1000+now.tv_nsec/1000000;
+}
+
+// Wait for 'events' on a socket until 'deadline' (now_ms(), 0 for none).
+// returns nonzero on timeout or error
+static int wait_io(int fd, short events, int64_t deadline)
+{
+    while (1)
+    {
+        int timeout = -1;
+        if (deadline)
+        {
+            int64_t left = deadline-now_ms();
+            if (left<=0)
+                return 1;
+            timeout = (int)left;
+        }
+        struct pollfd pfd = {fd, events, 0};
+        int ready = poll(&pfd, 1, timeout);
+        if (ready<0 && errno==EINTR)
+            continue;
+        return ready<=0;
+    }
+}
+
+// The deadline covers the whole buffer, so a peer can't hold on to a
+// worker by trickling it byte by byte.
+static int read_full(int fd, void *buf, size_t size, int64_t deadline)
+{
+    uint8_t *p = buf;
+    while (size)
+    {
+        ssize_t n = recv(fd, p, size, MSG_DONTWAIT);
+        if (n<0 && (errno==EAGAIN || errno==EWOULDBLOCK))
+        {
+            if (wait_io(fd, POLLIN, deadline))
+                return 1;
+            continue;
+        }
+        if (n<0 && errno==EINTR)
+            continue;
+        if (n<=0)
+            return 1;
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t size, int64_t deadline)
+{
+    const uint8_t *p = buf;
+    while (size)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL|MSG_DONTWAIT);
+        if (n<0 && (errno==EAGAIN || errno==EWOULDBLOCK))
+        {
+            if (wait_io(fd, POLLOUT, deadline))
+                return 1;
+            continue;
+        }
+        if (n<0 && errno==EINTR)
+            continue;
+        if (n<=0)
+            return 1;
+        p += n;
+        size -= (size_t)n;
+    }
+    return 0;
+}
+
+// Response buffer: frame length, status, body. 'body' points past the
+// status word and 'capacity' is what the body may use.
+typedef struct
+{
+    uint8_t *buf;
+    uint8_t *body;
+    size_t capacity;
+    size_t body_size;
+} rsad_response_t;
+
+static void response_reserve(rsad_response_t *resp, size_t capacity)
+{
+    resp->buf = malloc(8+capacity);
+    resp->body = resp->buf+8;
+    resp->capacity = capacity;
+    resp->body_size = 0;
+}
+
+// Map a client key name to the file it names inside the key directory.
+// returns NULL if it doesn't exist or resolves outside of it
+static char *key_path(const rsad_t *rsad, const char *name)
+{
+    if (name[0]=='/')
+        return NULL;
+    size_t dir_size = strlen(rsad->key_dir);
+    char *joined = malloc(dir_size+1+strlen(name)+1);
+    sprintf(joined, "%s/%s", rsad->key_dir, name);
+    char *path = realpath(joined, NULL);
+    free(joined);
+    if (path && (strncmp(path, rsad->key_dir, dir_size) ||
+        (dir_size>1 && path[dir_size]!='/')))
+    {
+        free(path);
+        path = NULL;
+    }
+    return path;
+}
+
+static int handle_transform(rsad_t *rsad, uint8_t op, const uint8_t *body,
+    size_t size, rsad_response_t *resp)
+{
+    if (size<2)
+        return RSAD_ERR_REQUEST;
+    size_t path_size = body[0] | body[1]<<8;
+    if (!path_size || size-2<path_size)
+        return RSAD_ERR_REQUEST;
+    char *name = malloc(path_size+1);
+    memcpy(name, body+2, path_size);
+    name[path_size] = 0;
+    char *path = key_path(rsad, name);
+    free(name);
+    if (!path)
+        return RSAD_ERR_KEYFILE;
+    rsad_key_t *entry = cache_acquire(&rsad->cache, path);
+    free(path);
+    if (!entry)
+        return RSAD_ERR_KEYFILE;
+    const uint8_t *data = body+2+path_size;
+    size_t data_size = size-2-path_size;
+    size_t out_size = op==RSAD_ENCRYPT ?
+        librsa_encrypt_size(entry->key, data_size) :
+        librsa_decrypt_size(entry->key, data_size);
+    int result = LIBRSA_ERR_ARG;
+    if (out_size<=RSAD_MAX_MESSAGE)
+    {
+        response_reserve(resp, out_size);
+        size_t written = out_size;
+        result = op==RSAD_ENCRYPT ?
+            librsa_encrypt(entry->key, data, data_size, resp->body, &written) :
+            librsa_decrypt(entry->key, data, data_size, resp->body, &written);
+        resp->body_size = result==LIBRSA_OK ? written : 0;
+    }
+    cache_release(&rsad->cache, entry);
+    return result;
+}
+
+static int handle_keygen(const uint8_t *body, size_t size,
+    rsad_response_t *resp)
+{
+    if (size<4)
+        return RSAD_ERR_REQUEST;
+    uint32_t bits = load32_le(body);
+    if (bits<RSAD_KEYGEN_MIN_BITS || bits>RSAD_KEYGEN_MAX_BITS || bits%32)
+        return RSAD_ERR_REQUEST;
+    librsa_key_t *public_key, *private_key;
+    int result = librsa_keygen(bits, &public_key, &private_key);
+    if (result!=LIBRSA_OK)
+        return result;
+    size_t public_size = 0, private_size = 0;
+    librsa_key_save(public_key, NULL, &public_size);
+    librsa_key_save(private_key, NULL, &private_size);
+    response_reserve(resp, 4+public_size+private_size);
+    store32_le(resp->body, (uint32_t)public_size);
+    librsa_key_save(public_key, resp->body+4, &public_size);
+    librsa_key_save(private_key, resp->body+4+public_size, &private_size);
+    resp->body_size = 4+public_size+private_size;
+    librsa_key_free(public_key);
+    librsa_key_free(private_key);
+    return LIBRSA_OK;
+}
+
+// Serve the request waiting on a connection.
+// returns nonzero once the connection is done with
+static int serve_request(rsad_t *rsad, int fd)
+{
+    int64_t deadline = now_ms()+RSAD_IO_TIMEOUT*1000;
+    uint8_t frame[4];
+    if (read_full(fd, frame, sizeof(frame), deadline))
+        return 1;
+    uint32_t size = load32_le(frame);
+    if (size<4 || size>RSAD_MAX_MESSAGE)
+        return 1;
+    uint8_t *request = malloc(size);
+    if (read_full(fd, request, size, deadline))
+    {
+        free(request);
+        return 1;
+    }
+    rsad_response_t resp = {NULL, NULL, 0, 0};
+    int status;
+    switch (request[0])
+    {
+    case RSAD_ENCRYPT:
+    case RSAD_DECRYPT:
+        status = handle_transform(rsad, request[0], request+4, size-4,
+            &resp);
+        break;
+    case RSAD_KEYGEN:
+        status = handle_keygen(request+4, size-4, &resp);
+        break;
+    default:
+        status = RSAD_ERR_REQUEST;
+        break;
+    }
+    free(request);
+    if (!resp.buf)
+        response_reserve(&resp, 0);
+    if (status!=LIBRSA_OK)
+        resp.body_size = 0;
+    store32_le(resp.buf, (uint32_t)(4+resp.body_size));
+    store32_le(resp.buf+4, (uint32_t)status);
+    deadline = now_ms()+RSAD_IO_TIMEOUT*1000;
+    int failed = write_full(fd, resp.buf, 8+resp.body_size, deadline);
+    free(resp.buf);
+    return failed;
+}
+
+// Workers take one request at a time, so a connection kept open between
+// requests doesn't hold one.
+static void worker_proc(void *arg)
+{
+    rsad_t *rsad = arg;
+    while (1)
+    {
+        int fd = queue_pop(&rsad->queue);
+        if (serve_request(rsad, fd))
+        {
+            close(fd);
+            fd = -1;
+        }
+        write_full(rsad->returns[1], &fd, sizeof(fd), 0);
+    }
+}
+
+// Accept connections and queue every one that has a request waiting.
+// returns when the listening socket fails
+static void poll_connections(rsad_t *rsad, int listen_fd)
+{
+    // the listening socket, the connections handed back, then the idle
+    // connections
+    size_t poll_size = 2+RSAD_MAX_CONNECTIONS;
+    struct pollfd *fds = malloc(poll_size*sizeof(struct pollfd));
+    for (size_t i = 0; i<poll_size; i++)
+        fds[i].events = POLLIN;
+    fds[0].fd = listen_fd;
+    fds[1].fd = rsad->returns[0];
+    size_t idle = 0;
+    size_t open = 0; // idle, queued or being served
+    while (1)
+    {
+        if (poll(fds, 2+idle, -1)<0)
+        {
+            if (errno==EINTR)
+                continue;
+            break;
+        }
+        // a hangup is queued too, the worker sees it and closes
+        for (size_t i = 2+idle; i-->2;)
+        {
+            if (!fds[i].revents)
+                continue;
+            queue_push(&rsad->queue, fds[i].fd);
+            fds[i].fd = fds[2+--idle].fd;
+        }
+        if (fds[1].revents)
+        {
+            int fd;
+            if (read_full(fds[1].fd, &fd, sizeof(fd), 0))
+                break;
+            if (fd<0)
+                open--;
+            else
+                fds[2+idle++].fd = fd;
+        }
+        if (fds[0].revents)
+        {
+            int fd = accept(listen_fd, NULL, NULL);
+            if (fd<0)
+            {
+                if (errno!=EINTR && errno!=ECONNABORTED)
+                    break;
+            }
+            else if (open==RSAD_MAX_CONNECTIONS)
+                close(fd); // overloaded, the client sees the connection drop
+            else
+            {
+                fds[2+idle++].fd = fd;
+                open++;
+            }
+        }
+    }
+    free(fds);
+}
+
+int rsad_run(const char *socket_path, const rsad_config_t *config)
+{
+    struct sockaddr_un addr;
+    if (strlen(socket_path)>=sizeof(addr.sun_path))
+    {
+        puts("socket path is too long.");
+        return 1;
+    }
+    char *key_dir = realpath(config->key_dir ? config->key_dir : ".", NULL);
+    struct stat st;
+    if (!key_dir || stat(key_dir, &st) || !S_ISDIR(st.st_mode))
+    {
+        free(key_dir);
+        puts("can't open key directory.");
+        return 1;
+    }
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd<0)
+    {
+        free(key_dir);
+        puts("can't create socket.");
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+    unlink(socket_path); // stale socket from a previous run
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(listen_fd, 128))
+    {
+        close(listen_fd);
+        free(key_dir);
+        puts("can't listen on socket.");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    size_t workers = config->workers ? config->workers : thread_cpu_count();
+    // workers hold on to it for as long as the process lives, even when
+    // this function gives up below, so it is never freed
+    rsad_t *rsad = malloc(sizeof(rsad_t));
+    mutex_init(&rsad->cache.lock);
+    rsad->cache.head = rsad->cache.tail = NULL;
+    rsad->cache.count = 0;
+    rsad->cache.capacity = config->cache_size ? config->cache_size : 1;
+    mutex_init(&rsad->queue.lock);
+    cond_init(&rsad->queue.ready);
+    rsad->queue.capacity = RSAD_MAX_CONNECTIONS;
+    rsad->queue.fds = malloc(rsad->queue.capacity*sizeof(int));
+    rsad->queue.head = rsad->queue.count = 0;
+    rsad->key_dir = key_dir;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, rsad->returns))
+    {
+        close(listen_fd);
+        puts("can't create socket.");
+        return 1;
+    }
+    for (size_t i = 0; i<workers; i++)
+    {
+        thread_t thread;
+        if (thread_create(&thread, worker_proc, rsad))
+        {
+            close(listen_fd);
+            puts("can't start worker threads.");
+            return 1;
+        }
+    }
+    poll_connections(rsad, listen_fd);
+    close(listen_fd);
+    puts("accept failed, shutting down.");
+    return 1;
+}
+#endif
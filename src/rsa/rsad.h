@@ -0,0 +1,58 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+// Long-running service on a Unix domain socket (POSIX only).
+//
+// Every message is framed as a little endian uint32 length followed by
+// that many bytes. A connection may carry any number of requests, each
+// answered in order; it only takes up a worker while a request is being
+// served, and is dropped if a request takes more than 10 seconds to
+// arrive once it has started, or its response more than 10 to be taken.
+//
+// request:  op (1 byte), reserved (3 bytes), op-specific body
+//   RSAD_ENCRYPT, RSAD_DECRYPT:
+//            key path length (uint16), key path relative to the key
+//            directory, data
+//   RSAD_KEYGEN:
+//            key size in bits (uint32), a multiple of 32 from
+//            RSAD_KEYGEN_MIN_BITS to RSAD_KEYGEN_MAX_BITS
+// response: status (int32, one of the LIBRSA_* codes or RSAD_ERR_*),
+//           then on success
+//   RSAD_ENCRYPT, RSAD_DECRYPT: transformed data
+//   RSAD_KEYGEN: public key size (uint32), public key, private key
+//
+// Keys are named by path and kept in an LRU cache together with their
+// precomputed contexts; a cached key is reloaded once its file changes.
+// Paths that resolve outside the key directory, through '..' or symbolic
+// links, are refused.
+
+enum
+{
+    RSAD_ENCRYPT = 1,
+    RSAD_DECRYPT = 2,
+    RSAD_KEYGEN = 3
+};
+
+enum
+{
+    RSAD_ERR_REQUEST = -100, // malformed or oversized request
+    RSAD_ERR_KEYFILE = -101 // key file can't be read or is outside the
+                            // key directory
+};
+
+#define RSAD_MAX_MESSAGE (64u<<20)
+// a client can't tie up a worker with a huge keygen
+#define RSAD_KEYGEN_MIN_BITS 1024
+#define RSAD_KEYGEN_MAX_BITS 8192
+
+typedef struct
+{
+    size_t workers; // 0: one per logical processor
+    size_t cache_size; // keys kept loaded
+    const char *key_dir; // the only directory keys are read from
+} rsad_config_t;
+
+// Serve requests until the process is terminated.
+// returns nonzero if the socket can't be set up
+int rsad_run(const char *socket_path, const rsad_config_t *config);
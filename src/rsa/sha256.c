@@ -0,0 +1,166 @@
+#include "config.h"
+#include "sha256.h"
+#include <string.h>
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) ((x)>>(n) | (x)<<(32-(n)))
+
+static void sha256_block(sha256_t *ctx, const uint8_t *p)
+{
+    uint32_t w[64];
+    for (int i = 0; i<16; i++)
+    {
+        w[i] = (uint32_t)p[4*i]<<24 | (uint32_t)p[4*i+1]<<16 |
+            (uint32_t)p[4*i+2]<<8 | p[4*i+3];
+    }
+    for (int i = 16; i<64; i++)
+    {
+        uint32_t s0 = ROTR(w[i-15], 7)^ROTR(w[i-15], 18)^w[i-15]>>3;
+        uint32_t s1 = ROTR(w[i-2], 17)^ROTR(w[i-2], 19)^w[i-2]>>10;
+        w[i] = w[i-16]+s0+w[i-7]+s1;
+    }
+    uint32_t a = ctx->state[0], b = ctx->state[1];
+    uint32_t c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5];
+    uint32_t g = ctx->state[6], h = ctx->state[7];
+    for (int i = 0; i<64; i++)
+    {
+        uint32_t s1 = ROTR(e, 6)^ROTR(e, 11)^ROTR(e, 25);
+        uint32_t ch = (e & f)^(~e & g);
+        uint32_t t1 = h+s1+ch+sha256_k[i]+w[i];
+        uint32_t s0 = ROTR(a, 2)^ROTR(a, 13)^ROTR(a, 22);
+        uint32_t maj = (a & b)^(a & c)^(b & c);
+        uint32_t t2 = s0+maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d+t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1+t2;
+    }
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+void sha256_init(sha256_t *ctx)
+{
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, iv, sizeof(iv));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+void sha256_update(sha256_t *ctx, const uint8_t *data, size_t size)
+{
+    ctx->length += size;
+    if (ctx->used)
+    {
+        size_t n = min(size, SHA256_BLOCK_SIZE-ctx->used);
+        memcpy(ctx->block+ctx->used, data, n);
+        ctx->used += n;
+        data += n;
+        size -= n;
+        if (ctx->used<SHA256_BLOCK_SIZE)
+            return;
+        sha256_block(ctx, ctx->block);
+        ctx->used = 0;
+    }
+    for (; size>=SHA256_BLOCK_SIZE; size -= SHA256_BLOCK_SIZE)
+    {
+        sha256_block(ctx, data);
+        data += SHA256_BLOCK_SIZE;
+    }
+    memcpy(ctx->block, data, size);
+    ctx->used = size;
+}
+
+void sha256_final(sha256_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bits = ctx->length*8;
+    // 0x80, zeros, then the bit length big endian in the last 8 bytes
+    ctx->block[ctx->used++] = 0x80;
+    if (ctx->used>SHA256_BLOCK_SIZE-8)
+    {
+        memset(ctx->block+ctx->used, 0, SHA256_BLOCK_SIZE-ctx->used);
+        sha256_block(ctx, ctx->block);
+        ctx->used = 0;
+    }
+    memset(ctx->block+ctx->used, 0, SHA256_BLOCK_SIZE-8-ctx->used);
+    for (int i = 0; i<8; i++)
+        ctx->block[SHA256_BLOCK_SIZE-1-i] = (uint8_t)(bits>>(8*i));
+    sha256_block(ctx, ctx->block);
+    for (int i = 0; i<8; i++)
+    {
+        digest[4*i] = (uint8_t)(ctx->state[i]>>24);
+        digest[4*i+1] = (uint8_t)(ctx->state[i]>>16);
+        digest[4*i+2] = (uint8_t)(ctx->state[i]>>8);
+        digest[4*i+3] = (uint8_t)ctx->state[i];
+    }
+}
+
+void hmac_sha256_init(hmac_sha256_t *ctx, const uint8_t *key,
+    size_t key_size)
+{
+    // keys longer than a block are hashed first
+    uint8_t pad[SHA256_BLOCK_SIZE] = {0};
+    if (key_size>SHA256_BLOCK_SIZE)
+    {
+        sha256_init(&ctx->inner);
+        sha256_update(&ctx->inner, key, key_size);
+        sha256_final(&ctx->inner, pad);
+    }
+    else
+        memcpy(pad, key, key_size);
+    for (int i = 0; i<SHA256_BLOCK_SIZE; i++)
+        pad[i] ^= 0x36;
+    sha256_init(&ctx->inner);
+    sha256_update(&ctx->inner, pad, SHA256_BLOCK_SIZE);
+    for (int i = 0; i<SHA256_BLOCK_SIZE; i++)
+        pad[i] ^= 0x36^0x5c;
+    sha256_init(&ctx->outer);
+    sha256_update(&ctx->outer, pad, SHA256_BLOCK_SIZE);
+    memset(pad, 0, sizeof(pad));
+}
+
+void hmac_sha256_update(hmac_sha256_t *ctx, const uint8_t *data,
+    size_t size)
+{ sha256_update(&ctx->inner, data, size); }
+
+void hmac_sha256_final(hmac_sha256_t *ctx, uint8_t mac[SHA256_DIGEST_SIZE])
+{
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    sha256_final(&ctx->inner, digest);
+    sha256_update(&ctx->outer, digest, SHA256_DIGEST_SIZE);
+    sha256_final(&ctx->outer, mac);
+    memset(digest, 0, sizeof(digest));
+    memset(ctx, 0, sizeof(hmac_sha256_t));
+}
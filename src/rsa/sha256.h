@@ -0,0 +1,32 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_BLOCK_SIZE 64
+
+// SHA-256 (FIPS 180-4), incremental.
+typedef struct
+{
+    uint32_t state[8];
+    uint64_t length; // bytes hashed so far
+    uint8_t block[SHA256_BLOCK_SIZE];
+    size_t used; // bytes of 'block' filled
+} sha256_t;
+
+void sha256_init(sha256_t *ctx);
+void sha256_update(sha256_t *ctx, const uint8_t *data, size_t size);
+void sha256_final(sha256_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+
+// HMAC-SHA-256 (RFC 2104), incremental.
+typedef struct
+{
+    sha256_t inner;
+    sha256_t outer;
+} hmac_sha256_t;
+
+void hmac_sha256_init(hmac_sha256_t *ctx, const uint8_t *key,
+    size_t key_size);
+void hmac_sha256_update(hmac_sha256_t *ctx, const uint8_t *data,
+    size_t size);
+void hmac_sha256_final(hmac_sha256_t *ctx, uint8_t mac[SHA256_DIGEST_SIZE]);
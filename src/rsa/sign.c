@@ -0,0 +1,123 @@
+#include "config.h"
+#include "sign.h"
+#include <stdlib.h>
+#include <string.h>
+
+// DER DigestInfo prefix for SHA-256, RFC 8017 section 9.2
+static const uint8_t sha256_prefix[19] = {
+    0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+    0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20
+};
+
+// 0x00 0x01, at least 8 bytes 0xff, 0x00, DigestInfo
+#define SIGN_MIN_SIZE (11+sizeof(sha256_prefix)+SHA256_DIGEST_SIZE)
+
+size_t sign_size(bigint_t *n)
+{
+    size_t limbs = n->size;
+    while (limbs && !n->data[limbs-1])
+        limbs--;
+    size_t bytes = limbs*sizeof(uint32_t);
+    uint32_t top = limbs ? n->data[limbs-1] : 0;
+    while (bytes && !(top>>24))
+    {
+        top <<= 8;
+        bytes--;
+    }
+    return bytes;
+}
+
+int sign_digest_file(FILE *f, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint8_t buf[1<<14];
+    sha256_t sha;
+    sha256_init(&sha);
+    size_t bytes_read;
+    while ((bytes_read = fread(buf, 1, sizeof(buf), f)))
+        sha256_update(&sha, buf, bytes_read);
+    if (ferror(f))
+        return SIGN_ERR_IO;
+    sha256_final(&sha, digest);
+    return SIGN_OK;
+}
+
+// EMSA-PKCS1-v1_5 encoding of 'digest' as a little endian block
+static int encode(rsa_ctx_t *ctx, size_t size,
+    const uint8_t digest[SHA256_DIGEST_SIZE], uint8_t *block)
+{
+    if (size<SIGN_MIN_SIZE || size>ctx->block_size)
+        return SIGN_ERR_KEY;
+    // built from the least significant end: digest, prefix, 0x00, 0xff..
+    uint8_t *p = block;
+    memset(block, 0, ctx->block_size);
+    for (size_t i = SHA256_DIGEST_SIZE; i--;)
+        *p++ = digest[i];
+    for (size_t i = sizeof(sha256_prefix); i--;)
+        *p++ = sha256_prefix[i];
+    p++;
+    memset(p, 0xff, block+size-2-p);
+    block[size-2] = 0x01;
+    return SIGN_OK;
+}
+
+int sign_create(rsa_ctx_t *ctx, bigint_t *n,
+    const uint8_t digest[SHA256_DIGEST_SIZE], uint8_t *sig)
+{
+    size_t size = sign_size(n);
+    uint8_t *block = malloc(ctx->block_size);
+    int result = encode(ctx, size, digest, block);
+    if (result==SIGN_OK)
+    {
+        // XXX: valid for little endian only!
+        rsa_transform_ctx(ctx, block, block);
+        for (size_t i = 0; i<size; i++)
+            sig[i] = block[size-1-i];
+    }
+    free(block);
+    return result;
+}
+
+int sign_load(rsa_ctx_t *ctx, bigint_t *n, const uint8_t *sig,
+    size_t sig_size, uint8_t *block)
+{
+    if (sig_size!=sign_size(n) || sig_size>ctx->block_size)
+        return SIGN_ERR_MISMATCH;
+    memset(block, 0, ctx->block_size);
+    for (size_t i = 0; i<sig_size; i++)
+        block[i] = sig[sig_size-1-i];
+    // the signature must be less than n
+    // XXX: valid for little endian only!
+    const uint32_t *s = (const uint32_t *)block;
+    for (size_t i = ctx->block_size/sizeof(uint32_t); i--;)
+    {
+        if (s[i]!=n->data[i])
+            return s[i]<n->data[i] ? SIGN_OK : SIGN_ERR_MISMATCH;
+    }
+    return SIGN_ERR_MISMATCH;
+}
+
+int sign_match(rsa_ctx_t *ctx, bigint_t *n, const uint8_t *block,
+    const uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint8_t *expected = malloc(ctx->block_size);
+    int result = encode(ctx, sign_size(n), digest, expected);
+    if (result==SIGN_OK && memcmp(block, expected, ctx->block_size))
+        result = SIGN_ERR_MISMATCH;
+    free(expected);
+    return result;
+}
+
+int sign_check(rsa_ctx_t *ctx, bigint_t *n,
+    const uint8_t digest[SHA256_DIGEST_SIZE], const uint8_t *sig,
+    size_t sig_size)
+{
+    uint8_t *block = malloc(ctx->block_size);
+    int result = sign_load(ctx, n, sig, sig_size, block);
+    if (result==SIGN_OK)
+    {
+        rsa_transform_ctx(ctx, block, block);
+        result = sign_match(ctx, n, block, digest);
+    }
+    free(block);
+    return result;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+#include "rsa.h"
+#include "sha256.h"
+#include <stdio.h>
+
+// RSASSA-PKCS1-v1_5 signatures (RFC 8017) over SHA-256 digests. A
+// signature is the modulus length in bytes, big endian, so it reads the
+// same as in other implementations; the digest covers the whole file.
+//
+// Verification works on ctx blocks so callers can check many signatures
+// with one rsa_transform_batch() call: sign_load() turns a signature into
+// a block, the transform raises it to the public exponent and
+// sign_match() compares the result with the expected encoding.
+
+enum
+{
+    SIGN_OK = 0,
+    SIGN_ERR_IO = -1,
+    SIGN_ERR_KEY = -2, // modulus too short for the encoding
+    SIGN_ERR_MISMATCH = -3 // malformed or wrong signature
+};
+
+// signature size in bytes for modulus n
+size_t sign_size(bigint_t *n);
+int sign_digest_file(FILE *f, uint8_t digest[SHA256_DIGEST_SIZE]);
+// 'sig' receives sign_size() bytes
+int sign_create(rsa_ctx_t *ctx, bigint_t *n,
+    const uint8_t digest[SHA256_DIGEST_SIZE], uint8_t *sig);
+// returns SIGN_OK if 'sig' is a valid signature of 'digest'
+int sign_check(rsa_ctx_t *ctx, bigint_t *n,
+    const uint8_t digest[SHA256_DIGEST_SIZE], const uint8_t *sig,
+    size_t sig_size);
+// signature to a ctx->block_size block, checking its size and range
+int sign_load(rsa_ctx_t *ctx, bigint_t *n, const uint8_t *sig,
+    size_t sig_size, uint8_t *block);
+// returns SIGN_OK if the transformed 'block' encodes 'digest'
+int sign_match(rsa_ctx_t *ctx, bigint_t *n, const uint8_t *block,
+    const uint8_t digest[SHA256_DIGEST_SIZE]);
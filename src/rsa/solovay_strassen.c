@@ -25,7 +25,7 @@ static int is_euler_witness(int a, bigint_t *n, bigint_t *prealloc[4])
     return result;
 }
 
-int is_prime_ss(bigint_t *n, size_t k)
+int is_prime_ss(rnd_t *rnd, bigint_t *n, size_t k)
 {
     // early out for n=2
     if (bigint_equal(n, &small_bigint[2]))
@@ -41,8 +41,8 @@ int is_prime_ss(bigint_t *n, size_t k)
     {
         // XXX: pick random bigint instead of plain int
         // 1] choose 1<a<n
-        int rmax = n->size<=1 ? n->data[0] : RAND_MAX;
-        int wit = rand()%(rmax-2)+2; // rand in range [2..n-1]
+        uint32_t rmax = n->size<=1 ? n->data[0] : RAND_MAX;
+        int wit = rnd_u32(rnd)%(rmax-2)+2; // rand in range [2..n-1]
         // 2] check if 'wit' is a Euler witness for 'n'
         if (!is_euler_witness(wit, n, prealloc))
         {
@@ -2,6 +2,7 @@
 #include "config.h"
 #include "common.h"
 #include "bigint.h"
+#include "rnd.h"
 
 // Solovay-Strassen probabilistic primality test for 'k' rounds
-int is_prime_ss(bigint_t *n, size_t k);
+int is_prime_ss(rnd_t *rnd, bigint_t *n, size_t k);
@@ -0,0 +1,235 @@
+#include "config.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+static const char *counter_names[STAT_COUNTER_COUNT] = {
+    "bigint_mul", "bigint_div", "modpow", "mont_mul", "limb_ops",
+    "allocs", "reallocs", "prime_candidates", "prime_rejected"
+};
+
+static const char *timer_names[STAT_TIMER_COUNT] = {
+    "read", "transform", "write", "keygen"
+};
+
+#if RSA_STATS
+typedef struct
+{
+    stat_timer_t timer;
+    uint64_t start;
+    uint64_t duration;
+} trace_event_t;
+
+// stats first, so a block and its stats_t share an address
+typedef struct stats_block
+{
+    stats_t stats;
+    size_t thread_index;
+    trace_event_t *events;
+    size_t event_count;
+    size_t event_capacity;
+    struct stats_block *next;
+} stats_block_t;
+
+THREAD_LOCAL stats_t *stats_current;
+// the blocks of live threads, and what exited ones counted
+static stats_block_t *blocks;
+static stats_t retired;
+static size_t thread_count;
+static void *volatile blocks_lock;
+static int trace_enabled;
+static uint64_t trace_origin;
+
+static void stats_detach();
+static thread_exit_hook_t detach_hook = {stats_detach, NULL, NULL};
+
+// held only to walk or change the list, never while counting
+static void lock_blocks()
+{
+    while (!atomic_cas_ptr(&blocks_lock, NULL, (void *)&blocks_lock))
+        ;
+}
+
+static void unlock_blocks()
+{ atomic_cas_ptr(&blocks_lock, (void *)&blocks_lock, NULL); }
+
+static void stats_sum(stats_t *sum, const stats_t *stats)
+{
+    for (size_t i = 0; i<STAT_COUNTER_COUNT; i++)
+        sum->counters[i] += stats->counters[i];
+    for (size_t i = 0; i<STAT_TIMER_COUNT; i++)
+    {
+        sum->timer_ns[i] += stats->timer_ns[i];
+        sum->timer_calls[i] += stats->timer_calls[i];
+    }
+}
+
+stats_t *stats_attach()
+{
+    stats_block_t *block = calloc(1, sizeof(stats_block_t));
+    lock_blocks();
+    block->thread_index = thread_count++;
+    block->next = blocks;
+    blocks = block;
+    unlock_blocks();
+    stats_current = &block->stats;
+    thread_at_exit(&detach_hook);
+    return stats_current;
+}
+
+// Fold an exiting thread's counts into the retired totals. A block with
+// trace events stays until the trace is written.
+static void stats_detach()
+{
+    stats_block_t *block = (stats_block_t *)stats_current;
+    if (!block || block->event_count)
+        return;
+    stats_current = NULL;
+    lock_blocks();
+    stats_block_t **link = &blocks;
+    while (*link!=block)
+        link = &(*link)->next;
+    *link = block->next;
+    stats_sum(&retired, &block->stats);
+    unlock_blocks();
+    free(block);
+}
+
+uint64_t stats_now()
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER count;
+    if (!freq.QuadPart)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (uint64_t)(count.QuadPart*1e9/freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+#endif
+}
+
+void stats_end(stat_timer_t timer, uint64_t start)
+{
+    uint64_t duration = stats_now()-start;
+    stats_t *stats = stats_current ? stats_current : stats_attach();
+    stats->timer_ns[timer] += duration;
+    stats->timer_calls[timer]++;
+    if (!trace_enabled)
+        return;
+    stats_block_t *block = (stats_block_t *)stats;
+    if (block->event_count==block->event_capacity)
+    {
+        block->event_capacity = max(block->event_capacity*2, 1024);
+        block->events = realloc(block->events,
+            block->event_capacity*sizeof(trace_event_t));
+    }
+    trace_event_t *event = &block->events[block->event_count++];
+    event->timer = timer;
+    event->start = start;
+    event->duration = duration;
+}
+
+void stats_snapshot(stats_t *stats)
+{
+    lock_blocks();
+    *stats = retired;
+    for (stats_block_t *block = blocks; block; block = block->next)
+        stats_sum(stats, &block->stats);
+    unlock_blocks();
+}
+
+void stats_trace_enable()
+{
+    trace_origin = stats_now();
+    trace_enabled = 1;
+}
+
+int stats_write_trace(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return 1;
+    const char *separator = "\n";
+    fputs("{\"traceEvents\": [", f);
+    lock_blocks();
+    for (stats_block_t *block = blocks; block; block = block->next)
+    {
+        for (size_t i = 0; i<block->event_count; i++)
+        {
+            const trace_event_t *event = &block->events[i];
+            // complete events, microseconds since tracing started
+            fprintf(f, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+                "\"dur\": %.3f, \"pid\": 1, \"tid\": %zu}", separator,
+                timer_names[event->timer],
+                (event->start-trace_origin)/1e3, event->duration/1e3,
+                block->thread_index);
+            separator = ",\n";
+        }
+    }
+    unlock_blocks();
+    fputs("\n]}\n", f);
+    return fclose(f)!=0;
+}
+#else
+void stats_snapshot(stats_t *stats)
+{ memset(stats, 0, sizeof(stats_t)); }
+
+void stats_trace_enable()
+{
+}
+
+int stats_write_trace(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return 1;
+    fputs("{\"traceEvents\": []}\n", f);
+    return fclose(f)!=0;
+}
+#endif
+
+void stats_print(FILE *f, int json)
+{
+    stats_t stats;
+    stats_snapshot(&stats);
+    if (json)
+    {
+        fputs("{\"counters\": {", f);
+        for (size_t i = 0; i<STAT_COUNTER_COUNT; i++)
+        {
+            fprintf(f, "%s\"%s\": %llu", i ? ", " : "", counter_names[i],
+                (unsigned long long)stats.counters[i]);
+        }
+        fputs("}, \"timers\": {", f);
+        for (size_t i = 0; i<STAT_TIMER_COUNT; i++)
+        {
+            fprintf(f, "%s\"%s\": {\"calls\": %llu, \"ns\": %llu}",
+                i ? ", " : "", timer_names[i],
+                (unsigned long long)stats.timer_calls[i],
+                (unsigned long long)stats.timer_ns[i]);
+        }
+        fputs("}}\n", f);
+        return;
+    }
+#if !RSA_STATS
+    fputs("statistics are not compiled in.\n", f);
+#endif
+    for (size_t i = 0; i<STAT_COUNTER_COUNT; i++)
+    {
+        fprintf(f, "%-18s %20llu\n", counter_names[i],
+            (unsigned long long)stats.counters[i]);
+    }
+    for (size_t i = 0; i<STAT_TIMER_COUNT; i++)
+    {
+        if (!stats.timer_calls[i])
+            continue;
+        fprintf(f, "%-18s %12.3f ms in %llu calls\n", timer_names[i],
+            stats.timer_ns[i]/1e6, (unsigned long long)stats.timer_calls[i]);
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+#include "thread.h"
+#include <stdio.h>
+
+// Hot-path counters and phase timers. Every thread counts into a block
+// of its own, so an update is a thread-local add; reports sum the blocks
+// of all threads that ever counted, an exiting thread's block folded into
+// a shared total and freed. With RSA_STATS set to 0 the STATS_*
+// macros compile to nothing and reports come out empty.
+
+typedef enum
+{
+    STAT_MUL, // bigint_mul() calls
+    STAT_DIV, // bigint_div() calls
+    STAT_MODPOW, // bigint_modpow() calls and per-key exponentiations
+    STAT_MONT_MUL, // Montgomery products, one per multi-buffer lane
+    STAT_LIMB_OPS, // limb multiply-adds and long division limb steps
+    STAT_ALLOC, // limb buffer allocations
+    STAT_REALLOC, // limb buffer growth
+    STAT_PRIME_CANDIDATES, // primality tests run by keygen
+    STAT_PRIME_REJECTED, // ... that found a composite
+    STAT_COUNTER_COUNT
+} stat_counter_t;
+
+typedef enum
+{
+    STAT_READ,
+    STAT_TRANSFORM,
+    STAT_WRITE,
+    STAT_KEYGEN,
+    STAT_TIMER_COUNT
+} stat_timer_t;
+
+typedef struct
+{
+    uint64_t counters[STAT_COUNTER_COUNT];
+    uint64_t timer_ns[STAT_TIMER_COUNT];
+    uint64_t timer_calls[STAT_TIMER_COUNT];
+} stats_t;
+
+#if RSA_STATS
+extern THREAD_LOCAL stats_t *stats_current;
+// registers the calling thread's block
+stats_t *stats_attach();
+uint64_t stats_now();
+void stats_end(stat_timer_t timer, uint64_t start);
+
+#define STATS_ADD(counter, n) \
+    ((stats_current ? stats_current : stats_attach())->counters[counter] += \
+    (n))
+// time a phase: STATS_BEGIN(t); ...; STATS_END(STAT_READ, t);
+#define STATS_BEGIN(name) uint64_t name = stats_now()
+#define STATS_END(timer, name) stats_end(timer, name)
+#else
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_BEGIN(name) ((void)0)
+#define STATS_END(timer, name) ((void)0)
+#endif
+
+// Sum over all threads. Approximate while other threads keep counting.
+void stats_snapshot(stats_t *stats);
+// Record every timed phase as a Chrome trace event from now on. Call
+// before starting worker threads.
+void stats_trace_enable();
+void stats_print(FILE *f, int json);
+// chrome://tracing / Perfetto JSON; returns nonzero on failure
+int stats_write_trace(const char *path);
@@ -0,0 +1,198 @@
+#include "config.h"
+#include "thread.h"
+#include <stdlib.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+typedef struct
+{
+    thread_proc_t proc;
+    void *arg;
+} thread_start_t;
+
+static thread_exit_hook_t *volatile exit_hooks = NULL;
+
+static void run_exit_hooks()
+{
+    for (thread_exit_hook_t *hook = exit_hooks; hook; hook = hook->next)
+        hook->proc();
+}
+
+static void arm_exit_hooks();
+
+void thread_at_exit(thread_exit_hook_t *hook)
+{
+    if (atomic_cas_ptr(&hook->registered, NULL, hook))
+    {
+        do
+            hook->next = exit_hooks;
+        while (!atomic_cas_ptr((void *volatile *)&exit_hooks, hook->next,
+            hook));
+    }
+    arm_exit_hooks();
+}
+
+#ifdef _WIN32
+// a fiber local slot's callback runs as its thread exits
+static INIT_ONCE exit_once = INIT_ONCE_STATIC_INIT;
+static DWORD exit_slot;
+
+static void WINAPI exit_callback(void *value)
+{ run_exit_hooks(); }
+
+static BOOL CALLBACK exit_init(PINIT_ONCE once, void *param, void **context)
+{
+    exit_slot = FlsAlloc(exit_callback);
+    return exit_slot!=FLS_OUT_OF_INDEXES;
+}
+
+static void arm_exit_hooks()
+{
+    if (InitOnceExecuteOnce(&exit_once, exit_init, NULL, NULL))
+        FlsSetValue(exit_slot, (void *)1);
+}
+
+static DWORD WINAPI thread_entry(LPVOID param)
+{
+    thread_start_t start = *(thread_start_t *)param;
+    free(param);
+    start.proc(start.arg);
+    return 0;
+}
+
+int thread_create(thread_t *thread, thread_proc_t proc, void *arg)
+{
+    thread_start_t *start = malloc(sizeof(thread_start_t));
+    start->proc = proc;
+    start->arg = arg;
+    *thread = CreateThread(NULL, 0, thread_entry, start, 0, NULL);
+    if (!*thread)
+    {
+        free(start);
+        return 1;
+    }
+    return 0;
+}
+
+void thread_join(thread_t thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+size_t thread_cpu_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+}
+
+int atomic_cas_ptr(void *volatile *target, void *expected, void *desired)
+{ return InterlockedCompareExchangePointer(target, desired, expected)==expected; }
+
+void mutex_init(mutex_t *mutex)
+{ InitializeCriticalSection(mutex); }
+
+void mutex_destroy(mutex_t *mutex)
+{ DeleteCriticalSection(mutex); }
+
+void mutex_lock(mutex_t *mutex)
+{ EnterCriticalSection(mutex); }
+
+void mutex_unlock(mutex_t *mutex)
+{ LeaveCriticalSection(mutex); }
+
+void cond_init(cond_t *cond)
+{ InitializeConditionVariable(cond); }
+
+void cond_destroy(cond_t *cond)
+{}
+
+void cond_wait(cond_t *cond, mutex_t *mutex)
+{ SleepConditionVariableCS(cond, mutex, INFINITE); }
+
+void cond_signal(cond_t *cond)
+{ WakeConditionVariable(cond); }
+
+void cond_broadcast(cond_t *cond)
+{ WakeAllConditionVariable(cond); }
+#else
+// a key's destructor runs as its thread exits
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+static pthread_key_t exit_key;
+static int exit_key_ready;
+
+static void exit_destructor(void *value)
+{ run_exit_hooks(); }
+
+static void exit_init()
+{ exit_key_ready = !pthread_key_create(&exit_key, exit_destructor); }
+
+static void arm_exit_hooks()
+{
+    pthread_once(&exit_once, exit_init);
+    if (exit_key_ready)
+        pthread_setspecific(exit_key, (void *)1);
+}
+
+static void *thread_entry(void *param)
+{
+    thread_start_t start = *(thread_start_t *)param;
+    free(param);
+    start.proc(start.arg);
+    return NULL;
+}
+
+int thread_create(thread_t *thread, thread_proc_t proc, void *arg)
+{
+    thread_start_t *start = malloc(sizeof(thread_start_t));
+    start->proc = proc;
+    start->arg = arg;
+    if (pthread_create(thread, NULL, thread_entry, start))
+    {
+        free(start);
+        return 1;
+    }
+    return 0;
+}
+
+void thread_join(thread_t thread)
+{ pthread_join(thread, NULL); }
+
+size_t thread_cpu_count()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count>0 ? (size_t)count : 1;
+}
+
+int atomic_cas_ptr(void *volatile *target, void *expected, void *desired)
+{ return __sync_bool_compare_and_swap(target, expected, desired); }
+
+void mutex_init(mutex_t *mutex)
+{ pthread_mutex_init(mutex, NULL); }
+
+void mutex_destroy(mutex_t *mutex)
+{ pthread_mutex_destroy(mutex); }
+
+void mutex_lock(mutex_t *mutex)
+{ pthread_mutex_lock(mutex); }
+
+void mutex_unlock(mutex_t *mutex)
+{ pthread_mutex_unlock(mutex); }
+
+void cond_init(cond_t *cond)
+{ pthread_cond_init(cond, NULL); }
+
+void cond_destroy(cond_t *cond)
+{ pthread_cond_destroy(cond); }
+
+void cond_wait(cond_t *cond, mutex_t *mutex)
+{ pthread_cond_wait(cond, mutex); }
+
+void cond_signal(cond_t *cond)
+{ pthread_cond_signal(cond); }
+
+void cond_broadcast(cond_t *cond)
+{ pthread_cond_broadcast(cond); }
+#endif
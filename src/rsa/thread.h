@@ -0,0 +1,55 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+// Minimal portable threading: Win32 threads or POSIX threads.
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#define THREAD_LOCAL __declspec(thread)
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#define THREAD_LOCAL __thread
+#endif
+
+typedef void (*thread_proc_t)(void *arg);
+
+// returns nonzero on failure
+int thread_create(thread_t *thread, thread_proc_t proc, void *arg);
+void thread_join(thread_t thread);
+
+// Work a thread does as it exits, such as releasing thread-local caches.
+// Hooks live in static storage and are never unregistered; all of them
+// run in every thread that registered one, however it was started.
+typedef struct thread_exit_hook
+{
+    void (*proc)();
+    void *volatile registered;
+    struct thread_exit_hook *next;
+} thread_exit_hook_t;
+
+// Register 'hook' and have the calling thread run the hooks when it
+// exits. Call it once per thread; a hook is only added the first time.
+void thread_at_exit(thread_exit_hook_t *hook);
+// number of logical processors available to this process
+size_t thread_cpu_count();
+
+// Store 'desired' in '*target' if it still holds 'expected', atomically.
+// returns nonzero if it did
+int atomic_cas_ptr(void *volatile *target, void *expected, void *desired);
+
+void mutex_init(mutex_t *mutex);
+void mutex_destroy(mutex_t *mutex);
+void mutex_lock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+
+void cond_init(cond_t *cond);
+void cond_destroy(cond_t *cond);
+void cond_wait(cond_t *cond, mutex_t *mutex);
+void cond_signal(cond_t *cond);
+void cond_broadcast(cond_t *cond);
@@ -0,0 +1,232 @@
+#include "config.h"
+#include "tune.h"
+#include "bigint.h"
+#include "cpu.h"
+#include "thread.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static tune_params_t *volatile current = NULL;
+
+void tune_defaults(tune_params_t *params)
+{
+    static const size_t window_bits[TUNE_WINDOW_COUNT] =
+        {6, 24, 80, 256, 768, SIZE_MAX};
+    memset(params, 0, sizeof(tune_params_t));
+    params->karatsuba_cutoff = BIGINT_KARATSUBA_CUTOFF;
+    params->ntt_cutoff = BIGINT_NTT_CUTOFF;
+    params->newton_cutoff = BIGINT_NEWTON_CUTOFF;
+    memcpy(params->window_bits, window_bits, sizeof(window_bits));
+}
+
+const tune_params_t *tune_params()
+{
+    tune_params_t *params = current;
+    if (params)
+        return params;
+    params = malloc(sizeof(tune_params_t));
+    tune_defaults(params);
+    char path[1024];
+    if (tune_default_path(path, sizeof(path)))
+        tune_load(path, params);
+    // a racing initializer got there first
+    if (!atomic_cas_ptr((void *volatile *)&current, NULL, params))
+    {
+        free(params);
+        params = current;
+    }
+    return params;
+}
+
+void tune_set(const tune_params_t *params)
+{
+    tune_params();
+    *current = *params;
+}
+
+size_t tune_window(size_t exp_bits)
+{
+    const tune_params_t *params = tune_params();
+    size_t window = 1;
+    while (window<=TUNE_WINDOW_COUNT &&
+        exp_bits>params->window_bits[window-1])
+    {
+        window++;
+    }
+    return window;
+}
+
+const char *tune_kernel(size_t size)
+{
+    const tune_params_t *params = tune_params();
+    for (size_t i = 0; i<params->kernel_count; i++)
+    {
+        if (params->kernels[i].size==size)
+            return params->kernels[i].name;
+    }
+    return NULL;
+}
+
+const char *tune_default_path(char *buf, size_t buf_size)
+{
+    const char *path = getenv("RSA_TUNE_FILE");
+    if (path)
+    {
+        // set but empty: no tuning file
+        if (!*path || strlen(path)>=buf_size)
+            return NULL;
+        strcpy(buf, path);
+        return buf;
+    }
+#ifdef _WIN32
+    const char *home = getenv("USERPROFILE");
+#else
+    const char *home = getenv("HOME");
+#endif
+    if (!home || !*home)
+        return NULL;
+    int len = snprintf(buf, buf_size, "%s/.rsa_tune", home);
+    return len>0 && (size_t)len<buf_size ? buf : NULL;
+}
+
+static int parse_size(const char *s, size_t *value)
+{
+    if (!strcmp(s, "never"))
+    {
+        *value = SIZE_MAX;
+        return 0;
+    }
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (end==s || *end || v>SIZE_MAX)
+        return 1;
+    *value = (size_t)v;
+    return 0;
+}
+
+static int parse_line(tune_params_t *params, const char *key,
+    const char *arg1, const char *arg2, unsigned *features)
+{
+    size_t a, b;
+    if (!strcmp(key, "cpu_features"))
+    {
+        if (!arg1 || parse_size(arg1, &a))
+            return 1;
+        *features = (unsigned)a;
+    }
+    else if (!strcmp(key, "karatsuba_cutoff"))
+        return !arg1 || parse_size(arg1, &params->karatsuba_cutoff);
+    else if (!strcmp(key, "ntt_cutoff"))
+        return !arg1 || parse_size(arg1, &params->ntt_cutoff);
+    else if (!strcmp(key, "newton_cutoff"))
+        return !arg1 || parse_size(arg1, &params->newton_cutoff);
+    else if (!strcmp(key, "window"))
+    {
+        if (!arg1 || !arg2 || parse_size(arg1, &a) || parse_size(arg2, &b) ||
+            a<2 || a>TUNE_WINDOW_COUNT+1)
+        {
+            return 1;
+        }
+        params->window_bits[a-2] = b;
+    }
+    else if (!strcmp(key, "kernel"))
+    {
+        if (!arg1 || !arg2 || parse_size(arg1, &a) ||
+            strlen(arg2)>=TUNE_NAME_SIZE ||
+            params->kernel_count==TUNE_MAX_KERNELS)
+        {
+            return 1;
+        }
+        tune_kernel_t *kernel = &params->kernels[params->kernel_count++];
+        kernel->size = a;
+        strcpy(kernel->name, arg2);
+    }
+    else if (!strcmp(key, "mb_kernel"))
+    {
+        if (!arg1 || strlen(arg1)>=TUNE_NAME_SIZE)
+            return 1;
+        strcpy(params->mb_kernel, arg1);
+    }
+    // unknown keys are left for newer versions
+    return 0;
+}
+
+int tune_load(const char *path, tune_params_t *params)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return TUNE_ERR_IO;
+    tune_params_t loaded = *params;
+    loaded.kernel_count = 0;
+    unsigned features = cpu_features();
+    int result = TUNE_OK;
+    char line[256];
+    while (result==TUNE_OK && fgets(line, sizeof(line), f))
+    {
+        char *key = strtok(line, " \t\r\n");
+        if (!key || *key=='#')
+            continue;
+        char *arg1 = strtok(NULL, " \t\r\n");
+        char *arg2 = strtok(NULL, " \t\r\n");
+        if (parse_line(&loaded, key, arg1, arg2, &features))
+            result = TUNE_ERR_FORMAT;
+    }
+    if (ferror(f))
+        result = TUNE_ERR_IO;
+    fclose(f);
+    for (size_t i = 1; i<TUNE_WINDOW_COUNT && result==TUNE_OK; i++)
+    {
+        if (loaded.window_bits[i]<loaded.window_bits[i-1])
+            result = TUNE_ERR_FORMAT;
+    }
+    if (result==TUNE_OK && (!loaded.karatsuba_cutoff ||
+        !loaded.ntt_cutoff || !loaded.newton_cutoff))
+    {
+        result = TUNE_ERR_FORMAT;
+    }
+    if (result==TUNE_OK && features!=cpu_features())
+        result = TUNE_ERR_CPU;
+    if (result==TUNE_OK)
+        *params = loaded;
+    return result;
+}
+
+static void print_size(FILE *f, size_t value)
+{
+    if (value==SIZE_MAX)
+        fputs("never", f);
+    else
+        fprintf(f, "%zu", value);
+}
+
+int tune_save(const char *path, const tune_params_t *params)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return TUNE_ERR_IO;
+    fputs("# written by 'rsa tune'\n", f);
+    fprintf(f, "cpu_features %u\n", cpu_features());
+    fputs("karatsuba_cutoff ", f);
+    print_size(f, params->karatsuba_cutoff);
+    fputs("\nntt_cutoff ", f);
+    print_size(f, params->ntt_cutoff);
+    fputs("\nnewton_cutoff ", f);
+    print_size(f, params->newton_cutoff);
+    fputc('\n', f);
+    for (size_t i = 0; i<TUNE_WINDOW_COUNT; i++)
+    {
+        fprintf(f, "window %zu ", i+2);
+        print_size(f, params->window_bits[i]);
+        fputc('\n', f);
+    }
+    for (size_t i = 0; i<params->kernel_count; i++)
+    {
+        fprintf(f, "kernel %zu %s\n", params->kernels[i].size,
+            params->kernels[i].name);
+    }
+    if (*params->mb_kernel)
+        fprintf(f, "mb_kernel %s\n", params->mb_kernel);
+    int failed = ferror(f);
+    return fclose(f) || failed ? TUNE_ERR_IO : TUNE_OK;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+// Machine-dependent choices of the bigint core: the limb counts where
+// multiplication and division switch algorithms, the exponent window
+// widths and the Montgomery kernels per modulus size. The compiled-in
+// defaults are measured on one machine; 'rsa tune' measures the current
+// one and writes a tuning file, which the library reads on first use from
+// $RSA_TUNE_FILE, or ~/.rsa_tune. A file written on a CPU with different
+// instruction set extensions is ignored, so one file can't mistune a
+// mixed fleet.
+
+enum
+{
+    TUNE_OK = 0,
+    TUNE_ERR_IO = -1,
+    TUNE_ERR_FORMAT = -2,
+    TUNE_ERR_CPU = -3 // measured on a CPU with other features
+};
+
+// window widths 2 to TUNE_WINDOW_COUNT+1 bits
+#define TUNE_WINDOW_COUNT 6
+#define TUNE_MAX_KERNELS 16
+#define TUNE_NAME_SIZE 16
+
+typedef struct
+{
+    size_t size; // modulus limbs
+    char name[TUNE_NAME_SIZE];
+} tune_kernel_t;
+
+typedef struct
+{
+    // limbs of the smaller factor from which bigint_mul() uses Karatsuba,
+    // then the NTT
+    size_t karatsuba_cutoff;
+    size_t ntt_cutoff;
+    // limbs of divisor and quotient from which bigint_div() uses a Newton
+    // reciprocal
+    size_t newton_cutoff;
+    // exponents of more than window_bits[i] bits take windows of i+2 bits
+    size_t window_bits[TUNE_WINDOW_COUNT];
+    // bigint_fixed.h kernel by modulus size, the default one for others
+    tune_kernel_t kernels[TUNE_MAX_KERNELS];
+    size_t kernel_count;
+    char mb_kernel[TUNE_NAME_SIZE]; // bigint_mb.h kernel, empty: default
+} tune_params_t;
+
+void tune_defaults(tune_params_t *params);
+// parameters in effect; the first call loads the tuning file, if any
+const tune_params_t *tune_params();
+// Replace the parameters in effect. Not synchronized with other threads
+// using the bigint core.
+void tune_set(const tune_params_t *params);
+// exponent window width in bits for an 'exp_bits'-bit exponent
+size_t tune_window(size_t exp_bits);
+// kernel name chosen for a 'size'-limb modulus, NULL if none
+const char *tune_kernel(size_t size);
+
+// returns the tuning file path in 'buf', NULL if there is none
+const char *tune_default_path(char *buf, size_t buf_size);
+// 'params' is left untouched unless the whole file is valid
+int tune_load(const char *path, tune_params_t *params);
+int tune_save(const char *path, const tune_params_t *params);
@@ -0,0 +1,419 @@
+#include "config.h"
+#include "tuner.h"
+#include "tune.h"
+#include "bigint.h"
+#include "bigint_fixed.h"
+#include "bigint_mb.h"
+#include "cpu.h"
+#include "rnd.h"
+#include "rsa.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <time.h>
+#else
+#include <windows.h>
+#endif
+
+// every measurement is the best of a few rounds of repeated calls
+#define TUNER_ROUNDS 3
+#define TUNER_MIN_SECONDS 0.01
+// modulus size for the window sweep
+#define TUNER_WINDOW_LIMBS 64
+
+typedef struct
+{
+    tune_params_t params; // choices so far
+    rnd_t rnd;
+} tuner_t;
+
+// operands of one timed call
+typedef struct
+{
+    bigint_t *a, *b, *q, *r;
+    rsa_ctx_t *ctx;
+    uint8_t *block;
+    const bigint_fixed_kernel_t *kernel;
+    const bigint_mb_kernel_t *mb;
+    bigint_mont_t *mont;
+    uint32_t *x, *y, *z, *t;
+    uint64_t *mb_x, *mb_y, *mb_t;
+} tuner_job_t;
+
+typedef void (*tuner_op_t)(tuner_job_t *job);
+// seconds per call of the method before the cutoff, or of the one after
+// it if 'use' is set, on 'size'-limb operands
+typedef double (*tuner_cmp_t)(tuner_t *tuner, size_t size, int use);
+
+static double now_seconds()
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart/freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+#endif
+}
+
+// seconds per call
+static double time_op(tuner_op_t op, tuner_job_t *job)
+{
+    double best = 0;
+    for (int round = 0; round<TUNER_ROUNDS; round++)
+    {
+        size_t calls = 0;
+        double start = now_seconds(), elapsed;
+        do
+        {
+            op(job);
+            calls++;
+            elapsed = now_seconds()-start;
+        } while (elapsed<TUNER_MIN_SECONDS);
+        if (!round || elapsed/calls<best)
+            best = elapsed/calls;
+    }
+    return best;
+}
+
+// random 'size'-limb number with the top bit set
+static bigint_t *random_bigint(tuner_t *tuner, size_t size)
+{
+    bigint_t *b = bigint_alloc_reserve(size);
+    rnd_bytes(&tuner->rnd, (uint8_t *)b->data, size*sizeof(uint32_t));
+    b->data[size-1] |= 0x80000000;
+    b->size = size;
+    return b;
+}
+
+static void random_limbs(tuner_t *tuner, uint32_t *x, size_t size)
+{
+    rnd_bytes(&tuner->rnd, (uint8_t *)x, size*sizeof(uint32_t));
+    // below any modulus with the top bit set
+    x[size-1] >>= 1;
+}
+
+static void op_mul(tuner_job_t *job)
+{ bigint_mul(job->r, job->a, job->b); }
+
+static void op_div(tuner_job_t *job)
+{ bigint_div(job->q, job->r, job->a, job->b); }
+
+static void op_transform(tuner_job_t *job)
+{ rsa_transform_ctx(job->ctx, job->block, job->block); }
+
+static void op_kernel(tuner_job_t *job)
+{
+    job->kernel->mul(job->mont, job->z, job->x, job->y, job->t);
+    job->kernel->sqr(job->mont, job->z, job->z, job->t);
+}
+
+static void op_mb(tuner_job_t *job)
+{ job->mb->mul(job->mont, job->mb_x, job->mb_x, job->mb_y, job->mb_t); }
+
+static double time_mul(tuner_t *tuner, size_t size, size_t karatsuba_cutoff,
+    size_t ntt_cutoff)
+{
+    tune_params_t params = tuner->params;
+    params.karatsuba_cutoff = karatsuba_cutoff;
+    params.ntt_cutoff = ntt_cutoff;
+    tune_set(&params);
+    tuner_job_t job;
+    job.a = random_bigint(tuner, size);
+    job.b = random_bigint(tuner, size);
+    job.r = bigint_alloc_reserve(2*size);
+    double seconds = time_op(op_mul, &job);
+    bigint_free(job.a);
+    bigint_free(job.b);
+    bigint_free(job.r);
+    return seconds;
+}
+
+// A cutoff right at the size runs one level of Karatsuba, the smaller
+// products below it stay schoolbook.
+static double cmp_karatsuba(tuner_t *tuner, size_t size, int use)
+{ return time_mul(tuner, size, use ? size : SIZE_MAX, SIZE_MAX); }
+
+// Karatsuba all the way down against the NTT
+static double cmp_ntt(tuner_t *tuner, size_t size, int use)
+{
+    return time_mul(tuner, size, tuner->params.karatsuba_cutoff,
+        use ? size : SIZE_MAX);
+}
+
+// one Newton level over long division, like cmp_karatsuba()
+static double cmp_newton(tuner_t *tuner, size_t size, int use)
+{
+    tune_params_t params = tuner->params;
+    params.newton_cutoff = use ? size : SIZE_MAX;
+    tune_set(&params);
+    tuner_job_t job;
+    job.a = random_bigint(tuner, 2*size);
+    job.b = random_bigint(tuner, size);
+    job.q = bigint_alloc_reserve(size+1);
+    job.r = bigint_alloc_reserve(size);
+    double seconds = time_op(op_div, &job);
+    bigint_free(job.a);
+    bigint_free(job.b);
+    bigint_free(job.q);
+    bigint_free(job.r);
+    return seconds;
+}
+
+// Smallest of the 'sizes' from which the method after the cutoff wins
+// at that size and the next one, which keeps a single noisy sample from
+// moving it; SIZE_MAX ("never") if it doesn't win like that anywhere in
+// the measured range.
+static size_t find_cutoff(tuner_t *tuner, const char *name,
+    const size_t *sizes, size_t count, tuner_cmp_t cmp)
+{
+    printf("%s:\n", name);
+    size_t cutoff = SIZE_MAX;
+    int won = 0;
+    for (size_t i = 0; i<count; i++)
+    {
+        double before = cmp(tuner, sizes[i], 0);
+        double after = cmp(tuner, sizes[i], 1);
+        printf("  %5zu limbs %10.2f us %10.2f us\n", sizes[i], before*1e6,
+            after*1e6);
+        if (after<before)
+        {
+            if (won || i==count-1)
+            {
+                cutoff = sizes[i-won];
+                break;
+            }
+            won = 1;
+        }
+        else
+            won = 0;
+    }
+    if (cutoff==SIZE_MAX)
+        puts("  cutoff never");
+    else
+        printf("  cutoff %zu limbs\n", cutoff);
+    return cutoff;
+}
+
+static double time_window(tuner_t *tuner, bigint_t *n, bigint_t *exp,
+    size_t window)
+{
+    tune_params_t params = tuner->params;
+    for (size_t i = 0; i<TUNE_WINDOW_COUNT; i++)
+        params.window_bits[i] = i+2<=window ? 0 : SIZE_MAX;
+    tune_set(&params);
+    rsa_ctx_t ctx;
+    if (rsa_ctx_init(&ctx, exp, n))
+        return 0;
+    tuner_job_t job;
+    job.ctx = &ctx;
+    job.block = malloc(ctx.block_size);
+    rnd_bytes(&tuner->rnd, job.block, ctx.block_size);
+    job.block[ctx.block_size-1] = 0;
+    double seconds = time_op(op_transform, &job);
+    free(job.block);
+    rsa_ctx_free(&ctx);
+    return seconds;
+}
+
+// Best width for every exponent size, made non-decreasing, then every
+// width starts halfway between the last size it lost and the first it
+// won.
+static void tune_windows(tuner_t *tuner)
+{
+    static const size_t exp_bits[] = {8, 16, 24, 32, 48, 64, 96, 128, 192,
+        256, 384, 512, 768, 1024, 1536, 2048};
+    size_t count = sizeof(exp_bits)/sizeof(exp_bits[0]);
+    size_t best[sizeof(exp_bits)/sizeof(exp_bits[0])];
+    bigint_t *n = random_bigint(tuner, TUNER_WINDOW_LIMBS);
+    n->data[0] |= 1;
+    puts("exponent windows:");
+    for (size_t i = 0; i<count; i++)
+    {
+        bigint_t *exp = random_bigint(tuner, (exp_bits[i]+31)/32);
+        if (exp_bits[i]%32)
+            exp->data[exp->size-1] >>= 32-exp_bits[i]%32;
+        double best_seconds = 0;
+        best[i] = 1;
+        for (size_t w = 1; w<=TUNE_WINDOW_COUNT+1 && w<=exp_bits[i]; w++)
+        {
+            double seconds = time_window(tuner, n, exp, w);
+            if (w==1 || seconds<best_seconds)
+            {
+                best_seconds = seconds;
+                best[i] = w;
+            }
+        }
+        if (i && best[i]<best[i-1])
+            best[i] = best[i-1];
+        printf("  %5zu bits %zu-bit windows %10.2f us\n", exp_bits[i],
+            best[i], best_seconds*1e6);
+        bigint_free(exp);
+    }
+    bigint_free(n);
+    for (size_t w = 2; w<=TUNE_WINDOW_COUNT+1; w++)
+    {
+        size_t i = 0;
+        while (i<count && best[i]<w)
+            i++;
+        size_t bits = i==count ? SIZE_MAX :
+            i ? (exp_bits[i-1]+exp_bits[i])/2 : 0;
+        tuner->params.window_bits[w-2] = bits;
+        if (bits!=SIZE_MAX)
+            printf("  %zu-bit windows over %zu bits\n", w, bits);
+    }
+}
+
+static double time_kernel(tuner_t *tuner, bigint_mont_t *mont,
+    const bigint_fixed_kernel_t *kernel)
+{
+    size_t s = mont->size;
+    tuner_job_t job;
+    job.kernel = kernel;
+    job.mont = mont;
+    job.x = bigint_mem_alloc(5*(s+1)*sizeof(uint32_t));
+    job.y = job.x+s;
+    job.z = job.y+s;
+    job.t = job.z+s;
+    random_limbs(tuner, job.x, s);
+    random_limbs(tuner, job.y, s);
+    double seconds = time_op(op_kernel, &job);
+    bigint_mem_free(job.x);
+    return seconds;
+}
+
+static void tune_kernels(tuner_t *tuner)
+{
+    static const size_t sizes[] = {16, 32, 48, 64, 96, 128};
+    puts("montgomery kernels:");
+    tune_set(&tuner->params);
+    tuner->params.kernel_count = 0;
+    for (size_t i = 0; i<sizeof(sizes)/sizeof(sizes[0]); i++)
+    {
+        const bigint_fixed_kernel_t *kernels[BIGINT_FIXED_MAX_CANDIDATES];
+        size_t count = bigint_fixed_candidates(sizes[i], cpu_features(),
+            kernels);
+        if (count<2)
+            continue;
+        bigint_t *n = random_bigint(tuner, sizes[i]);
+        n->data[0] |= 1;
+        bigint_mont_t mont;
+        bigint_mont_init(&mont, n);
+        size_t best = 0;
+        double best_seconds = 0;
+        printf("  %5zu limbs", sizes[i]);
+        for (size_t k = 0; k<count; k++)
+        {
+            double seconds = time_kernel(tuner, &mont, kernels[k]);
+            printf(" %s %.2f us", kernels[k]->name, seconds*1e6);
+            if (!k || seconds<best_seconds)
+            {
+                best_seconds = seconds;
+                best = k;
+            }
+        }
+        printf(" -> %s\n", kernels[best]->name);
+        tune_kernel_t *entry =
+            &tuner->params.kernels[tuner->params.kernel_count++];
+        entry->size = sizes[i];
+        strcpy(entry->name, kernels[best]->name);
+        bigint_mont_free(&mont);
+        bigint_free(n);
+    }
+}
+
+static void tune_mb(tuner_t *tuner)
+{
+    const bigint_mb_kernel_t *kernels[BIGINT_MB_MAX_CANDIDATES];
+    size_t count = bigint_mb_candidates(cpu_features(), kernels);
+    size_t s = TUNER_WINDOW_LIMBS/2;
+    bigint_t *n = random_bigint(tuner, s);
+    n->data[0] |= 1;
+    bigint_mont_t mont;
+    bigint_mont_init(&mont, n);
+    size_t best = 0;
+    double best_seconds = 0;
+    printf("multi-buffer kernels:\n  %5zu limbs", s);
+    for (size_t k = 0; k<count; k++)
+    {
+        size_t lanes = kernels[k]->lanes;
+        tuner_job_t job;
+        job.mb = kernels[k];
+        job.mont = &mont;
+        job.mb_x = bigint_mem_alloc((3*s+2)*lanes*sizeof(uint64_t));
+        job.mb_y = job.mb_x+s*lanes;
+        job.mb_t = job.mb_y+s*lanes;
+        uint32_t *limbs = bigint_mem_alloc(s*sizeof(uint32_t));
+        for (size_t l = 0; l<lanes; l++)
+        {
+            random_limbs(tuner, limbs, s);
+            for (size_t j = 0; j<s; j++)
+                job.mb_x[j*lanes+l] = limbs[j];
+            random_limbs(tuner, limbs, s);
+            for (size_t j = 0; j<s; j++)
+                job.mb_y[j*lanes+l] = limbs[j];
+        }
+        double seconds = time_op(op_mb, &job)/lanes;
+        printf(" %s %.2f us", kernels[k]->name, seconds*1e6);
+        if (!k || seconds<best_seconds)
+        {
+            best_seconds = seconds;
+            best = k;
+        }
+        bigint_mem_free(limbs);
+        bigint_mem_free(job.mb_x);
+    }
+    printf(" per lane -> %s\n", kernels[best]->name);
+    strcpy(tuner->params.mb_kernel, kernels[best]->name);
+    bigint_mont_free(&mont);
+    bigint_free(n);
+}
+
+int tuner_run(const char *path)
+{
+    static const size_t karatsuba_sizes[] = {8, 12, 16, 24, 32, 40, 48,
+        64, 96, 128, 192};
+    static const size_t ntt_sizes[] = {512, 768, 1024, 1536, 2048, 3072,
+        4096, 6144, 8192};
+    static const size_t newton_sizes[] = {128, 256, 384, 512, 768, 1024,
+        1536, 2048, 3072, 4096};
+    char default_path[1024];
+    if (!path)
+        path = tune_default_path(default_path, sizeof(default_path));
+    if (!path)
+    {
+        puts("no tuning file path, set RSA_TUNE_FILE.");
+        return 1;
+    }
+    tuner_t tuner;
+    if (rnd_init(&tuner.rnd))
+    {
+        puts("can't initialize random number generator.");
+        return 1;
+    }
+    // measure from the compiled-in defaults, not an older file
+    tune_defaults(&tuner.params);
+    tuner.params.karatsuba_cutoff = find_cutoff(&tuner,
+        "schoolbook / karatsuba", karatsuba_sizes,
+        sizeof(karatsuba_sizes)/sizeof(karatsuba_sizes[0]), cmp_karatsuba);
+    tuner.params.ntt_cutoff = find_cutoff(&tuner, "karatsuba / ntt",
+        ntt_sizes, sizeof(ntt_sizes)/sizeof(ntt_sizes[0]), cmp_ntt);
+    tuner.params.newton_cutoff = find_cutoff(&tuner, "long division / newton",
+        newton_sizes, sizeof(newton_sizes)/sizeof(newton_sizes[0]),
+        cmp_newton);
+    tune_windows(&tuner);
+    tune_kernels(&tuner);
+    tune_mb(&tuner);
+    tune_set(&tuner.params);
+    if (tune_save(path, &tuner.params))
+    {
+        printf("can't write %s.\n", path);
+        return 1;
+    }
+    printf("written to %s\n", path);
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "config.h"
+#include "common.h"
+
+// 'rsa tune': measures the bigint core on this machine and writes the
+// tuning file read by tune.h. Every crossover is found by timing both
+// sides of it, one algorithm level at a time, on random operands:
+// schoolbook against one Karatsuba split, Karatsuba against the NTT,
+// long division against one Newton level, every window width for a
+// range of exponent sizes, and every usable Montgomery kernel.
+
+// Tune and write the result to 'path', or the default tuning file if
+// NULL. returns nonzero on failure
+int tuner_run(const char *path);